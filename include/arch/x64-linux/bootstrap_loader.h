@@ -2,5 +2,6 @@
 #define __BOOTSTRAP_H__
 
 struct java_class * hb_load_class (const char * path);
+int hb_loader_init (int nr_threads);
 
 #endif
@@ -0,0 +1,12 @@
+#ifndef __CDS_H__
+#define __CDS_H__
+
+struct java_class;
+
+int hb_cds_open (const char * path);
+int hb_cds_dump_at_exit (const char * path);
+
+struct java_class * hb_cds_find (const char * file);
+void hb_cds_record (const char * file, struct java_class * cls);
+
+#endif
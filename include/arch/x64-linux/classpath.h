@@ -0,0 +1,10 @@
+#ifndef __CLASSPATH_H__
+#define __CLASSPATH_H__
+
+#include <types.h>
+
+int hb_classpath_init (const char * classpath);
+u1 * hb_classpath_open (const char * file);
+int hb_classpath_stamp (const char * file, u8 * mtime, u8 * size);
+
+#endif
@@ -30,7 +30,7 @@
 #define ESHOULD_BRANCH 3
 #define ETHREAD_DEATH  4
 
-int hb_invoke_ctor (struct obj_ref * oref);
+int hb_invoke_ctor (struct native_object * oref);
 int hb_exec(jthread_t * t);
 
 
@@ -18,6 +18,8 @@
 #include <types.h>
 #include <constants.h>
 #include <hawkbeans.h>
+#include <metaspace.h>
+#include <symbol.h>
 
 #if DEBUG_CLASS == 1
 #define CL_DEBUG(fmt, args...) HB_DEBUG(fmt, ##args)
@@ -58,15 +60,14 @@
 #endif
 
 
-enum ref_types {
-	OBJ_OBJ,
-	OBJ_ARRAY,
-};
+struct native_object;
 
-typedef struct obj_ref {
-	u8 heap_ptr;
-	u1 type;
-} obj_ref_t;
+/* 
+ * A reference is a direct pointer to the object's header
+ * on the heap. Whether it's an array or not is recorded
+ * in the header flags.
+ */
+typedef struct native_object obj_ref_t;
 
 typedef union variable {
 
@@ -77,7 +78,7 @@ typedef union variable {
 	f4 float_val;
 	d8 dbl_val;
 	u8 ptr_val;
-	struct obj_ref * obj;
+	struct native_object * obj;
 } var_t;
 
 typedef struct const_pool_info {
@@ -118,6 +119,14 @@ typedef struct method_info {
 
 	struct java_class * owner;
 	code_attr_t * code_attr;
+
+	// GC stack maps (see stackmap.h), NULL if we couldn't build them
+	u2 * map_depth;
+	u1 * map_bits;
+	u2 map_stride;
+
+	// allocation site ids by pc (see gc_alloc_site())
+	u4 * alloc_sites;
 	
 } method_info_t;
 
@@ -129,6 +138,11 @@ typedef struct field_info {
 
 	attr_info_t * attrs;
 
+	// T_* type from the descriptor, and (for instance 
+	// fields) the byte offset of the field in the object
+	u1 type;
+	u4 offset;
+
 	// these only apply to static fields
 	struct java_class * owner;
 	const_pool_info_t * cpe;
@@ -168,8 +182,28 @@ typedef struct java_class {
 
 	var_t * field_vals;
 
+	/* 
+	 * instance layout, shared by all objects of this class. 
+	 * inst_field_infos lists every instance field (superclass
+	 * fields first), each of which records its own offset.
+	 * ref_offsets lists the offsets of the ones the GC has
+	 * to trace.
+	 */
+	u2 inst_field_count;
+	field_info_t ** inst_field_infos;
+	u4 inst_size;
+	u2 ref_count;
+	u4 * ref_offsets;
+	struct native_object * inst_template;
+
+	// cached at prep so we don't have to look it up by name
+	struct java_class * super_cls;
+
 	const char * name;
 
+	// everything above that we allocated lives here (see metaspace.c)
+	metaspace_t meta;
+
 } java_class_t;
 
 
@@ -178,40 +212,216 @@ typedef struct java_class {
 
 typedef struct native_object {
 
-	/* these are unused if this is allocated */
-	u2 order;
-
-	struct list_head link; // for free list accounting
-
 	java_class_t * class;
 
 	union {
 
-		u2 val;
+		u8 val;
 
 		struct _obj {
 			u1 isarray  : 1;
 			u1 gc_mark  : 1;
-			u2 pad      : 14;
-		} obj __attribute__((packed));
+			u1 pad      : 5;
+			u1 survived : 1; // made it through a collection
+			u1 site[3];      // where it was allocated (see gc_alloc_site())
+			u1 pad2[4];
+		} obj;
 
 		struct _arr {
 			u1 isarray  : 1;
 			u1 gc_mark  : 1;
 			u1 type     : 5;
-			u2 length   : 9;
+			u1 survived : 1;
+			u1 site[3];
+			i4 length;
 		} array __attribute__((packed));
 
 	} flags __attribute__((packed));
 
-	u2 field_count;
+	// instance vars (or array elements) follow the header
+	var_t fields[0];
 
-	var_t * fields;
+} native_obj_t;
 
-	// used to cross-check during field resolution
-	field_info_t ** field_infos;
+/* 
+ * Array elements are stored densely at their natural
+ * width right after the header, e.g. a char[] element
+ * is HB_ARRAY_ELEMS(arr, u2)[i]
+ */
+#define HB_ARRAY_ELEMS(obj, ctype) ((ctype*)(obj)->fields)
 
-} native_obj_t;
+/* 
+ * Instance fields are packed by width, each at the
+ * offset recorded in its field_info
+ */
+#define HB_FIELD_PTR(obj, off, ctype) ((ctype*)((u1*)(obj)->fields + (off)))
+
+/*
+ * A reference as it's stored in the heap, i.e. in a reference
+ * field or a T_REF array element. With HB_COMPRESSED_REFS this is
+ * the distance from hb_ref_base in HB_REF_SHIFT-sized granules,
+ * which reaches 64GB. hb_ref_base sits one granule below the heap
+ * so that 0 stays null. References everywhere else (locals, operand
+ * stacks, statics, var_t) are plain pointers, so every heap slot
+ * has to go through hb_load_ref()/hb_store_ref().
+ */
+#if HB_COMPRESSED_REFS == 1
+
+#define HB_REF_SHIFT 4 // must match HB_OBJ_ALIGN
+#define HB_REF_REACH (1UL << (32 + HB_REF_SHIFT))
+
+typedef u4 hb_ref_t;
+
+extern u8 hb_ref_base;
+
+static inline obj_ref_t *
+hb_decode_ref (hb_ref_t ref)
+{
+	return ref ? (obj_ref_t*)(hb_ref_base + ((u8)ref << HB_REF_SHIFT)) : NULL;
+}
+
+static inline hb_ref_t
+hb_encode_ref (obj_ref_t * ref)
+{
+	return ref ? (hb_ref_t)(((u8)ref - hb_ref_base) >> HB_REF_SHIFT) : 0;
+}
+
+#else
+
+typedef obj_ref_t * hb_ref_t;
+
+static inline obj_ref_t *
+hb_decode_ref (hb_ref_t ref)
+{
+	return ref;
+}
+
+static inline hb_ref_t
+hb_encode_ref (obj_ref_t * ref)
+{
+	return ref;
+}
+
+#endif
+
+static inline obj_ref_t *
+hb_load_ref (hb_ref_t * slot)
+{
+	return hb_decode_ref(*slot);
+}
+
+static inline void
+hb_store_ref (hb_ref_t * slot, obj_ref_t * ref)
+{
+	*slot = hb_encode_ref(ref);
+}
+
+/* the site an object was allocated at (see gc_alloc_site()), 0 if unknown */
+static inline u4
+hb_obj_site (native_obj_t * obj)
+{
+	u1 * site = obj->flags.obj.site;
+	return site[0] | (site[1] << 8) | (site[2] << 16);
+}
+
+static inline void
+hb_set_obj_site (native_obj_t * obj, u4 site)
+{
+	obj->flags.obj.site[0] = site;
+	obj->flags.obj.site[1] = site >> 8;
+	obj->flags.obj.site[2] = site >> 16;
+}
+
+/* size of a value of the given type (T_*) in an object or array */
+static inline u1
+hb_type_size (u1 type)
+{
+	switch (type) {
+		case T_BOOLEAN:
+		case T_BYTE:
+			return 1;
+		case T_CHAR:
+		case T_SHORT:
+			return 2;
+		case T_FLOAT:
+		case T_INT:
+			return 4;
+		case T_REF:
+			return sizeof(hb_ref_t);
+		default:
+			return 8;
+	}
+}
+
+
+static inline var_t
+hb_get_field (native_obj_t * obj, field_info_t * fi)
+{
+	var_t v;
+
+	switch (fi->type) {
+		case T_BOOLEAN:
+		case T_BYTE:
+			v.int_val = *HB_FIELD_PTR(obj, fi->offset, i1);
+			break;
+		case T_CHAR:
+			v.int_val = *HB_FIELD_PTR(obj, fi->offset, u2);
+			break;
+		case T_SHORT:
+			v.int_val = *HB_FIELD_PTR(obj, fi->offset, i2);
+			break;
+		case T_INT:
+			v.int_val = *HB_FIELD_PTR(obj, fi->offset, u4);
+			break;
+		case T_FLOAT:
+			v.float_val = *HB_FIELD_PTR(obj, fi->offset, f4);
+			break;
+		case T_LONG:
+			v.long_val = *HB_FIELD_PTR(obj, fi->offset, u8);
+			break;
+		case T_DOUBLE:
+			v.dbl_val = *HB_FIELD_PTR(obj, fi->offset, d8);
+			break;
+		default:
+			v.obj = hb_load_ref(HB_FIELD_PTR(obj, fi->offset, hb_ref_t));
+			break;
+	}
+
+	return v;
+}
+
+
+static inline void
+hb_set_field (native_obj_t * obj, field_info_t * fi, var_t v)
+{
+	switch (fi->type) {
+		case T_BOOLEAN:
+		case T_BYTE:
+			*HB_FIELD_PTR(obj, fi->offset, i1) = (i1)v.int_val;
+			break;
+		case T_CHAR:
+			*HB_FIELD_PTR(obj, fi->offset, u2) = (u2)v.int_val;
+			break;
+		case T_SHORT:
+			*HB_FIELD_PTR(obj, fi->offset, i2) = (i2)v.int_val;
+			break;
+		case T_INT:
+			*HB_FIELD_PTR(obj, fi->offset, u4) = v.int_val;
+			break;
+		case T_FLOAT:
+			*HB_FIELD_PTR(obj, fi->offset, f4) = v.float_val;
+			break;
+		case T_LONG:
+			*HB_FIELD_PTR(obj, fi->offset, u8) = v.long_val;
+			break;
+		case T_DOUBLE:
+			*HB_FIELD_PTR(obj, fi->offset, d8) = v.dbl_val;
+			break;
+		default:
+			hb_store_ref(HB_FIELD_PTR(obj, fi->offset, hb_ref_t), v.obj);
+			break;
+	}
+}
 
 
 const char * hb_get_const_str(u2 idx, struct java_class * cls);
@@ -243,10 +453,7 @@ int hb_class_is_loaded(const char * class_nm);
 void hb_add_class (const char * class_nm, java_class_t * cls);
 java_class_t * hb_get_class (const char * class_nm);
 java_class_t * hb_get_or_load_class (const char * class_nm);
-
-/* instance variables */
-int hb_setup_obj_fields (native_obj_t * obj, java_class_t * cls);
-int hb_get_obj_field_count (java_class_t * cls);
+java_class_t * hb_get_or_load_class_sym (const char * class_nm);
 
 /* supers */
 const char * hb_get_super_class_nm (java_class_t * cls);
@@ -22,6 +22,13 @@
 #define DEBUG_NATIVE 0 // native methods
 #define DEBUG_THREAD 0 // threads
 #define DEBUG_STACK  0 // stack frames etc
+#define DEBUG_STACKMAP 0 // GC stack maps
+
+/*
+ * store references in the heap as 32-bit offsets
+ * (see hb_ref_t in class.h) instead of full pointers
+ */
+#define HB_COMPRESSED_REFS 1
 
 
 
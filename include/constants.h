@@ -93,7 +93,7 @@ typedef struct CONSTANT_NameAndType_info {
 typedef struct CONSTANT_Utf8_info {
 	u1 tag;
 	u2 len;
-	u1 bytes[0];
+	u1 * bytes; // an interned symbol (see symbol.c)
 } CONSTANT_Utf8_info_t;
 
 typedef struct CONSTANT_MethodHandle_info {
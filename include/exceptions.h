@@ -43,7 +43,7 @@
 
 
 void hb_throw_and_create_excp (u1 type);
-void hb_throw_exception (struct obj_ref * eref);
+void hb_throw_exception (struct native_object * eref);
 
 
 #endif
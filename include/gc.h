@@ -15,6 +15,8 @@
 #ifndef __GC_H__
 #define __GC_H__
 
+#include <pthread.h>
+
 #include <hawkbeans.h>
 
 #if DEBUG_GC == 1
@@ -23,67 +25,374 @@
 #define GC_DEBUG(fmt, args...)
 #endif
 
-/* GC will run every 20 ms or so */
-#define GC_DEFAULT_INTERVAL 20
+/* 
+ * Trigger policy. We start a collection when the heap will be more 
+ * than GC_TRIGGER_OCCUPANCY percent full by the time the cycle is 
+ * done, going by the allocation rate, which we sample at least 
+ * GC_POLICY_TICK_US apart, looking at the clock every GC_POLICY_CHECK 
+ * safepoints. At least GC_MIN_ALLOC percent of the heap gets allocated 
+ * between collections, and if the GC is already taking more than 
+ * GC_GROW_OVERHEAD percent of the run time, we don't start early. The 
+ * large object space is collected once half of what was free after 
+ * the last collection is used up.
+ */
+#define GC_TRIGGER_OCCUPANCY 80
+#define GC_MIN_ALLOC         10
+#define GC_POLICY_TICK_US    1000
+#define GC_POLICY_CHECK      256
 
-struct nk_hashtable;
-struct jthread;
+/* 
+ * Heap sizing policy. After each collection we grow the heap if 
+ * it is more than GC_GROW_OCCUPANCY percent full or if we spent more 
+ * than GC_GROW_OVERHEAD percent of our time collecting. If it stays 
+ * below GC_SHRINK_OCCUPANCY percent for GC_SHRINK_CYCLES collections 
+ * in a row we give memory back. Either way we aim for 
+ * GC_TARGET_OCCUPANCY percent.
+ */
+#define GC_GROW_OCCUPANCY   70
+#define GC_GROW_OVERHEAD    10
+#define GC_TARGET_OCCUPANCY 50
+#define GC_SHRINK_OCCUPANCY 20
+#define GC_SHRINK_CYCLES    8
+
+/* 
+ * Marking can be spread over several threads (--gc-threads), 
+ * the thread that triggered the collection is one of them
+ */
+#define GC_DEFAULT_THREADS 1
+#define GC_MAX_THREADS     64
 
-typedef enum ref_state {
-	GC_REF_ABSENT,
-	GC_REF_PRESENT,
-} ref_state_t; 
+/* initial number of entries in a mark deque, they grow as needed */
+#define GC_DEQUE_INIT 256
 
-/* this may have more info soon */
-typedef struct ref_entry {
-	ref_state_t state;
-} ref_entry_t;
+/* collector modes */
+#define GC_MODE_STW        0 // everything happens in one pause
+#define GC_MODE_CONCURRENT 1 // marking runs alongside the mutator
+#define GC_MODE_INCREMENTAL 2 // marking and sweeping happen a slice at a time
+#define GC_MODE_REGIONS     3 // like STW, but we also evacuate the emptiest regions
 
-typedef struct gc_ref_tbl {
-	struct nk_hashtable * htable;
-} gc_ref_tbl_t;
+/* 
+ * In incremental mode, each slice runs until it uses up the pause 
+ * target (--gc-pause-target-us), and the mutator then gets at least 
+ * as long before the next one. We look at the clock every 
+ * GC_SLICE_CHECK objects.
+ */
+#define GC_DEFAULT_PAUSE_TARGET_US 1000
+#define GC_SLICE_CHECK             64
+
+/* 
+ * In region mode, only regions with less than GC_EVAC_LIVE percent
+ * live data are evacuated, emptiest first, and only as many as we
+ * think we can copy within the pause target. We start out guessing 
+ * that we copy GC_EVAC_DEFAULT_RATE bytes per us, then measure it.
+ */
+#define GC_EVAC_LIVE         50
+#define GC_EVAC_DEFAULT_RATE 256
+
+/* 
+ * Also in region mode, we keep track of how many of the objects
+ * from each allocation site (a new, newarray, or anewarray in some
+ * method) live through their first collection. Once we've seen 
+ * GC_PRETENURE_SAMPLES of them, a site where at least 
+ * GC_PRETENURE_SURVIVAL percent survive gets its objects allocated 
+ * in old regions (see mm.h), which we don't evacuate. Counts are 
+ * halved every GC_PRETENURE_WINDOW samples so that sites can change 
+ * their minds.
+ */
+#define GC_PRETENURE_SAMPLES  64
+#define GC_PRETENURE_SURVIVAL 90
+#define GC_PRETENURE_WINDOW   4096
+#define GC_SITES_INIT         64
+#define GC_MAX_SITES          (1 << 24)
+
+/* 
+ * With --gc-dedup-strings, Strings that survive their first
+ * collection get their character arrays hashed, and those with the
+ * same contents end up sharing one array. The table of arrays we've
+ * seen starts with GC_DEDUP_INIT slots. Only the collecting thread
+ * touches it, and only while the mutator is stopped, so it's a plain
+ * (unlocked) table.
+ */
+#define GC_DEDUP_INIT 256
+
+/* initial size of a remembered set hash table */
+#define GC_REMSET_INIT 16
+
+/* 
+ * C code can keep a reference across a call that might 
+ * run the GC by registering it with gc_protect()
+ */
+#define GC_MAX_HANDLES 16
+
+/* where an incremental cycle is at */
+#define GC_PHASE_IDLE  0
+#define GC_PHASE_MARK  1
+#define GC_PHASE_SWEEP 2
+
+/* number of overwritten references logged per SATB buffer */
+#define GC_SATB_BUF_SIZE 256
+
+struct jthread;
 
 typedef struct gc_stats {
 	u8 gc_time;
+	u8 pause_time; // time the mutator was stopped
 	u8 mark_time;
 	u8 sweep_time;
+	u8 evac_time;
+	u8 bytes_evacuated;
+	u4 regions_evacuated;
 	u4 obj_collected;
-	u4 bytes_reclaimed;
+	u8 bytes_reclaimed;
+	u4 strings_deduped;
+	u8 dedup_bytes; // size of the arrays that are no longer needed
 } gc_stats_t;
 
 typedef struct gc_time {
-	u8 time_since_collect;
-	int interval_ms;
+	u8 last_collect_ns;
+	int interval_ms; // collect at least this often, 0 if we don't care
 } gc_time_t;
 
+typedef struct gc_policy {
+	u8 start_ns;       // when the GC was set up
+	u8 cycle_start_ns; // when the current cycle started
+	u8 cycle_ns;       // how long a cycle takes (smoothed)
+	u8 pause_ns;       // total time the mutator has been stopped
+	u8 tick_ns;        // last allocation rate sample
+	u8 tick_alloc;     // bytes allocated as of then
+	u8 alloc_rate;     // bytes per ms (smoothed)
+	u8 used_after;     // heap in use after the last collection
+	u8 heap_trigger;   // collect when this much of the heap is in use
+	u8 los_trigger;    // same for the large object space
+	u4 countdown;      // safepoints until we look at the clock
+	const char * reason; // why the current cycle started
+} gc_policy_t;
+
+/* 
+ * What goes into the GC log (--gc-log) and the summary
+ * at exit. Every pause is kept so we can get percentiles.
+ */
+typedef struct gc_log {
+	FILE * file;
+	u4 cycles;
+	u8 * pauses;      // in ns
+	u4 npauses;
+	u4 pauses_size;
+	u8 max_pause;     // longest pause in the current cycle
+	u8 heap_before;   // heap in use when the current cycle started
+	u8 los_before;
+	u8 gc_ns;         // total time spent collecting
+	int cycle_ended;
+} gc_log_t;
+
+/* 
+ * Objects that have been marked but not scanned yet. Each
+ * mark thread has one of these (a Chase-Lev work-stealing deque). 
+ * The owner pushes and pops at the bottom, other threads steal 
+ * from the top.
+ */
+struct gc_deque_buf {
+	i8 size;
+	struct gc_deque_buf * prev; // retired buffers, freed after marking
+	struct native_object * objs[0];
+};
+
+typedef struct gc_deque {
+	i8 top;
+	i8 bottom;
+	struct gc_deque_buf * buf;
+} gc_deque_t;
+
+/* 
+ * References overwritten by the mutator while a concurrent
+ * mark is running (snapshot-at-the-beginning). They were reachable
+ * when marking started, so the marker has to see them.
+ */
+struct gc_satb_buf {
+	struct gc_satb_buf * next;
+	u4 count;
+	struct native_object * objs[GC_SATB_BUF_SIZE];
+};
+
+/* 
+ * The objects outside a region that (may) point into it. They're
+ * recorded by the write barrier, so we can find and fix up those
+ * references when the region is evacuated without scanning the heap.
+ */
+struct gc_remset {
+	struct native_object ** objs; // open addressing, NULL is empty
+	u4 size;
+	u4 count;
+};
+
+typedef struct gc_region {
+	u4 live;     // bytes still in use after the last sweep
+	u1 pinned;   // referenced conservatively, so it can't move
+	u1 in_cset;  // being evacuated
+	struct gc_remset remset;
+} gc_region_t;
+
+/* where an evacuated object went (sorted by from) */
+struct gc_fwd {
+	struct native_object * from;
+	struct native_object * to;
+};
+
+/* 
+ * A String character array that others with the same contents
+ * can share. The table doesn't keep these alive.
+ */
+struct gc_dedup_ent {
+	u4 hash;
+	struct native_object * arr; // NULL if the slot is empty
+};
+
+/* an allocation site, see gc_alloc_site() */
+struct gc_site {
+	struct method_info * mi;
+	u2 pc;
+	u1 pretenure;
+	u4 survived; // objects that made it through their first collection
+	u4 died;     // objects that didn't
+};
+
+typedef struct gc_worker {
+	int id;
+	pthread_t thread;
+	struct gc_state * state;
+	gc_deque_t deque;
+	u4 seed; // for picking who to steal from
+	u8 scanned;
+} __attribute__((aligned(64))) gc_worker_t;
+
 typedef struct gc_state {
 	struct list_head root_list;
-	gc_ref_tbl_t * ref_tbl;
+
+	// mark threads, worker 0 is whoever is collecting
+	int nworkers;
+	gc_worker_t * workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	u4 mark_epoch;  // bumped to start the workers
+	int ndone;      // workers done with this mark phase
+	int nidle;      // workers out of work (for termination)
+	int nactive;    // workers taking part in this trace
+	int mark_failed;
+
+	// concurrent marking
+	int mode;
+	pthread_t conc_thread;
+	pthread_cond_t conc_cond;
+	int conc_request;  // mutator wants the marker to start
+	int conc_active;   // we're in the middle of a concurrent cycle
+	int conc_done;     // marker is finished, time for the remark pause
+	struct gc_satb_buf * satb_cur;  // being filled by the mutator
+	struct gc_satb_buf * satb_full; // waiting for the marker
+
+	// incremental collection
+	int phase;
+	u8 pause_target_ns;
+	u8 next_slice_ns; // mutator runs until then before the next slice
+
+	// region mode
+	u4 nregions;
+	gc_region_t * regions;
+	struct gc_fwd * fwd;
+	u4 nfwd;
+	u4 fwd_size;
+	u8 evac_rate; // bytes copied per us
+	u4 nr_pretenured; // sites we're pretenuring
+
+	// string deduplication
+	int dedup;
+	struct java_class * string_cls;
+	struct gc_dedup_ent * dedup_tab;
+	u4 dedup_size;
+	u4 dedup_count;
+	struct native_object ** dedup_queue; // new survivors, waiting to be deduplicated
+	u4 dedup_nqueue;
+	u4 dedup_qsize;
+
+	struct native_object ** handles[GC_MAX_HANDLES];
+	int nhandles;
 
 	gc_stats_t collect_stats;
 	gc_time_t time_info;
+	gc_policy_t policy;
+	gc_log_t log;
+	u4 idle_cycles; // consecutive collections with a mostly empty heap
 	int trace;
 } gc_state_t;
 
 typedef struct gc_root {
 	struct list_head link;
 	int (*scan)(struct gc_state * gc_state, void * priv_data);
+	void (*update)(struct gc_state * gc_state, void * priv_data); // fix up moved objects
 	const char * name;
 	void * ptr;
 } gc_root_t;
 
 
-int gc_insert_ref(struct obj_ref * ref);
 int gc_collect(struct jthread * t);
+int gc_collect_full(struct jthread * t);
 int gc_should_collect(struct jthread * t);
-int gc_init(struct jthread * main, struct obj_ref * base_obj, int trace, int interval);
+int gc_init(struct jthread * main, struct native_object * base_obj, int trace, int interval, int nthreads, int mode, int pause_target_us);
+int gc_open_log(struct jthread * t, const char * path);
+int gc_enable_dedup(struct jthread * t);
+int gc_sweep_some(u4 bytes);
+void gc_protect(struct native_object ** ref);
+void gc_unprotect(void);
+
+extern int gc_satb_active;
+void gc_satb_enqueue(struct native_object * obj);
+
+/*
+ * Write barrier for reference stores. Call it with the
+ * reference that's about to be overwritten. It only does
+ * anything while a concurrent mark is running.
+ */
+static inline void
+gc_write_barrier (struct native_object * old)
+{
+	if (__builtin_expect(gc_satb_active, 0) && old) {
+		gc_satb_enqueue(old);
+	}
+}
+
+extern int gc_remsets_active;
+void gc_remember(struct native_object * obj, struct native_object * ref);
+
+/*
+ * Called after a reference is stored into an object. In region
+ * mode this records cross-region references in remembered sets.
+ */
+static inline void
+gc_post_barrier (struct native_object * obj, struct native_object * ref)
+{
+	if (__builtin_expect(gc_remsets_active, 0) && ref) {
+		gc_remember(obj, ref);
+	}
+}
 
 /* allocation interface */
-struct obj_ref * gc_array_alloc(u1 type, i4 count);
-struct obj_ref * gc_str_obj_alloc(const char * str);
-struct obj_ref * gc_obj_alloc(struct java_class * cls);
+struct native_object * gc_array_alloc(u1 type, i4 count, u4 site);
+struct native_object * gc_str_obj_alloc(const char * str);
+struct native_object * gc_obj_alloc(struct java_class * cls, u4 site);
+u4 gc_alloc_site(struct method_info * mi, u2 pc);
 
-#endif
 
+extern struct gc_site * gc_sites;
 
+/*
+ * Should objects from this allocation site be
+ * allocated in an old region?
+ */
+static inline int
+gc_pretenure (u4 site)
+{
+	return site && gc_sites[site].pretenure;
+}
 
+#endif
@@ -289,11 +289,53 @@ bitmap_zero (unsigned long *dst, int nbits)
 	}
 }
 
-static inline int 
+static inline int
 test_bit (unsigned int nr, const volatile unsigned long *addr)
 {
     return ((1UL << (nr % BITS_PER_LONG)) &
         (addr[nr / BITS_PER_LONG])) != 0;
 }
 
+/*
+ * Returns the index of the next set bit at or after offset,
+ * or size if there isn't one.
+ */
+static inline unsigned long
+find_next_bit (const unsigned long * addr, unsigned long size, unsigned long offset)
+{
+	while (offset < size) {
+		unsigned long w = addr[BIT_WORD(offset)] >> (offset % BITS_PER_LONG);
+
+		if (w) {
+			offset += __builtin_ctzl(w);
+			return offset < size ? offset : size;
+		}
+
+		offset = (offset | (BITS_PER_LONG - 1)) + 1;
+	}
+
+	return size;
+}
+
+/* same as find_next_bit(), but looks for a clear bit */
+static inline unsigned long
+find_next_zero_bit (const unsigned long * addr, unsigned long size, unsigned long offset)
+{
+	while (offset < size) {
+		unsigned long w = (~addr[BIT_WORD(offset)]) >> (offset % BITS_PER_LONG);
+
+		if (w) {
+			offset += __builtin_ctzl(w);
+			return offset < size ? offset : size;
+		}
+
+		offset = (offset | (BITS_PER_LONG - 1)) + 1;
+	}
+
+	return size;
+}
+
+#define find_first_bit(addr, size)      find_next_bit((addr), (size), 0)
+#define find_first_zero_bit(addr, size) find_next_zero_bit((addr), (size), 0)
+
 #endif
@@ -0,0 +1,8 @@
+#ifndef __INFLATE_H__
+#define __INFLATE_H__
+
+#include <types.h>
+
+int hb_inflate (u1 * dst, u4 dst_len, const u1 * src, u4 src_len);
+
+#endif
@@ -0,0 +1,52 @@
+/* 
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the 
+ * file "LICENSE.txt".
+ */
+#ifndef __METASPACE_H__
+#define __METASPACE_H__
+
+#include <types.h>
+
+#define META_CHUNK_MIN  4096
+#define META_CHUNK_MAX  (64*1024)
+#define META_ALIGN      8
+
+struct meta_chunk {
+	struct meta_chunk * next;
+	u8 size; // bytes usable after the header
+	u1 data[0];
+};
+
+/* 
+ * Every piece of metadata hanging off a class (its constant
+ * pool, fields, methods, code, stack maps, instance layout,
+ * static field values) is bump-allocated from the class's own
+ * metaspace. Nothing in it is ever freed on its own; the whole
+ * thing goes away at once with hb_meta_free(). A metaspace must
+ * only be used by one thread at a time. An all-zero metaspace is
+ * empty and ready to use.
+ */
+typedef struct metaspace {
+	struct meta_chunk * chunks; // newest first
+	u1 * cur;
+	u1 * end;
+	u8 used;     // bytes handed out
+	u8 reserved; // bytes in chunks
+	u4 nchunks;
+} metaspace_t;
+
+void * hb_meta_alloc (metaspace_t * ms, u8 size);
+void hb_meta_free (metaspace_t * ms);
+void hb_print_metaspace (void);
+
+#endif
@@ -17,6 +17,7 @@
 
 
 #include <types.h>
+#include <list.h>
 
 #include <hawkbeans.h>
 
@@ -33,12 +34,104 @@
 #endif
 
 /* linux */
-#define HB_DEFAULT_HEAP_SIZE (1024*1024)
+#define HB_DEFAULT_HEAP_SIZE     (1024*1024)
+#define HB_DEFAULT_MAX_HEAP_SIZE (512UL*1024*1024)
+
+/*
+ * The heap grows and shrinks a region at a time. The address 
+ * space for the maximum heap size is reserved up front and regions
+ * are committed from the bottom up, so the heap is always 
+ * contiguous and a region is just a buddy block of HB_REGION_ORDER.
+ */
+#define HB_REGION_ORDER 20
+#define HB_REGION_SIZE  (1UL << HB_REGION_ORDER)
+
+/* 
+ * Objects from allocation sites the GC has found to be long-lived
+ * (see gc_pretenure()) are allocated in old regions. These have their
+ * own free lists and slabs, and are never evacuated. An old region goes
+ * back to the rest of the heap once it's entirely free.
+ */
+
+/* the heap starts on a boundary this big so it can use huge pages */
+#define HB_HUGE_PAGE_SIZE (2UL*1024*1024)
+
+/* flags for heap_init() */
+#define HB_HEAP_HUGEPAGES 0x1 // back the heap with transparent huge pages
+#define HB_HEAP_PRETOUCH  0x2 // fault in the heap as soon as it's committed
+
+/* 
+ * Small objects are not handed to the buddy allocator directly (which
+ * would round them up to a power of two). Instead they are carved out of
+ * slab pages, which are themselves buddy blocks of order HB_SLAB_ORDER.
+ * Each slab serves a single size class, classes are HB_SLAB_GRANULE bytes
+ * apart up to HB_SLAB_MAX_OBJ.
+ */
+#define HB_SLAB_ORDER     12
+#define HB_SLAB_SIZE      (1UL << HB_SLAB_ORDER)
+#define HB_SLAB_GRANULE   16
+#define HB_SLAB_MAX_OBJ   512
+#define HB_SLAB_CLASSES   (HB_SLAB_MAX_OBJ / HB_SLAB_GRANULE)
+#define HB_SLAB_MAX_SLOTS (HB_SLAB_SIZE / HB_SLAB_GRANULE)
+
+/*
+ * Objects of at least HB_LOS_MIN_OBJ bytes don't come from the
+ * buddy heap. They go in the large object space (LOS), a separately
+ * reserved range of virtual memory where each one gets its own run
+ * of pages. Pages are only backed once they're touched, and are given
+ * back to the OS when the object dies.
+ */
+#define HB_PAGE_SHIFT       12
+#define HB_PAGE_SIZE        (1UL << HB_PAGE_SHIFT)
+#define HB_LOS_MIN_OBJ      (32*1024)
+#define HB_LOS_DEFAULT_SIZE (256UL*1024*1024)
+
+/*
+ * Every object starts on an HB_OBJ_ALIGN boundary. The heap
+ * keeps one bit per such granule, set if an object starts there,
+ * so the GC can tell whether an arbitrary word is a reference 
+ * and can walk all allocated objects.
+ */
+#define HB_OBJ_ALIGN 16
+
+struct slab {
+	struct list_head link; // on the partial list for its size class
+
+	u2 obj_size;
+	u2 nr_objs;
+	u2 nr_free;
+	u2 first; // offset of the first slot from the start of the slab
+
+	// one bit per slot, set if allocated
+	unsigned long alloc_bits[HB_SLAB_MAX_SLOTS / (8*sizeof(unsigned long))];
+};
+
+/*
+ * A free block in the buddy allocator. This overlays the
+ * start of the block (it's never a live object).
+ */
+struct buddy_block {
+	u2 order;
+	struct list_head link; // for free list accounting
+};
 
 struct heap_info {
 	void * heap_region;
 
 	u8 allocated;
+	u8 total_alloc; // bytes handed out since startup
+	u8 committed; // bytes of regions currently part of the heap
+	u8 min_committed; // we never shrink below this (the initial size)
+	u8 max_size;
+	int flags; // HB_HEAP_* flags
+	int alloc_marked; // new objects start out marked (during concurrent GC)
+	u8 sweep_cursor; // lazy sweeping has reached this offset...
+	u8 sweep_limit;  // ...of the part of the heap it has to cover
+	u8 * evac_bits; // regions being evacuated, we don't allocate in them
+	u4 nr_evac;
+	u8 * old_bits; // regions holding pretenured objects
+	u4 nr_old;
+	struct list_head old_lists[HB_REGION_ORDER + 1]; // free lists for old regions
 
 	u2 order; // log2(size of heap region)
 	u2 min_order; // minimum sized block that can be allocated
@@ -47,17 +140,56 @@ struct heap_info {
 	struct list_head * free_lists; // power of 2 free lists
 
 	u8 * tag_bits; // bitmap for min blocks
+
+	u8 slab_pages; // number of buddy blocks currently used as slabs
+	u8 slab_bytes; // bytes handed out from slabs
+	u8 * slab_bits; // bitmap for slab-sized blocks, set if used as a slab
+	struct list_head slab_partial[HB_SLAB_CLASSES]; // slabs with free slots
+	struct list_head old_slab_partial[HB_SLAB_CLASSES]; // same, in old regions
+
+	u8 * obj_bits; // object start bitmap, one bit per HB_OBJ_ALIGN bytes
+	u8 num_obj_granules; // number of bits in obj_bits
+
+	void * los_region;
+	u8 los_pages; // number of pages in the LOS
+	u8 los_used; // pages currently backing large objects
+	u8 * los_used_bits; // set if the page is in use
+	u8 * los_start_bits; // set if a large object starts on this page
 };
 
 struct java_class;
 
-int heap_init(int heap_size_megs);
-
-struct obj_ref * array_alloc(u1 type, i4 count);
-struct obj_ref * string_object_alloc(const char * str);
-struct obj_ref * object_alloc(struct java_class * cls);
-struct native_object * alloc_checked(const u4 size);
+int heap_init(u8 init_size, u8 max_size, int flags);
+int heap_grow(u8 bytes);
+u8 heap_shrink(u8 bytes);
+u8 heap_used(void);
+u8 heap_committed(void);
+u8 heap_total_alloc(void);
+u8 heap_los_used(void);
+u8 heap_los_size(void);
+void heap_set_alloc_marked(int on);
+void heap_begin_sweep(void);
+struct native_object * heap_sweep_next(void);
+int heap_sweep_pending(void);
+int heap_region_of(void * addr);
+u4 heap_max_regions(void);
+void heap_set_evacuating(u4 region, int on);
+int heap_region_is_old(u4 region);
+u4 heap_old_regions(void);
+struct native_object * heap_region_next_obj(u4 region, struct native_object * obj);
+struct native_object * heap_copy_obj(struct native_object * obj);
+
+struct native_object * array_alloc(u1 type, i4 count);
+struct native_object * array_alloc_site(u1 type, i4 count, u4 site);
+struct native_object * string_object_alloc(const char * str);
+struct native_object * object_alloc(struct java_class * cls);
+struct native_object * object_alloc_site(struct java_class * cls, u4 site);
+struct native_object * alloc_checked(const u8 size, int old);
 void object_free(struct native_object * obj);
+u4 object_size(struct native_object * obj);
+int heap_is_obj(void * addr);
+struct native_object * heap_next_obj(struct native_object * obj);
+struct native_object * los_next_obj(struct native_object * obj);
 void * buddy_alloc (u2 order);
 void buddy_free (void * addr, u2 order);
 void buddy_stats (void);
@@ -74,7 +74,7 @@ int hb_push_frame_by_method (struct jthread * t,
 int hb_push_frame (struct jthread * t,
 			java_class_t * cls,
 			u2 method_idx);
-int hb_push_ctor_frame (struct jthread * t, struct obj_ref * oref);
+int hb_push_ctor_frame (struct jthread * t, struct native_object * oref);
 
 int hb_get_parm_count_from_method (struct jthread * t, 
 				   struct method_info * mi,
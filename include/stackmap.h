@@ -0,0 +1,53 @@
+/* 
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the 
+ * file "LICENSE.txt".
+ */
+#ifndef __STACKMAP_H__
+#define __STACKMAP_H__
+
+#include <hawkbeans.h>
+#include <class.h>
+
+#if DEBUG_STACKMAP == 1
+#define SM_DEBUG(fmt, args...) HB_DEBUG(fmt, ##args)
+#else
+#define SM_DEBUG(fmt, args...)
+#endif
+
+/* depth for a pc that's not the start of a reachable instruction */
+#define SM_UNREACHED 0xffff
+
+/*
+ * A stack map tells the GC which locals and operand stack
+ * slots hold references when a frame is at a given pc.
+ * Each instruction has map_stride bytes of bits, locals first
+ * (bit i is local i), then the operand stack (bit max_locals + i - 1
+ * is oprs[i], since slot 0 of the operand stack isn't used).
+ * map_depth is the number of operands on the stack before the
+ * instruction executes.
+ */
+static inline u1 *
+hb_stack_map_bits (method_info_t * mi, u2 pc)
+{
+	return &mi->map_bits[pc * mi->map_stride];
+}
+
+static inline int
+hb_stack_map_is_ref (u1 * bits, u4 slot)
+{
+	return (bits[slot >> 3] >> (slot & 7)) & 1;
+}
+
+int hb_build_stack_maps (java_class_t * cls);
+
+#endif
@@ -0,0 +1,58 @@
+/* 
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the 
+ * file "LICENSE.txt".
+ */
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include <stddef.h>
+
+#include <types.h>
+#include <metaspace.h>
+
+#define HB_SYMTAB_INIT_SIZE 4096
+
+/*
+ * Every Utf8 constant is interned into the VM-wide symbol table
+ * when its class is loaded, so two symbols with the same bytes
+ * are the same pointer. Names and descriptors can then be
+ * compared with ==, and hashed without looking at the string.
+ * A symbol is handed out as a pointer to its (NUL-terminated)
+ * bytes, so it can be used anywhere a C string is expected.
+ */
+typedef struct hb_symbol {
+	struct hb_symbol * next; // hash chain
+	u4 hash;
+	u2 len;
+	char bytes[0];
+} hb_symbol_t;
+
+#define HB_SYM(s) ((hb_symbol_t*)((const char*)(s) - offsetof(hb_symbol_t, bytes)))
+
+static inline u4
+hb_sym_hash (const char * sym)
+{
+	return HB_SYM(sym)->hash;
+}
+
+// well-known symbols, valid after hb_symtab_init()
+extern const char * hb_sym_ctor;   // <init>
+extern const char * hb_sym_string; // java/lang/String
+
+int hb_symtab_init (void);
+const char * hb_intern (const char * str, u2 len);
+const char * hb_intern_str (const char * str);
+u4 hb_symtab_count (void);
+const metaspace_t * hb_symtab_meta (void);
+
+#endif
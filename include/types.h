@@ -19,6 +19,7 @@
 typedef long           i8;
 typedef int            i4;
 typedef short          i2;
+typedef signed char    i1;
 typedef unsigned long  u8;
 typedef unsigned int   u4;
 typedef unsigned short u2;
@@ -20,6 +20,21 @@ public final class String implements CharSequence, Comparable<String>
 		characters = new char[len];
 	}
 
+	/**
+	 * Create a String that takes over the given character array.
+	 * Nobody may write to the array afterwards: the GC can make
+	 * Strings with the same contents share one array once their
+	 * constructor has returned, so anything that fills in the array
+	 * has to be done by then.
+	 * 
+	 * @param c the character array
+	 * @param share ignored - tells this apart from String(char[])
+	 */
+	private String(char[] c, boolean share)
+	{
+		characters = c;
+	}
+
 	/**
 	 * Create a String from a byte array
 	 * 
@@ -226,10 +241,10 @@ public final class String implements CharSequence, Comparable<String>
 		int len1 = this.characters.length;
 		int len2 = len1 + s.characters.length;
 		
-		String r = new String(len2);
-		System.arraycopy(this.characters, 0, r.characters, 0, len1);
-		System.arraycopy(s.characters, 0, r.characters, len1, len2);
-		return r;
+		char[] c = new char[len2];
+		System.arraycopy(this.characters, 0, c, 0, len1);
+		System.arraycopy(s.characters, 0, c, len1, len2 - len1);
+		return new String(c, true);
 	}
 	
 	public boolean contentEquals(CharSequence s)
@@ -509,11 +524,10 @@ public final class String implements CharSequence, Comparable<String>
 	public String replace(char oldChar, char newChar)
 	{
 		int len = characters.length;
-		String r = new String(this.characters, 0, len);
+		char[] c = new char[len];
 		for (int i=0; i<len; i++)
-			if (r.characters[i] == oldChar)
-				r.characters[i] = newChar;
-		return r;
+			c[i] = (characters[i] == oldChar) ? newChar : characters[i];
+		return new String(c, true);
 	}
 	
 	public boolean startsWith(String s)
@@ -638,9 +652,9 @@ public final class String implements CharSequence, Comparable<String>
 
 	public static String valueOf(char c)
 	{
-		String r = new String(1);
-		r.characters[0] = c;
-		return r;
+		char[] r = new char[1];
+		r[0] = c;
+		return new String(r, true);
 	}
 
 	public static String valueOf(char[] c)
@@ -692,9 +706,9 @@ public final class String implements CharSequence, Comparable<String>
 	static String valueOf(int i, int radix)
 	{
 		int len = StringUtils.exactStringLength(i, radix);
-		String r = new String(len);
-		StringUtils.getIntChars(r.characters, len, i, radix);
-		return r;
+		char[] c = new char[len];
+		StringUtils.getIntChars(c, len, i, radix);
+		return new String(c, true);
 	}
 	
 	/**
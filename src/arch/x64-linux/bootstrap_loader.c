@@ -18,18 +18,27 @@
 #include <string.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include <hawkbeans.h>
 #include <types.h>
 #include <constants.h>
 #include <class.h>
+#include <stackmap.h>
+#include <list.h>
+#include <hashtable.h>
 
 #include <arch/x64-linux/bootstrap_loader.h>
+#include <arch/x64-linux/cds.h>
+#include <arch/x64-linux/classpath.h>
 #include <arch/x64-linux/util.h>
 
 #define GET_AND_INC(field, sz) \
 	cls->field = get_u##sz(clb); clb += sz
 
+/* most classes we'll load ahead of time */
+#define PRELOAD_MAX 4096
+
 #define PARSE_AND_CHECK(count, func, str) \
 	if (cls->count > 0) { \
 		skip = 0; \
@@ -41,21 +50,37 @@
 	}
 
 
-static u1*
-open_class_file (const char * path)
+/* 
+ * Gets the name of the file a class lives in,
+ * which might mean adding the extension (in buf)
+ */
+static const char *
+class_file_name (const char * path, char * buf)
 {
-	int fd;
-	struct stat s;
-	void * cm = NULL;
 	const char * suf = ".class";
-	char buf[512];
-	
+
 	// do we need to add the extension?
 	if (!strstr(path, suf)) {
 		memset(buf, 0, 512);
 		strncpy(buf, path, 512);
 		strncat(buf, suf, 7);
-		path = buf;
+		return buf;
+	}
+
+	return path;
+}
+
+
+static u1*
+open_class_file (const char * path)
+{
+	int fd;
+	struct stat s;
+	void * cm = NULL;
+
+	// classes on the classpath are already indexed (see classpath.c)
+	if ((cm = hb_classpath_open(path))) {
+		return (u1*)cm;
 	}
 		
 	if ((fd = open(path, O_RDONLY)) == -1) {
@@ -83,18 +108,18 @@ open_class_file (const char * path)
 
 
 static const_pool_info_t * 
-parse_const_pool_entry (u1 * ptr, u1 * sz)
+parse_const_pool_entry (u1 * ptr, u1 * sz, java_class_t * cls)
 {
 	switch (*ptr) {
 		case CONSTANT_Class:  {
-			CONSTANT_Class_info_t * c = malloc(sizeof(CONSTANT_Class_info_t));
+			CONSTANT_Class_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_Class_info_t));
 			c->tag      = *ptr;
 			c->name_idx = get_u2(ptr+1);
 			*sz = 3;
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_Fieldref: {
-			CONSTANT_Fieldref_info_t * c = malloc(sizeof(CONSTANT_Fieldref_info_t));
+			CONSTANT_Fieldref_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_Fieldref_info_t));
 			c->tag               = *ptr;
 			c->class_idx         = get_u2(ptr+1);
 			c->name_and_type_idx = get_u2(ptr+3);
@@ -102,7 +127,7 @@ parse_const_pool_entry (u1 * ptr, u1 * sz)
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_Methodref: {
-			CONSTANT_Methodref_info_t * c = malloc(sizeof(CONSTANT_Methodref_info_t));
+			CONSTANT_Methodref_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_Methodref_info_t));
 			c->tag               = *ptr;
 			c->class_idx         = get_u2(ptr+1);
 			c->name_and_type_idx = get_u2(ptr+3);
@@ -110,7 +135,7 @@ parse_const_pool_entry (u1 * ptr, u1 * sz)
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_InterfaceMethodref: {
-			CONSTANT_InterfaceMethodref_info_t * c = malloc(sizeof(CONSTANT_InterfaceMethodref_info_t));
+			CONSTANT_InterfaceMethodref_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_InterfaceMethodref_info_t));
 			c->tag               = *ptr;
 			c->class_idx         = get_u2(ptr+1);
 			c->name_and_type_idx = get_u2(ptr+3);
@@ -118,28 +143,28 @@ parse_const_pool_entry (u1 * ptr, u1 * sz)
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_String: {
-			CONSTANT_String_info_t * c = malloc(sizeof(CONSTANT_String_info_t));
+			CONSTANT_String_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_String_info_t));
 			c->tag     = *ptr;
 			c->str_idx = get_u2(ptr+1);
 			*sz = 3;
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_Integer: {
-			CONSTANT_Integer_info_t * c = malloc(sizeof(CONSTANT_Integer_info_t));
+			CONSTANT_Integer_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_Integer_info_t));
 			c->tag   = *ptr;
 			c->bytes = get_u4(ptr+1);
 			*sz = 5;
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_Float: {
-			CONSTANT_Float_info_t * c = malloc(sizeof(CONSTANT_Float_info_t));
+			CONSTANT_Float_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_Float_info_t));
 			c->tag   = *ptr;
 			c->bytes = get_u4(ptr+1);
 			*sz = 5;
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_Long: {
-			CONSTANT_Long_info_t * c = malloc(sizeof(CONSTANT_Long_info_t));
+			CONSTANT_Long_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_Long_info_t));
 			c->tag      = *ptr;
 			c->hi_bytes = get_u4(ptr+1);
 			c->lo_bytes = get_u4(ptr+5);
@@ -147,7 +172,7 @@ parse_const_pool_entry (u1 * ptr, u1 * sz)
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_Double: {
-			CONSTANT_Double_info_t * c = malloc(sizeof(CONSTANT_Double_info_t));
+			CONSTANT_Double_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_Double_info_t));
 			c->tag      = *ptr;
 			c->hi_bytes = get_u4(ptr+1);
 			c->lo_bytes = get_u4(ptr+5);
@@ -155,7 +180,7 @@ parse_const_pool_entry (u1 * ptr, u1 * sz)
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_NameAndType: {
-			CONSTANT_NameAndType_info_t * c = malloc(sizeof(CONSTANT_NameAndType_info_t));
+			CONSTANT_NameAndType_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_NameAndType_info_t));
 			c->tag      = *ptr;
 			c->name_idx = get_u2(ptr+1);
 			c->desc_idx = get_u2(ptr+3);
@@ -166,16 +191,15 @@ parse_const_pool_entry (u1 * ptr, u1 * sz)
 			CONSTANT_Utf8_info_t * c = NULL;
 			u1 tag = *ptr;
 			u2 len = get_u2(ptr+1);
-			c = malloc(sizeof(CONSTANT_Utf8_info_t) + len + 1);
+			c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_Utf8_info_t));
 			c->tag = tag;
 			c->len = len;
 			*sz = 3 + len; 
-			memset(c->bytes, 0, len + 1);
-			memcpy(c->bytes, ptr+3, len);
+			c->bytes = (u1*)hb_intern((char*)ptr+3, len);
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_MethodHandle: {
-			CONSTANT_MethodHandle_info_t * c = malloc(sizeof(CONSTANT_MethodHandle_info_t));
+			CONSTANT_MethodHandle_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_MethodHandle_info_t));
 			c->tag = *ptr;
 			c->ref_kind = *(ptr+1);
 			c->ref_idx  = get_u2(ptr+2);
@@ -183,14 +207,14 @@ parse_const_pool_entry (u1 * ptr, u1 * sz)
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_MethodType: {
-			CONSTANT_MethodType_info_t * c = malloc(sizeof(CONSTANT_MethodType_info_t));
+			CONSTANT_MethodType_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_MethodType_info_t));
 			c->tag      = *ptr;
 			c->desc_idx = get_u2(ptr+1);
 			*sz = 3;
 			return (const_pool_info_t*)c;
 		}
 		case CONSTANT_InvokeDynamic: {
-			CONSTANT_InvokeDynamic_info_t * c = malloc(sizeof(CONSTANT_InvokeDynamic_info_t));
+			CONSTANT_InvokeDynamic_info_t * c = hb_meta_alloc(&cls->meta, sizeof(CONSTANT_InvokeDynamic_info_t));
 			c->tag                       = *ptr;
 			c->bootstrap_method_attr_idx = get_u2(ptr+1);
 			c->name_and_type_idx         = get_u2(ptr+3);
@@ -218,20 +242,18 @@ parse_const_pool (u1 * clb, java_class_t * cls, u4 * skip)
 {
 	int i;
 
-	cls->const_pool = (const_pool_info_t**)malloc(sizeof(const_pool_info_t*)*(cls->const_pool_count));
+	cls->const_pool = hb_meta_alloc(&cls->meta, sizeof(const_pool_info_t*)*(cls->const_pool_count));
 
 	if (!cls->const_pool) {
 		HB_ERR("Could not allocate constant pool\n");
 		return -1;
 	}
 
-	memset(cls->const_pool, 0, sizeof(const_pool_info_t*)*(cls->const_pool_count));
-
 	for (i = 1; i < cls->const_pool_count; i++) {
 		const_pool_info_t * cinfo = NULL;
 		u1 sz = 0;
 
-		cinfo = parse_const_pool_entry(clb, &sz);
+		cinfo = parse_const_pool_entry(clb, &sz, cls);
 
 		if (!cinfo) {
 			HB_ERR("Could not parse constant pool entry %d\n", i);
@@ -261,12 +283,11 @@ parse_ixes (u1 * clb, java_class_t * cls, u4 * skip)
 {
 	int i;
 
-	cls->interfaces = malloc(cls->interfaces_count * sizeof(u2));
+	cls->interfaces = hb_meta_alloc(&cls->meta, cls->interfaces_count * sizeof(u2));
 	if (!cls->interfaces) {
 		HB_ERR("Could not allocate interfaces\n");
 		return -1;
 	}
-	memset(cls->interfaces, 0, cls->interfaces_count * sizeof(u2));
 
 	for (i = 0; i < cls->interfaces_count; i++) {
 		GET_AND_INC(interfaces[i], 2);
@@ -302,12 +323,11 @@ parse_fields (u1 * clb, java_class_t * cls, u4 * skip)
 {
 	int i;
 
-	cls->fields = malloc(sizeof(field_info_t)*cls->fields_count);
+	cls->fields = hb_meta_alloc(&cls->meta, sizeof(field_info_t)*cls->fields_count);
 	if (!cls->fields) {
 		HB_ERR("Could not allocate fields\n");
 		return -1;
 	}
-	memset(cls->fields, 0, sizeof(field_info_t)*cls->fields_count);
 	
 	for (i = 0; i < cls->fields_count; i++) {
 		GET_AND_INC(fields[i].acc_flags, 2);
@@ -350,12 +370,11 @@ parse_method_code (u1 * clb, method_info_t * m, java_class_t * cls)
 	u2 attr_name_idx = get_u2(clb); clb+=2;
 	u4 attr_len      = get_u4(clb); clb+=4;
 
-	m->code_attr = malloc(sizeof(code_attr_t));
+	m->code_attr = hb_meta_alloc(&cls->meta, sizeof(code_attr_t));
 	if (!m->code_attr) {
 		HB_ERR("Could not allocate code attribute\n");
 		return -1;
 	}
-	memset(m->code_attr, 0, sizeof(code_attr_t));
 
 	m->code_attr->attr_name_idx = attr_name_idx;
 	m->code_attr->attr_len      = attr_len;
@@ -363,19 +382,14 @@ parse_method_code (u1 * clb, method_info_t * m, java_class_t * cls)
 	m->code_attr->max_locals    = get_u2(clb); clb+=2;
 	m->code_attr->code_len      = get_u4(clb); clb+=4;
 
-	m->code_attr->code = malloc(m->code_attr->code_len);
-	if (!m->code_attr->code) {
-		HB_ERR("Could not allocate code for method!\n");
-		return -1;
-	}
-	
-	memcpy(m->code_attr->code, clb, m->code_attr->code_len);
+	// nothing rewrites bytecode, so it can stay in the class file
+	m->code_attr->code = clb;
 
 	clb += m->code_attr->code_len;
 
 	m->code_attr->excp_table_len = get_u2(clb); clb+=2;
 	
-	m->code_attr->excp_table = malloc(sizeof(excp_table_t)*m->code_attr->excp_table_len);
+	m->code_attr->excp_table = hb_meta_alloc(&cls->meta, sizeof(excp_table_t)*m->code_attr->excp_table_len);
 	if (!m->code_attr->excp_table) {
 		HB_ERR("Could not allocate exception table\n");
 		return -1;
@@ -414,12 +428,11 @@ parse_methods (u1 * clb, java_class_t * cls, u4 * skip)
 {
 	int i, j;
 
-	cls->methods = malloc(sizeof(method_info_t)*cls->methods_count);
+	cls->methods = hb_meta_alloc(&cls->meta, sizeof(method_info_t)*cls->methods_count);
 	if (!cls->methods) {
 		HB_ERR("Could not allocate methods\n");	
 		return -1;
 	}
-	memset(cls->methods, 0, sizeof(method_info_t)*cls->methods_count);
 
 	for (i = 0; i < cls->methods_count; i++) {
 		GET_AND_INC(methods[i].acc_flags, 2);
@@ -523,10 +536,14 @@ print_class_info (java_class_t * cls)
 }
 
 /*
- * TODO: should throw a ClassNotFoundException on error
+ * Reads, parses, and verifies a class file, and builds
+ * the stack maps for its methods.
+ *
+ * @return: the new class, NULL on error
+ *
  */
-java_class_t * 
-hb_load_class (const char * path)
+static java_class_t *
+parse_class_file (const char * path)
 {
 	java_class_t * cls = NULL;
 	u1 * class_bytes   = NULL;
@@ -547,24 +564,324 @@ hb_load_class (const char * path)
 
 	if (parse_class(class_bytes, cls) != 0) {
 		HB_ERR("Could not parse class file\n");
-		return NULL;
+		goto out_err;
 	}
 
 	if (verify_class(cls) != 0) {
 		HB_ERR("Could not verify class\n");
+		goto out_err;
+	}
+
+	// methods we can't map will be scanned conservatively by the GC
+	hb_build_stack_maps(cls);
+
+	return cls;
+
+out_err:
+	// nothing else points into it yet, so it can all go at once
+	hb_meta_free(&cls->meta);
+	free(cls);
+	return NULL;
+}
+
+
+static java_class_t *
+find_class_file (const char * file)
+{
+	// we might not have to parse it at all (see cds.c)
+	java_class_t * cls = hb_cds_find(file);
+
+	return cls ? cls : parse_class_file(file);
+}
+
+
+/*
+ * Loader threads parse classes before anyone asks for them.
+ * Whenever a class is parsed, the classes its constant pool
+ * refers to are queued up, and the loader threads parse those
+ * (and so on) in the background. When hb_load_class() wants one
+ * of them it takes the parsed class, waiting for it if a loader
+ * thread is in the middle of it. Everything past parsing
+ * (recording it, prepping, initializing) still happens on the
+ * thread that asked for the class.
+ */
+enum preload_state {
+	PRELOAD_QUEUED,
+	PRELOAD_BUSY,
+	PRELOAD_DONE,
+	PRELOAD_TAKEN,
+};
+
+struct preload {
+	const char * file;
+	enum preload_state state;
+	java_class_t * cls; // NULL if we couldn't load it
+	struct list_head node;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work; // loader threads wait for something to load
+	pthread_cond_t done; // everyone else waits for it to be loaded
+	struct nk_hashtable * table; // file name -> struct preload
+	struct list_head queue;
+	u4 count;
+	int nr_threads;
+} loader = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+
+static unsigned
+preload_hash_fn (unsigned long key)
+{
+	char * buf = (char*)key;
+	return nk_hash_buffer((unsigned char*)buf, strlen(buf));
+}
+
+
+static int
+preload_eq_fn (unsigned long k1, unsigned long k2)
+{
+	return strcmp((char*)k1, (char*)k2) == 0;
+}
+
+
+/*
+ * Queues up the classes that the given (just parsed)
+ * class refers to, for the loader threads to parse.
+ *
+ */
+static void
+queue_refs (java_class_t * cls)
+{
+	int i;
+
+	if (!loader.nr_threads) {
+		return;
+	}
+
+	for (i = 1; i < cls->const_pool_count; i++) {
+		const_pool_info_t * c = cls->const_pool[i];
+		struct preload * p = NULL;
+		const char * name = NULL;
+		char * file = NULL;
+
+		if (i == cls->this || !c || IS_RESOLVED(c) || c->tag != CONSTANT_Class) {
+			continue;
+		}
+
+		name = hb_get_const_str(((CONSTANT_Class_info_t*)c)->name_idx, cls);
+
+		// array classes don't have class files
+		if (!name || name[0] == '[') {
+			continue;
+		}
+
+		file = malloc(strlen(name) + 7);
+
+		if (!file) {
+			return;
+		}
+
+		sprintf(file, "%s.class", name);
+
+		pthread_mutex_lock(&loader.lock);
+
+		if (loader.count >= PRELOAD_MAX ||
+		    nk_htable_search(loader.table, (unsigned long)file) ||
+		    !(p = malloc(sizeof(struct preload)))) {
+			pthread_mutex_unlock(&loader.lock);
+			free(file);
+			continue;
+		}
+
+		p->file  = file;
+		p->state = PRELOAD_QUEUED;
+		p->cls   = NULL;
+
+		nk_htable_insert(loader.table, (unsigned long)file, (unsigned long)p);
+		list_add_tail(&p->node, &loader.queue);
+		loader.count++;
+
+		pthread_cond_signal(&loader.work);
+		pthread_mutex_unlock(&loader.lock);
+	}
+}
+
+
+static void *
+loader_thread (void * arg)
+{
+	while (1) {
+		struct preload * p = NULL;
+		java_class_t * cls = NULL;
+		u8 mtime, size;
+
+		pthread_mutex_lock(&loader.lock);
+
+		while (list_empty(&loader.queue)) {
+			pthread_cond_wait(&loader.work, &loader.lock);
+		}
+
+		p = list_first_entry(&loader.queue, struct preload, node);
+		list_del(&p->node);
+		p->state = PRELOAD_BUSY;
+
+		pthread_mutex_unlock(&loader.lock);
+
+		// it's only a guess, so classes that aren't there aren't an error
+		if (hb_classpath_stamp(p->file, &mtime, &size) == 0) {
+			cls = find_class_file(p->file);
+		}
+
+		if (cls) {
+			queue_refs(cls);
+		}
+
+		pthread_mutex_lock(&loader.lock);
+		p->cls   = cls;
+		p->state = PRELOAD_DONE;
+		pthread_cond_broadcast(&loader.done);
+		pthread_mutex_unlock(&loader.lock);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Takes a class the loader threads parsed (or are parsing)
+ * for us. If they haven't gotten to it yet, we'll do it
+ * ourselves, and mark it taken either way so that it isn't
+ * queued up later on.
+ *
+ * @return: the parsed class, NULL if we have to load it
+ *
+ */
+static java_class_t *
+take_preloaded (const char * file)
+{
+	struct preload * p = NULL;
+	java_class_t * cls = NULL;
+
+	if (!loader.nr_threads) {
 		return NULL;
 	}
 
-	cls->name   = path;
+	pthread_mutex_lock(&loader.lock);
+
+	p = (struct preload*)nk_htable_search(loader.table, (unsigned long)file);
+
+	if (p) {
+		while (p->state == PRELOAD_BUSY) {
+			pthread_cond_wait(&loader.done, &loader.lock);
+		}
+
+		if (p->state == PRELOAD_QUEUED) {
+			list_del(&p->node);
+		} else if (p->state == PRELOAD_DONE) {
+			cls = p->cls;
+		}
+
+		p->state = PRELOAD_TAKEN;
+	} else if (loader.count < PRELOAD_MAX && (p = malloc(sizeof(struct preload)))) {
+		// so the loader threads don't go and parse it again
+		p->file  = strdup(file);
+		p->state = PRELOAD_TAKEN;
+		p->cls   = NULL;
+
+		if (!p->file) {
+			free(p);
+		} else {
+			nk_htable_insert(loader.table, (unsigned long)p->file, (unsigned long)p);
+			loader.count++;
+		}
+	}
+
+	pthread_mutex_unlock(&loader.lock);
+
+	return cls;
+}
+
+
+/*
+ * Starts the threads that load classes
+ * ahead of time.
+ *
+ * @return: 0 on success, -1 otherwise.
+ *
+ */
+int
+hb_loader_init (int nr_threads)
+{
+	int i;
+
+	INIT_LIST_HEAD(&loader.queue);
+
+	loader.table = nk_create_htable(0, preload_hash_fn, preload_eq_fn);
+
+	if (!loader.table) {
+		HB_ERR("Could not create preload table\n");
+		return -1;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_t t;
+
+		if (pthread_create(&t, NULL, loader_thread, NULL) != 0) {
+			HB_ERR("Could not create loader thread\n");
+			return -1;
+		}
+
+		pthread_detach(t);
+	}
+
+	loader.nr_threads = nr_threads;
+
+	CL_DEBUG("Started %d class loader threads\n", nr_threads);
+
+	return 0;
+}
+
+
+/*
+ * TODO: should throw a ClassNotFoundException on error
+ */
+java_class_t * 
+hb_load_class (const char * path)
+{
+	java_class_t * cls = NULL;
+	const char * file  = NULL;
+	char buf[512];
+
+	file = class_file_name(path, buf);
+
+	cls = take_preloaded(file);
+
+	if (!cls) {
+		cls = find_class_file(file);
+
+		if (!cls) {
+			return NULL;
+		}
+
+		queue_refs(cls);
+	}
+
+	hb_cds_record(file, cls);
+
+	cls->name   = hb_intern_str(path);
 
 	CL_DEBUG("Class file (for class %s) verified and loaded\n", hb_get_class_name(cls));
 
-	cls->field_vals = malloc(sizeof(var_t)*cls->fields_count);
+	cls->field_vals = hb_meta_alloc(&cls->meta, sizeof(var_t)*cls->fields_count);
 	if (!cls->field_vals) {
 		HB_ERR("Could not allocate class fields\n");
 		return NULL;
 	}
-	memset(cls->field_vals, 0, sizeof(var_t)*cls->fields_count);
 
 	cls->status = CLS_LOADED;
 	
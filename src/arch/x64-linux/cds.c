@@ -0,0 +1,637 @@
+/*
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the
+ * file "LICENSE.txt".
+ */
+
+/*
+ * Class data sharing. With --dump-cds, every class we parse
+ * is copied (as it is right after parsing, before it's prepped)
+ * into one buffer, which is written out as an archive when
+ * we exit. With --cds, that archive is mapped at startup and
+ * hb_load_class() uses the classes in it instead of parsing
+ * their class files again.
+ *
+ * Pointers in the archive are laid out for it being mapped at
+ * the base recorded in its header, and the archive carries a
+ * bitmap with a bit for every word that holds one. If we can't
+ * get the mapping at that base, we just slide all of them.
+ * The mapping is private, so the classes in it get written
+ * (prepped, resolved) like any other.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <hawkbeans.h>
+#include <hb_util.h>
+#include <types.h>
+#include <constants.h>
+#include <class.h>
+
+#include <arch/x64-linux/cds.h>
+#include <arch/x64-linux/classpath.h>
+
+#define CDS_MAGIC    0x53444348 // "HCDS"
+#define CDS_VERSION  2
+#define CDS_BASE     0x500000000000UL // where we'd like archives to be mapped
+#define CDS_BUF_INIT (1UL << 20)
+
+struct cds_header {
+	u4 magic;
+	u4 version;
+
+	// the archive is only good for a build with the same layout
+	u2 class_size;
+	u2 method_size;
+	u2 field_size;
+	u2 code_size;
+
+	u4 nr_classes;
+	u8 base;    // address the pointers in the archive assume
+	u8 size;    // of the whole archive
+	u8 classes; // offset of the class table (sorted by file name)
+	u8 ptrmap;  // offset of the pointer bitmap
+	u8 nr_ptr_words; // words the pointer bitmap covers
+};
+
+struct cds_class {
+	const char * file;
+	java_class_t * cls;
+
+	// to tell if the class file changed since the dump
+	u8 mtime;
+	u8 size;
+
+	u8 used; // we only hand out each class once
+};
+
+/* the archive we're using */
+static struct cds_header * archive;
+
+/* the archive we're building */
+static struct cds_dump {
+	const char * path;
+
+	u1 * data;
+	u8 len;
+	u8 cap;
+	unsigned long * ptrmap; // one bit per word of data
+
+	struct cds_class * classes; // pointers are offsets into data
+	u4 nr_classes;
+	u4 max_classes;
+} dump;
+
+#define CDS_AT(off, type) ((type*)(dump.data + (off)))
+
+
+static inline struct cds_class *
+archive_classes (void)
+{
+	return (struct cds_class*)((u1*)archive + archive->classes);
+}
+
+
+/*
+ * Slides every pointer in an archive that
+ * didn't get mapped at its base address.
+ *
+ */
+static void
+relocate (struct cds_header * hdr, u8 delta)
+{
+	unsigned long * map = (unsigned long*)((u1*)hdr + hdr->ptrmap);
+	u8 i;
+
+	for_each_set_bit(i, map, hdr->nr_ptr_words) {
+		((u8*)hdr)[i] += delta;
+	}
+
+	CL_DEBUG("Relocated CDS archive by 0x%lx\n", delta);
+}
+
+
+/*
+ * Maps a class data sharing archive made with
+ * --dump-cds so that hb_load_class() can use
+ * the classes in it.
+ *
+ * @return: 0 on success, -1 otherwise.
+ *
+ */
+int
+hb_cds_open (const char * path)
+{
+	struct cds_header hdr;
+	void * addr = NULL;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		HB_ERR("Could not open CDS archive (%s): %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    hdr.magic != CDS_MAGIC ||
+	    hdr.version != CDS_VERSION) {
+		HB_ERR("%s is not a CDS archive\n", path);
+		close(fd);
+		return -1;
+	}
+
+	if (hdr.class_size != sizeof(java_class_t) ||
+	    hdr.method_size != sizeof(method_info_t) ||
+	    hdr.field_size != sizeof(field_info_t) ||
+	    hdr.code_size != sizeof(code_attr_t)) {
+		HB_ERR("CDS archive (%s) is from a different build\n", path);
+		close(fd);
+		return -1;
+	}
+
+	addr = mmap((void*)hdr.base,
+		    hdr.size,
+		    PROT_READ|PROT_WRITE,
+		    MAP_PRIVATE,
+		    fd,
+		    0);
+
+	close(fd);
+
+	if (addr == MAP_FAILED) {
+		HB_ERR("Could not map CDS archive (%s): %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	archive = addr;
+
+	if ((u8)addr != hdr.base) {
+		relocate(archive, (u8)addr - hdr.base);
+	}
+
+	CL_DEBUG("Mapped CDS archive with %u classes at %p\n", hdr.nr_classes, addr);
+
+	return 0;
+}
+
+
+static int
+cds_class_cmp (const void * key, const void * elm)
+{
+	return strcmp((const char*)key, ((struct cds_class*)elm)->file);
+}
+
+
+/*
+ * Archived strings are plain copies, so they have to be
+ * swapped for symbols before anyone compares them.
+ */
+static void
+intern_strings (java_class_t * cls)
+{
+	int i;
+
+	for (i = 1; i < cls->const_pool_count; i++) {
+		CONSTANT_Utf8_info_t * u = (CONSTANT_Utf8_info_t*)cls->const_pool[i];
+
+		if (u && u->tag == CONSTANT_Utf8) {
+			u->bytes = (u1*)hb_intern((char*)u->bytes, u->len);
+		}
+	}
+}
+
+
+/*
+ * Looks for a class in the archive by the name of its
+ * class file. Classes whose files changed since the dump
+ * have to be parsed again.
+ *
+ * @return: the archived class, or NULL if there
+ * isn't a (usable) one
+ *
+ */
+java_class_t *
+hb_cds_find (const char * file)
+{
+	struct cds_class * c = NULL;
+	u8 mtime, size;
+
+	if (!archive) {
+		return NULL;
+	}
+
+	c = bsearch(file, archive_classes(), archive->nr_classes, sizeof(struct cds_class), cds_class_cmp);
+
+	if (!c || c->used) {
+		return NULL;
+	}
+
+	if (hb_classpath_stamp(file, &mtime, &size) != 0 ||
+	    size != c->size ||
+	    mtime != c->mtime) {
+		CL_DEBUG("Archived copy of %s is stale\n", file);
+		return NULL;
+	}
+
+	// loader threads might be after it too
+	if (__sync_lock_test_and_set(&c->used, 1)) {
+		return NULL;
+	}
+
+	intern_strings(c->cls);
+
+	return c->cls;
+}
+
+
+/*
+ * Makes room for size bytes (8-byte aligned and zeroed)
+ * at the end of the archive we're building.
+ *
+ * @return: the offset of the new space
+ *
+ */
+static u8
+cds_alloc (u8 size)
+{
+	u8 off = (dump.len + 7) & ~7UL;
+
+	if (off + size > dump.cap) {
+		u8 cap = dump.cap ? dump.cap : CDS_BUF_INIT;
+		u1 * data = NULL;
+		unsigned long * map = NULL;
+
+		while (off + size > cap) {
+			cap <<= 1;
+		}
+
+		data = realloc(dump.data, cap);
+		map  = realloc(dump.ptrmap, BITS_TO_LONGS(cap / 8) * sizeof(long));
+
+		if (!data || !map) {
+			HB_ERR("Could not grow CDS archive\n");
+			exit(EXIT_FAILURE);
+		}
+
+		memset(data + dump.cap, 0, cap - dump.cap);
+		memset((u1*)map + BITS_TO_LONGS(dump.cap / 8) * sizeof(long), 0,
+		       (BITS_TO_LONGS(cap / 8) - BITS_TO_LONGS(dump.cap / 8)) * sizeof(long));
+
+		dump.data   = data;
+		dump.ptrmap = map;
+		dump.cap    = cap;
+	}
+
+	dump.len = off + size;
+
+	return off;
+}
+
+
+/* copies something into the archive, offset 0 (the header) stands for NULL */
+static u8
+cds_copy (const void * src, u8 size)
+{
+	u8 off;
+
+	if (!src || !size) {
+		return 0;
+	}
+
+	off = cds_alloc(size);
+	memcpy(dump.data + off, src, size);
+
+	return off;
+}
+
+
+/* points the pointer at slot (an offset) at whatever is at target */
+static void
+cds_ptr (u8 slot, u8 target)
+{
+	if (!target) {
+		*CDS_AT(slot, u8) = 0;
+		return;
+	}
+
+	*CDS_AT(slot, u8) = CDS_BASE + target;
+	dump.ptrmap[BIT_WORD(slot / 8)] |= BIT_MASK(slot / 8);
+}
+
+
+static u8
+const_size (const_pool_info_t * c)
+{
+	switch (c->tag) {
+		case CONSTANT_Class:
+			return sizeof(CONSTANT_Class_info_t);
+		case CONSTANT_Fieldref:
+			return sizeof(CONSTANT_Fieldref_info_t);
+		case CONSTANT_Methodref:
+			return sizeof(CONSTANT_Methodref_info_t);
+		case CONSTANT_InterfaceMethodref:
+			return sizeof(CONSTANT_InterfaceMethodref_info_t);
+		case CONSTANT_String:
+			return sizeof(CONSTANT_String_info_t);
+		case CONSTANT_Integer:
+			return sizeof(CONSTANT_Integer_info_t);
+		case CONSTANT_Float:
+			return sizeof(CONSTANT_Float_info_t);
+		case CONSTANT_Long:
+			return sizeof(CONSTANT_Long_info_t);
+		case CONSTANT_Double:
+			return sizeof(CONSTANT_Double_info_t);
+		case CONSTANT_NameAndType:
+			return sizeof(CONSTANT_NameAndType_info_t);
+		case CONSTANT_Utf8:
+			return sizeof(CONSTANT_Utf8_info_t);
+		case CONSTANT_MethodHandle:
+			return sizeof(CONSTANT_MethodHandle_info_t);
+		case CONSTANT_MethodType:
+			return sizeof(CONSTANT_MethodType_info_t);
+		case CONSTANT_InvokeDynamic:
+			return sizeof(CONSTANT_InvokeDynamic_info_t);
+		default:
+			return 0;
+	}
+}
+
+
+static void
+dump_method (method_info_t * m, u8 moff, u8 coff)
+{
+	code_attr_t * code = m->code_attr;
+	u8 aoff = 0;
+
+	cds_ptr(moff + offsetof(method_info_t, owner), coff);
+	cds_ptr(moff + offsetof(method_info_t, alloc_sites), 0);
+
+	if (!code) {
+		cds_ptr(moff + offsetof(method_info_t, code_attr), 0);
+		cds_ptr(moff + offsetof(method_info_t, map_depth), 0);
+		cds_ptr(moff + offsetof(method_info_t, map_bits), 0);
+		return;
+	}
+
+	aoff = cds_copy(code, sizeof(code_attr_t));
+	cds_ptr(moff + offsetof(method_info_t, code_attr), aoff);
+
+	cds_ptr(aoff + offsetof(code_attr_t, code),
+		cds_copy(code->code, code->code_len));
+	cds_ptr(aoff + offsetof(code_attr_t, excp_table),
+		cds_copy(code->excp_table, sizeof(excp_table_t) * code->excp_table_len));
+
+	if (m->map_depth) {
+		cds_ptr(moff + offsetof(method_info_t, map_depth),
+			cds_copy(m->map_depth, sizeof(u2) * code->code_len));
+		cds_ptr(moff + offsetof(method_info_t, map_bits),
+			cds_copy(m->map_bits, (u8)code->code_len * m->map_stride));
+	}
+}
+
+
+/*
+ * Copies a freshly parsed class into the archive.
+ *
+ * @return: the offset of its java_class_t
+ *
+ */
+static u8
+dump_class (java_class_t * cls)
+{
+	u8 coff, poff, foff, moff;
+	u8 * cp_offs = NULL;
+	int i, j;
+
+	cp_offs = calloc(cls->const_pool_count, sizeof(u8));
+
+	if (!cp_offs) {
+		HB_ERR("Could not allocate constant offsets\n");
+		exit(EXIT_FAILURE);
+	}
+
+	coff = cds_copy(cls, sizeof(java_class_t));
+
+	// nothing the class picks up after parsing comes along
+	cds_ptr(coff + offsetof(java_class_t, attributes), 0);
+	cds_ptr(coff + offsetof(java_class_t, field_vals), 0);
+	cds_ptr(coff + offsetof(java_class_t, inst_field_infos), 0);
+	cds_ptr(coff + offsetof(java_class_t, ref_offsets), 0);
+	cds_ptr(coff + offsetof(java_class_t, inst_template), 0);
+	cds_ptr(coff + offsetof(java_class_t, super_cls), 0);
+	cds_ptr(coff + offsetof(java_class_t, name), 0);
+
+	// it starts out with an empty metaspace of its own once mapped
+	memset(CDS_AT(coff + offsetof(java_class_t, meta), u1), 0, sizeof(metaspace_t));
+
+	poff = cds_alloc(sizeof(const_pool_info_t*) * cls->const_pool_count);
+	cds_ptr(coff + offsetof(java_class_t, const_pool), poff);
+
+	for (i = 1; i < cls->const_pool_count; i++) {
+		const_pool_info_t * c = cls->const_pool[i];
+
+		if (!c) {
+			continue;
+		}
+
+		cp_offs[i] = cds_copy(c, const_size(c));
+		cds_ptr(poff + i * sizeof(const_pool_info_t*), cp_offs[i]);
+
+		// strings point into the class file, so they come along separately
+		if (c->tag == CONSTANT_Utf8) {
+			CONSTANT_Utf8_info_t * u = (CONSTANT_Utf8_info_t*)c;
+			cds_ptr(cp_offs[i] + offsetof(CONSTANT_Utf8_info_t, bytes),
+				cds_copy(u->bytes, u->len + 1));
+		}
+	}
+
+	cds_ptr(coff + offsetof(java_class_t, interfaces),
+		cds_copy(cls->interfaces, sizeof(u2) * cls->interfaces_count));
+
+	foff = cds_copy(cls->fields, sizeof(field_info_t) * cls->fields_count);
+	cds_ptr(coff + offsetof(java_class_t, fields), foff);
+
+	for (i = 0; i < cls->fields_count; i++) {
+		field_info_t * f = &cls->fields[i];
+		u8 off = foff + i * sizeof(field_info_t);
+		u8 cpe = 0;
+
+		for (j = 1; f->cpe && j < cls->const_pool_count; j++) {
+			if (cls->const_pool[j] == f->cpe) {
+				cpe = cp_offs[j];
+				break;
+			}
+		}
+
+		cds_ptr(off + offsetof(field_info_t, attrs), 0);
+		cds_ptr(off + offsetof(field_info_t, owner), coff);
+		cds_ptr(off + offsetof(field_info_t, cpe), cpe);
+		cds_ptr(off + offsetof(field_info_t, value), 0);
+	}
+
+	moff = cds_copy(cls->methods, sizeof(method_info_t) * cls->methods_count);
+	cds_ptr(coff + offsetof(java_class_t, methods), moff);
+
+	for (i = 0; i < cls->methods_count; i++) {
+		dump_method(&cls->methods[i], moff + i * sizeof(method_info_t), coff);
+	}
+
+	free(cp_offs);
+
+	return coff;
+}
+
+
+/*
+ * Adds a class we just parsed (or took from an
+ * archive, before anything touched it) to the archive
+ * we'll write out at exit, if we're making one.
+ *
+ */
+void
+hb_cds_record (const char * file, java_class_t * cls)
+{
+	struct cds_class * c = NULL;
+	u8 mtime, size;
+
+	if (!dump.path) {
+		return;
+	}
+
+	if (hb_classpath_stamp(file, &mtime, &size) != 0) {
+		return;
+	}
+
+	if (dump.nr_classes == dump.max_classes) {
+		u4 max = dump.max_classes ? dump.max_classes * 2 : 64;
+		struct cds_class * classes = realloc(dump.classes, max * sizeof(struct cds_class));
+
+		if (!classes) {
+			HB_ERR("Could not grow CDS class table\n");
+			return;
+		}
+
+		dump.classes     = classes;
+		dump.max_classes = max;
+	}
+
+	c = &dump.classes[dump.nr_classes++];
+
+	c->file  = (const char*)cds_copy(file, strlen(file) + 1);
+	c->cls   = (java_class_t*)dump_class(cls);
+	c->mtime = mtime;
+	c->size  = size;
+	c->used  = 0;
+}
+
+
+static int
+dump_class_cmp (const void * a, const void * b)
+{
+	const struct cds_class * c1 = a;
+	const struct cds_class * c2 = b;
+
+	return strcmp(CDS_AT((u8)c1->file, char), CDS_AT((u8)c2->file, char));
+}
+
+
+static void
+cds_write (void)
+{
+	struct cds_header * hdr = NULL;
+	u8 toff, moff, words;
+	u8 written = 0;
+	int fd;
+	u4 i;
+
+	qsort(dump.classes, dump.nr_classes, sizeof(struct cds_class), dump_class_cmp);
+
+	toff = cds_alloc(sizeof(struct cds_class) * dump.nr_classes);
+
+	for (i = 0; i < dump.nr_classes; i++) {
+		u8 off = toff + i * sizeof(struct cds_class);
+
+		*CDS_AT(off, struct cds_class) = dump.classes[i];
+
+		cds_ptr(off + offsetof(struct cds_class, file), (u8)dump.classes[i].file);
+		cds_ptr(off + offsetof(struct cds_class, cls), (u8)dump.classes[i].cls);
+	}
+
+	// the bitmap covers everything up to itself
+	words = (dump.len + 7) / 8;
+	moff  = cds_alloc(BITS_TO_LONGS(words) * sizeof(long));
+	memcpy(dump.data + moff, dump.ptrmap, BITS_TO_LONGS(words) * sizeof(long));
+
+	hdr = CDS_AT(0, struct cds_header);
+
+	hdr->magic        = CDS_MAGIC;
+	hdr->version      = CDS_VERSION;
+	hdr->class_size   = sizeof(java_class_t);
+	hdr->method_size  = sizeof(method_info_t);
+	hdr->field_size   = sizeof(field_info_t);
+	hdr->code_size    = sizeof(code_attr_t);
+	hdr->nr_classes   = dump.nr_classes;
+	hdr->base         = CDS_BASE;
+	hdr->size         = dump.len;
+	hdr->classes      = toff;
+	hdr->ptrmap       = moff;
+	hdr->nr_ptr_words = words;
+
+	if ((fd = open(dump.path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1) {
+		HB_ERR("Could not create CDS archive (%s): %s\n", dump.path, strerror(errno));
+		return;
+	}
+
+	while (written < dump.len) {
+		ssize_t n = write(fd, dump.data + written, dump.len - written);
+
+		if (n <= 0) {
+			HB_ERR("Could not write CDS archive (%s): %s\n", dump.path, strerror(errno));
+			break;
+		}
+
+		written += n;
+	}
+
+	close(fd);
+
+	CL_DEBUG("Wrote %u classes (%lu bytes) to CDS archive %s\n", dump.nr_classes, dump.len, dump.path);
+}
+
+
+/*
+ * Starts recording every class we load, to be
+ * written to the given archive when we exit.
+ *
+ * @return: 0 on success, -1 otherwise.
+ *
+ */
+int
+hb_cds_dump_at_exit (const char * path)
+{
+	dump.path = path;
+
+	// the header goes first, which also keeps offset 0 from meaning anything
+	cds_alloc(sizeof(struct cds_header));
+
+	if (atexit(cds_write) != 0) {
+		HB_ERR("Could not register CDS dump\n");
+		return -1;
+	}
+
+	return 0;
+}
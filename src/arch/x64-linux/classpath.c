@@ -0,0 +1,505 @@
+/*
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the
+ * file "LICENSE.txt".
+ */
+
+/*
+ * The classpath (--classpath) is a colon-separated list of
+ * directories and jar files. When we start up we index every
+ * class file on it by name (e.g. java/lang/String.class): we
+ * walk the directories, and read each jar's central directory
+ * out of its mapping. Finding a class is then one hash lookup,
+ * and the first classpath entry that has it wins.
+ *
+ * Jar entries are read straight out of the jar's mapping,
+ * compressed ones are inflated (see inflate.c) into a buffer
+ * of their own. Only plain zip files are supported, i.e. no
+ * zip64 or encryption.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <hawkbeans.h>
+#include <types.h>
+#include <class.h>
+#include <hashtable.h>
+#include <inflate.h>
+
+#include <arch/x64-linux/classpath.h>
+
+#define ZIP_EOCD_SIG   0x06054b50
+#define ZIP_CDIR_SIG   0x02014b50
+#define ZIP_LOCAL_SIG  0x04034b50
+#define ZIP_EOCD_LEN   22
+#define ZIP_CDIR_LEN   46
+#define ZIP_LOCAL_LEN  30
+#define ZIP_MAX_COMMENT 0xffff
+
+#define ZIP_STORED   0
+#define ZIP_DEFLATED 8
+
+struct cp_jar {
+	const char * path;
+	u1 * data;
+	u8 size;
+	u8 mtime;
+};
+
+/* a class file somewhere on the classpath */
+struct cp_entry {
+	const char * name; // relative to its classpath entry
+	const char * path; // the file, for ones in directories
+	struct cp_jar * jar;
+
+	// for jar entries
+	u4 offset; // of the local header
+	u4 csize;
+	u4 usize;
+	u2 method;
+};
+
+static struct nk_hashtable * cp_index;
+
+
+static inline u2
+le_u2 (const u1 * p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+static inline u4
+le_u4 (const u1 * p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u4)p[3] << 24);
+}
+
+
+static inline int
+is_class_file (const char * name, u4 len)
+{
+	return len > 6 && strncmp(name + len - 6, ".class", 6) == 0;
+}
+
+
+static unsigned
+cp_hash_fn (unsigned long key)
+{
+	char * buf = (char*)key;
+	return nk_hash_buffer((unsigned char*)buf, strlen(buf));
+}
+
+
+static int
+cp_eq_fn (unsigned long k1, unsigned long k2)
+{
+	return strcmp((char*)k1, (char*)k2) == 0;
+}
+
+
+/*
+ * Adds a class file to the index unless an earlier
+ * classpath entry already has one by that name.
+ *
+ */
+static int
+add_entry (struct cp_entry * e)
+{
+	struct cp_entry * new = NULL;
+
+	if (nk_htable_search(cp_index, (unsigned long)e->name)) {
+		free((void*)e->name);
+		free((void*)e->path);
+		return 0;
+	}
+
+	new = malloc(sizeof(struct cp_entry));
+
+	if (!new) {
+		HB_ERR("Could not allocate classpath entry\n");
+		return -1;
+	}
+
+	*new = *e;
+
+	if (!nk_htable_insert(cp_index, (unsigned long)new->name, (unsigned long)new)) {
+		HB_ERR("Could not index %s\n", new->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int
+index_dir (const char * root, const char * rel)
+{
+	char path[PATH_MAX];
+	struct dirent * d = NULL;
+	DIR * dir = NULL;
+
+	snprintf(path, PATH_MAX, "%s%s%s", root, *rel ? "/" : "", rel);
+
+	if (!(dir = opendir(path))) {
+		HB_ERR("Could not open classpath directory (%s): %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while ((d = readdir(dir))) {
+		char name[PATH_MAX];
+		struct stat s;
+
+		if (d->d_name[0] == '.') {
+			continue;
+		}
+
+		if (snprintf(name, PATH_MAX, "%s%s%s", rel, *rel ? "/" : "", d->d_name) >= PATH_MAX ||
+		    snprintf(path, PATH_MAX, "%s/%s", root, name) >= PATH_MAX) {
+			continue;
+		}
+
+		if (d->d_type == DT_UNKNOWN || d->d_type == DT_LNK) {
+			if (stat(path, &s) != 0) {
+				continue;
+			}
+			d->d_type = S_ISDIR(s.st_mode) ? DT_DIR : DT_REG;
+		}
+
+		if (d->d_type == DT_DIR) {
+			if (index_dir(root, name) != 0) {
+				closedir(dir);
+				return -1;
+			}
+		} else if (d->d_type == DT_REG && is_class_file(d->d_name, strlen(d->d_name))) {
+			struct cp_entry e;
+
+			memset(&e, 0, sizeof(e));
+			e.name = strdup(name);
+			e.path = strdup(path);
+
+			if (!e.name || !e.path || add_entry(&e) != 0) {
+				closedir(dir);
+				return -1;
+			}
+		}
+	}
+
+	closedir(dir);
+
+	return 0;
+}
+
+
+static const u1 *
+find_eocd (struct cp_jar * jar)
+{
+	const u1 * p = NULL;
+	const u1 * stop = NULL;
+
+	if (jar->size < ZIP_EOCD_LEN) {
+		return NULL;
+	}
+
+	// it's at the end, unless there's a comment after it
+	p    = jar->data + jar->size - ZIP_EOCD_LEN;
+	stop = jar->size > ZIP_EOCD_LEN + ZIP_MAX_COMMENT ? p - ZIP_MAX_COMMENT : jar->data;
+
+	for (; p >= stop; p--) {
+		if (le_u4(p) == ZIP_EOCD_SIG) {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+
+static int
+index_jar (const char * path)
+{
+	struct cp_jar * jar = NULL;
+	const u1 * eocd = NULL;
+	const u1 * p = NULL;
+	struct stat s;
+	u4 i, count, cdir_off;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		HB_ERR("Could not open jar (%s): %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &s) == -1) {
+		HB_ERR("Could not stat jar (%s): %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	jar = malloc(sizeof(struct cp_jar));
+
+	if (!jar) {
+		HB_ERR("Could not allocate jar\n");
+		close(fd);
+		return -1;
+	}
+
+	jar->path  = path;
+	jar->size  = s.st_size;
+	jar->mtime = (u8)s.st_mtim.tv_sec * 1000000000UL + s.st_mtim.tv_nsec;
+	jar->data  = mmap(NULL, jar->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (jar->data == MAP_FAILED) {
+		HB_ERR("Could not map jar (%s): %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (!(eocd = find_eocd(jar))) {
+		HB_ERR("%s is not a jar file\n", path);
+		return -1;
+	}
+
+	count    = le_u2(eocd + 10);
+	cdir_off = le_u4(eocd + 16);
+
+	if (cdir_off >= jar->size) {
+		HB_ERR("Bad central directory in %s (zip64 isn't supported)\n", path);
+		return -1;
+	}
+
+	p = jar->data + cdir_off;
+
+	for (i = 0; i < count; i++) {
+		struct cp_entry e;
+		u2 name_len;
+
+		if (p + ZIP_CDIR_LEN > jar->data + jar->size || le_u4(p) != ZIP_CDIR_SIG) {
+			HB_ERR("Bad central directory entry %u in %s\n", i, path);
+			return -1;
+		}
+
+		name_len = le_u2(p + 28);
+
+		if (p + ZIP_CDIR_LEN + name_len > jar->data + jar->size) {
+			HB_ERR("Bad central directory entry %u in %s\n", i, path);
+			return -1;
+		}
+
+		if (is_class_file((const char*)p + ZIP_CDIR_LEN, name_len)) {
+
+			memset(&e, 0, sizeof(e));
+			e.jar    = jar;
+			e.method = le_u2(p + 10);
+			e.csize  = le_u4(p + 20);
+			e.usize  = le_u4(p + 24);
+			e.offset = le_u4(p + 42);
+			e.name   = strndup((const char*)p + ZIP_CDIR_LEN, name_len);
+
+			if (!e.name || add_entry(&e) != 0) {
+				return -1;
+			}
+		}
+
+		p += ZIP_CDIR_LEN + name_len + le_u2(p + 30) + le_u2(p + 32);
+	}
+
+	CL_DEBUG("Indexed %u entries in %s\n", count, path);
+
+	return 0;
+}
+
+
+/*
+ * Builds the class index for the given classpath
+ * (a colon-separated list of directories and jars).
+ *
+ * @return: 0 on success, -1 otherwise.
+ *
+ */
+int
+hb_classpath_init (const char * classpath)
+{
+	char * cp = strdup(classpath);
+	char * save = NULL;
+	char * ent = NULL;
+
+	cp_index = nk_create_htable(0, cp_hash_fn, cp_eq_fn);
+
+	if (!cp || !cp_index) {
+		HB_ERR("Could not create classpath index\n");
+		return -1;
+	}
+
+	for (ent = strtok_r(cp, ":", &save); ent; ent = strtok_r(NULL, ":", &save)) {
+		struct stat s;
+
+		if (stat(ent, &s) != 0) {
+			HB_ERR("Could not find classpath entry (%s): %s\n", ent, strerror(errno));
+			return -1;
+		}
+
+		if (S_ISDIR(s.st_mode)) {
+			if (index_dir(ent, "") != 0) {
+				return -1;
+			}
+		} else if (index_jar(ent) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+static u1 *
+read_jar_entry (struct cp_entry * e)
+{
+	struct cp_jar * jar = e->jar;
+	const u1 * local = jar->data + e->offset;
+	const u1 * data = NULL;
+	u1 * buf = NULL;
+
+	if (e->offset + (u8)ZIP_LOCAL_LEN > jar->size || le_u4(local) != ZIP_LOCAL_SIG) {
+		HB_ERR("Bad local header for %s in %s\n", e->name, jar->path);
+		return NULL;
+	}
+
+	// the local header has its own (possibly different) extra field
+	data = local + ZIP_LOCAL_LEN + le_u2(local + 26) + le_u2(local + 28);
+
+	if (data + e->csize > jar->data + jar->size) {
+		HB_ERR("Truncated entry for %s in %s\n", e->name, jar->path);
+		return NULL;
+	}
+
+	switch (e->method) {
+		case ZIP_STORED:
+			return (u1*)data;
+		case ZIP_DEFLATED:
+			buf = malloc(e->usize);
+			if (!buf) {
+				HB_ERR("Could not allocate buffer for %s\n", e->name);
+				return NULL;
+			}
+			if (hb_inflate(buf, e->usize, data, e->csize) != 0) {
+				HB_ERR("Could not inflate %s in %s\n", e->name, jar->path);
+				free(buf);
+				return NULL;
+			}
+			return buf;
+		default:
+			HB_ERR("Unsupported compression (%d) for %s in %s\n", e->method, e->name, jar->path);
+			return NULL;
+	}
+}
+
+
+static u1 *
+read_file_entry (struct cp_entry * e)
+{
+	struct stat s;
+	void * cm = NULL;
+	int fd;
+
+	if ((fd = open(e->path, O_RDONLY)) == -1) {
+		HB_ERR("Could not open file (%s): %s\n", e->path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &s) == -1) {
+		HB_ERR("Could not stat file (%s): %s\n", e->path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	cm = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (cm == MAP_FAILED) {
+		HB_ERR("Could not map file (%s): %s\n", e->path, strerror(errno));
+		return NULL;
+	}
+
+	return (u1*)cm;
+}
+
+
+/*
+ * Gets the contents of a class file
+ * (e.g. java/lang/String.class) from the classpath.
+ *
+ * @return: the class file's bytes, NULL if it's not
+ * on the classpath (or there is no classpath)
+ *
+ */
+u1 *
+hb_classpath_open (const char * file)
+{
+	struct cp_entry * e = NULL;
+
+	if (!cp_index) {
+		return NULL;
+	}
+
+	e = (struct cp_entry*)nk_htable_search(cp_index, (unsigned long)file);
+
+	if (!e) {
+		return NULL;
+	}
+
+	return e->jar ? read_jar_entry(e) : read_file_entry(e);
+}
+
+
+/*
+ * Gets the size and modification time of a class file
+ * (by way of its jar if it's in one), so we can tell
+ * if it changed.
+ *
+ * @return: 0 on success, -1 if there's no such file.
+ *
+ */
+int
+hb_classpath_stamp (const char * file, u8 * mtime, u8 * size)
+{
+	struct cp_entry * e = NULL;
+	struct stat s;
+
+	if (cp_index) {
+		e = (struct cp_entry*)nk_htable_search(cp_index, (unsigned long)file);
+	}
+
+	if (e && e->jar) {
+		*mtime = e->jar->mtime;
+		*size  = e->usize;
+		return 0;
+	}
+
+	if (stat(e ? e->path : file, &s) != 0) {
+		return -1;
+	}
+
+	*mtime = (u8)s.st_mtim.tv_sec * 1000000000UL + s.st_mtim.tv_nsec;
+	*size  = s.st_size;
+
+	return 0;
+}
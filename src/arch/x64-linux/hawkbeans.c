@@ -14,20 +14,28 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
+#include <unistd.h>
 
 #include <hawkbeans.h>
+#include <hb_util.h>
 #include <bc_interp.h>
 #include <class.h>
+#include <constants.h>
 #include <thread.h>
 #include <stack.h>
 #include <mm.h>
 #include <gc.h>
 
 #include <arch/x64-linux/bootstrap_loader.h>
+#include <arch/x64-linux/cds.h>
+#include <arch/x64-linux/classpath.h>
 
 jthread_t * cur_thread;
 
+#define HB_MAX_LOADER_THREADS 8L
+
 static void
 version (void)
 {
@@ -45,9 +53,25 @@ usage (const char * prog)
 	fprintf(stderr, "Arguments:\n\n");
 	fprintf(stderr, " %20.20s Print the version number and exit\n", "--version, -V");
 	fprintf(stderr, " %20.20s Print this message\n", "--help, -h");
-	fprintf(stderr, " %20.20s Set the heap size (in MB). Default is 1MB.\n", "--heap-size, -H");
+	fprintf(stderr, " %20.20s Set the initial heap size (in MB). Default is 1MB.\n", "--heap-size, -H");
+	fprintf(stderr, " %20.20s Set the maximum heap size (in MB). Default is 512MB.\n", "--max-heap-size, -M");
+	fprintf(stderr, " %20.20s Set the initial (-Xms) or maximum (-Xmx) heap size, e.g. -Xmx64m\n", "-Xms<size>, -Xmx<size>");
+	fprintf(stderr, " %20.20s Objects of %dKB and up go in a separate %luMB large object space, which the heap size doesn't limit\n", "", HB_LOS_MIN_OBJ >> 10, HB_LOS_DEFAULT_SIZE >> 20);
+	fprintf(stderr, " %20.20s Back the heap with transparent huge pages\n", "-XX:+UseTransparentHugePages");
+	fprintf(stderr, " %20.20s Fault in heap memory as soon as it's committed\n", "-XX:+AlwaysPreTouch");
+	fprintf(stderr, " %20.20s Print per-class metadata usage at exit\n", "-XX:+PrintMetaspace");
 	fprintf(stderr, " %20.20s Trace the Garbage Collector\n", "--trace-gc, -t");
-	fprintf(stderr, " %20.20s GC collection interval in ms\n", "--gc-interval, -c");
+	fprintf(stderr, " %20.20s Also collect at least every N ms\n", "--gc-interval, -c");
+	fprintf(stderr, " %20.20s Number of threads the GC marks with. Default is 1.\n", "--gc-threads, -g");
+	fprintf(stderr, " %20.20s Mark the heap concurrently with the program\n", "--gc-concurrent, -C");
+	fprintf(stderr, " %20.20s Collect incrementally, pausing for at most about this long (in us)\n", "--gc-pause-target-us, -P");
+	fprintf(stderr, " %20.20s Evacuate the emptiest heap regions (within the pause target)\n", "--gc-regions, -R");
+	fprintf(stderr, " %20.20s Log each GC cycle (as JSON) to a file\n", "--gc-log, -L");
+	fprintf(stderr, " %20.20s Make Strings with the same contents share their arrays\n", "--gc-dedup-strings, -D");
+	fprintf(stderr, " %20.20s Colon-separated directories and jars to load classes from\n", "--classpath, -p");
+	fprintf(stderr, " %20.20s Threads that parse classes ahead of time. Default is one less than the number of CPUs, at most %ld.\n", "--loader-threads, -l", HB_MAX_LOADER_THREADS);
+	fprintf(stderr, " %20.20s Use the classes in a class data sharing archive\n", "--cds, -s");
+	fprintf(stderr, " %20.20s Write the classes this run loads to a class data sharing archive\n", "--dump-cds, -S");
 	fprintf(stderr, "\n\n");
 	exit(EXIT_SUCCESS);
 }
@@ -57,17 +81,40 @@ static struct option long_options[] = {
 	{"help", no_argument, 0, 'h'},
 	{"version", no_argument, 0, 'V'},
 	{"heap-size", required_argument, 0, 'H'},
+	{"max-heap-size", required_argument, 0, 'M'},
 	{"trace-gc", no_argument, 0, 't'},
 	{"gc-interval", required_argument, 0, 'c'},
+	{"gc-threads", required_argument, 0, 'g'},
+	{"gc-concurrent", no_argument, 0, 'C'},
+	{"gc-pause-target-us", required_argument, 0, 'P'},
+	{"gc-regions", no_argument, 0, 'R'},
+	{"gc-log", required_argument, 0, 'L'},
+	{"gc-dedup-strings", no_argument, 0, 'D'},
+	{"classpath", required_argument, 0, 'p'},
+	{"loader-threads", required_argument, 0, 'l'},
+	{"cds", required_argument, 0, 's'},
+	{"dump-cds", required_argument, 0, 'S'},
 	{0, 0, 0, 0}
 };
 
 
 static struct gopts {
-	int heap_size_megs;
+	u8 heap_init_size;
+	u8 heap_max_size;
+	int heap_flags;
 	int trace_gc;
 	const char * class_path;
 	int gc_interval;
+	int gc_threads;
+	int gc_mode;
+	int gc_pause_target_us;
+	const char * gc_log;
+	int gc_dedup;
+	const char * classpath;
+	int loader_threads;
+	const char * cds;
+	const char * dump_cds;
+	int print_metaspace;
 } glob_opts;
 
 
@@ -83,7 +130,7 @@ create_argv_array (int argc, char ** argv)
 		return NULL;
 	}
 
-	arr_obj = (native_obj_t*)arr->heap_ptr;
+	arr_obj = arr;
 
 	for (i = 0; i < argc; i++) {
 		obj_ref_t * str_obj = string_object_alloc(argv[i]);
@@ -91,21 +138,50 @@ create_argv_array (int argc, char ** argv)
 			HB_ERR("Could not create string object for argv array\n");
 			return NULL;
 		}
-		arr_obj->fields[i].obj = str_obj;
+		hb_store_ref(&HB_ARRAY_ELEMS(arr_obj, hb_ref_t)[i], str_obj);
+		gc_post_barrier(arr_obj, str_obj);
 	}
 	
 	return arr;
 }
 
 
+/*
+ * Parses a size with an optional k, m, or g suffix
+ * (in bytes if there is no suffix).
+ */
+static u8
+parse_size (const char * str)
+{
+	char * end = NULL;
+	u8 size = strtoul(str, &end, 10);
+
+	switch (*end) {
+		case 'g': case 'G':
+			size <<= 10;
+		case 'm': case 'M':
+			size <<= 10;
+		case 'k': case 'K':
+			size <<= 10;
+			break;
+		default:
+			break;
+	}
+
+	return size;
+}
+
+
 static void
 parse_args (int argc, char ** argv)
 {
 	int c;
 
+	glob_opts.loader_threads = -1;
+
 	while (1) {
 		int opt_idx = 0;
-		c = getopt_long(argc, argv, "c:hVH:t", long_options, &opt_idx);
+		c = getopt_long(argc, argv, "c:CDg:hl:L:VH:M:p:P:Rs:S:X:t", long_options, &opt_idx);
 		
 		if (c == -1) {
 			break;
@@ -123,8 +199,57 @@ parse_args (int argc, char ** argv)
 			case 'c':
 				glob_opts.gc_interval = atoi(optarg);
 				break;
+			case 'g':
+				glob_opts.gc_threads = atoi(optarg);
+				break;
+			case 'C':
+				glob_opts.gc_mode = GC_MODE_CONCURRENT;
+				break;
+			case 'P':
+				glob_opts.gc_pause_target_us = atoi(optarg);
+				break;
+			case 'R':
+				glob_opts.gc_mode = GC_MODE_REGIONS;
+				break;
+			case 'L':
+				glob_opts.gc_log = optarg;
+				break;
+			case 'D':
+				glob_opts.gc_dedup = 1;
+				break;
+			case 'p':
+				glob_opts.classpath = optarg;
+				break;
+			case 'l':
+				glob_opts.loader_threads = atoi(optarg);
+				break;
+			case 's':
+				glob_opts.cds = optarg;
+				break;
+			case 'S':
+				glob_opts.dump_cds = optarg;
+				break;
 			case 'H': 
-				glob_opts.heap_size_megs = atoi(optarg);
+				glob_opts.heap_init_size = (u8)atoi(optarg) << 20;
+				break;
+			case 'M': 
+				glob_opts.heap_max_size = (u8)atoi(optarg) << 20;
+				break;
+			case 'X':
+				if (strncmp(optarg, "ms", 2) == 0) {
+					glob_opts.heap_init_size = parse_size(optarg + 2);
+				} else if (strncmp(optarg, "mx", 2) == 0) {
+					glob_opts.heap_max_size = parse_size(optarg + 2);
+				} else if (strcmp(optarg, "X:+UseTransparentHugePages") == 0) {
+					glob_opts.heap_flags |= HB_HEAP_HUGEPAGES;
+				} else if (strcmp(optarg, "X:+AlwaysPreTouch") == 0) {
+					glob_opts.heap_flags |= HB_HEAP_PRETOUCH;
+				} else if (strcmp(optarg, "X:+PrintMetaspace") == 0) {
+					glob_opts.print_metaspace = 1;
+				} else {
+					HB_ERR("Unknown option: -X%s\n", optarg);
+					usage(argv[0]);
+				}
 				break;
 			case 't':
 				glob_opts.trace_gc = 1;
@@ -136,6 +261,16 @@ parse_args (int argc, char ** argv)
 		}
 	}
 
+	// by default the loader threads get every CPU but ours
+	if (glob_opts.loader_threads < 0) {
+		glob_opts.loader_threads = min(sysconf(_SC_NPROCESSORS_ONLN) - 1, HB_MAX_LOADER_THREADS);
+	}
+
+	// a pause target on its own means incremental collection
+	if (glob_opts.gc_pause_target_us && glob_opts.gc_mode == GC_MODE_STW) {
+		glob_opts.gc_mode = GC_MODE_INCREMENTAL;
+	}
+
 	if (optind >= argc) {
 		usage(argv[0]);
 	}
@@ -159,11 +294,38 @@ main (int argc, char ** argv)
 	parse_args(argc, argv);
 
 	/* setup the heap using default sizes */
-	heap_init(glob_opts.heap_size_megs);
+	if (heap_init(glob_opts.heap_init_size, glob_opts.heap_max_size, glob_opts.heap_flags) != 0) {
+		HB_ERR("Could not initialize heap\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (hb_symtab_init() != 0) {
+		exit(EXIT_FAILURE);
+	}
 
 	/* initialize the hashtable that stores loaded classes */
 	hb_classmap_init();
 
+	if (glob_opts.print_metaspace) {
+		atexit(hb_print_metaspace);
+	}
+
+	if (glob_opts.classpath && hb_classpath_init(glob_opts.classpath) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (glob_opts.cds && hb_cds_open(glob_opts.cds) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (glob_opts.dump_cds && hb_cds_dump_at_exit(glob_opts.dump_cds) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (glob_opts.loader_threads > 0 && hb_loader_init(glob_opts.loader_threads) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
 	cls = hb_load_class(glob_opts.class_path);
 
 	if (!cls) {
@@ -171,6 +333,18 @@ main (int argc, char ** argv)
 		exit(EXIT_FAILURE);
 	}
 
+	/*
+	 * register the base class under its own name so that
+	 * references to it find this copy instead of loading
+	 * it again
+	 */
+	hb_add_class(hb_get_const_str(((CONSTANT_Class_info_t*)cls->const_pool[cls->this])->name_idx, cls), cls);
+
+	if (hb_prep_class(cls) != 0) {
+		HB_ERR("Could not prep base class (%s)\n", glob_opts.class_path);
+		exit(EXIT_FAILURE);
+	}
+
 	obj = object_alloc(cls);
 
 	main_idx    = hb_get_method_idx("main", cls);
@@ -192,10 +366,16 @@ main (int argc, char ** argv)
 		exit(EXIT_FAILURE);
 	}
 
-	gc_init(main_thread, obj, glob_opts.trace_gc, glob_opts.gc_interval);
+	gc_init(main_thread, obj, glob_opts.trace_gc, glob_opts.gc_interval, glob_opts.gc_threads, glob_opts.gc_mode, glob_opts.gc_pause_target_us);
+
+	if (glob_opts.gc_log && gc_open_log(main_thread, glob_opts.gc_log) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (glob_opts.gc_dedup && gc_enable_dedup(main_thread) != 0) {
+		exit(EXIT_FAILURE);
+	}
 
-	gc_insert_ref(jargv);
-	
 	hb_exec(main_thread);
 
 	HB_DEBUG("======= HAWKBEANS EXIT ========\n");
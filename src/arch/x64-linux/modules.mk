@@ -1,3 +1,5 @@
 
 SRC += src/arch/x64-linux/hawkbeans.c \
-       src/arch/x64-linux/bootstrap_loader.c
+       src/arch/x64-linux/bootstrap_loader.c \
+       src/arch/x64-linux/cds.c \
+       src/arch/x64-linux/classpath.c
@@ -468,111 +468,77 @@ handle_aload_3 (u1 * bc, java_class_t * cls) {
 	DO_ALOADN(3);
 }
 
-static int
-handle_iaload (u1 * bc, java_class_t * cls) {
-	var_t idx = pop_val();
-	var_t a = pop_val();
-	var_t res;
-	obj_ref_t * ref = a.obj;
-	native_obj_t * arr;
-	
-	if (!ref) {
-		hb_throw_and_create_excp(EXCP_NULL_PTR);
-		return -ESHOULD_BRANCH;
-	}
-
-	arr = (native_obj_t*)ref->heap_ptr;
-	
-	if (idx.int_val > arr->flags.array.length - 1) {
-		hb_throw_and_create_excp(EXCP_ARR_IDX_OOB);
-		return -ESHOULD_BRANCH;
+/*
+ * Array elements are packed at their natural width, so
+ * the load and store handlers only differ in the element
+ * type and the var_t member it goes through.
+ */
+#define DO_ARR_CHECK(arr, idx) \
+	if (!(arr)) { \
+		hb_throw_and_create_excp(EXCP_NULL_PTR); \
+		return -ESHOULD_BRANCH; \
+	} \
+	if ((u4)(idx).int_val >= (u4)(arr)->flags.array.length) { \
+		hb_throw_and_create_excp(EXCP_ARR_IDX_OOB); \
+		return -ESHOULD_BRANCH; \
 	}
 
-	res.int_val = arr->fields[idx.int_val].int_val;
-
-	push_val(res);
-	
+#define DO_ARR_LOAD(ctype, member) \
+	var_t idx = pop_val(); \
+	var_t a = pop_val(); \
+	native_obj_t * arr = a.obj; \
+	var_t res; \
+	DO_ARR_CHECK(arr, idx); \
+	res.member = HB_ARRAY_ELEMS(arr, ctype)[idx.int_val]; \
+	push_val(res); \
 	return 1;
+
+static int
+handle_iaload (u1 * bc, java_class_t * cls) {
+	DO_ARR_LOAD(i4, int_val);
 }
 
 static int
 handle_laload (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_LOAD(u8, long_val);
 }
 
 static int
 handle_faload (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_LOAD(f4, float_val);
 }
 
 static int
 handle_daload (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_LOAD(d8, dbl_val);
 }
 
 static int
 handle_aaload (u1 * bc, java_class_t * cls) {
 	var_t idx = pop_val();
-	var_t arr = pop_val();
-	obj_ref_t * arr_ref = arr.obj;
-	native_obj_t * arr_obj = NULL;
-
-	if (!arr_ref) {
-		hb_throw_and_create_excp(EXCP_NULL_PTR);
-		return -ESHOULD_BRANCH;
-	}
-
-	arr_obj = (native_obj_t*)arr_ref->heap_ptr;
-
-	if (idx.int_val > arr_obj->flags.array.length - 1) {
-		hb_throw_and_create_excp(EXCP_ARR_IDX_OOB);
-		return -ESHOULD_BRANCH;
-	}
-
-	push_val(arr_obj->fields[idx.int_val]);
-
+	var_t a = pop_val();
+	native_obj_t * arr = a.obj;
+	var_t res;
+	DO_ARR_CHECK(arr, idx);
+	res.obj = hb_load_ref(&HB_ARRAY_ELEMS(arr, hb_ref_t)[idx.int_val]);
+	push_val(res);
 	return 1;
 }
 
+// also used for boolean arrays
 static int
 handle_baload (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_LOAD(i1, int_val);
 }
 
 static int
 handle_caload (u1 * bc, java_class_t * cls) {
-	var_t idx = pop_val();
-	var_t aref = pop_val();
-	var_t res;
-	native_obj_t * arr;
-
-	if (!aref.obj) {
-		hb_throw_and_create_excp(EXCP_NULL_PTR);
-		return -ESHOULD_BRANCH;
-	}
-
-	arr = (native_obj_t*)aref.obj->heap_ptr;
-
-	if (idx.int_val > arr->flags.array.length - 1) {
-		hb_throw_and_create_excp(EXCP_ARR_IDX_OOB);
-		return -ESHOULD_BRANCH;
-	}
-
-	res.int_val = (int)arr->fields[idx.int_val].char_val;
-		
-	push_val(res);
-
-	return 1;
+	DO_ARR_LOAD(u2, int_val);
 }
 
 static int
 handle_saload (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_LOAD(i2, int_val);
 }
 
 // WRITE ME
@@ -759,113 +725,63 @@ handle_astore_3 (u1 * bc, java_class_t * cls) {
 	DO_ASTOREN(3);
 }
 
+#define DO_ARR_STORE(ctype, member) \
+	var_t v = pop_val(); \
+	var_t idx = pop_val(); \
+	var_t a = pop_val(); \
+	native_obj_t * arr = a.obj; \
+	DO_ARR_CHECK(arr, idx); \
+	HB_ARRAY_ELEMS(arr, ctype)[idx.int_val] = (ctype)v.member; \
+	return 1;
+
 static int
 handle_iastore (u1 * bc, java_class_t * cls) {
-	var_t v = pop_val(); 
-	var_t idx = pop_val();
-	var_t a = pop_val();
-	obj_ref_t * ref = a.obj;
-	native_obj_t * arr;
-	
-	if (!ref) {
-		hb_throw_and_create_excp(EXCP_NULL_PTR);
-		return -ESHOULD_BRANCH;
-	}
-
-	arr = (native_obj_t*)ref->heap_ptr;
-	
-	if (idx.int_val > arr->flags.array.length - 1) {
-		hb_throw_and_create_excp(EXCP_ARR_IDX_OOB);
-		return -ESHOULD_BRANCH;
-	}
-
-	arr->fields[idx.int_val].int_val = v.int_val;
-	
-	return 1;
+	DO_ARR_STORE(i4, int_val);
 }
 
 static int
 handle_lastore (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_STORE(u8, long_val);
 }
 
 static int
 handle_fastore (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_STORE(f4, float_val);
 }
 
 static int
 handle_dastore (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_STORE(d8, dbl_val);
 }
 
+// TODO: type checking
 static int
 handle_aastore (u1 * bc, java_class_t * cls) {
-	var_t val = pop_val();
+	var_t v = pop_val();
 	var_t idx = pop_val();
-	var_t arr = pop_val();
-	obj_ref_t * arr_ref = arr.obj;
-	native_obj_t * arr_obj = NULL;
-
-	if (!arr_ref) {
-		hb_throw_and_create_excp(EXCP_NULL_PTR);
-		return -ESHOULD_BRANCH;
-	}
-
-	arr_obj = (native_obj_t*)arr_ref->heap_ptr;
-
-	if (idx.int_val > arr_obj->flags.array.length - 1) {
-		hb_throw_and_create_excp(EXCP_ARR_IDX_OOB);
-		return -ESHOULD_BRANCH;
-	}
-
-	// TODO: type checking
-	arr_obj->fields[idx.int_val] = val;
-
+	var_t a = pop_val();
+	native_obj_t * arr = a.obj;
+	DO_ARR_CHECK(arr, idx);
+	gc_write_barrier(hb_load_ref(&HB_ARRAY_ELEMS(arr, hb_ref_t)[idx.int_val]));
+	hb_store_ref(&HB_ARRAY_ELEMS(arr, hb_ref_t)[idx.int_val], v.obj);
+	gc_post_barrier(arr, v.obj);
 	return 1;
 }
 
+// also used for boolean arrays
 static int
 handle_bastore (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_STORE(i1, int_val);
 }
 
 static int
 handle_castore (u1 * bc, java_class_t * cls) {
-	var_t v = pop_val(); 
-	var_t idx = pop_val();
-	var_t a = pop_val();
-	obj_ref_t * ref = a.obj;
-	native_obj_t * arr;
-	char x;
-	
-	if (!ref) {
-		hb_throw_and_create_excp(EXCP_NULL_PTR);
-		return -ESHOULD_BRANCH;
-	}
-
-	arr = (native_obj_t*)ref->heap_ptr;
-	
-	if (idx.int_val > arr->flags.array.length - 1) {
-		hb_throw_and_create_excp(EXCP_ARR_IDX_OOB);
-		return -ESHOULD_BRANCH;
-	}
-
-	x = (char)v.int_val;
-
-	arr->fields[idx.int_val].char_val = x;
-
-	return 1;
+	DO_ARR_STORE(u2, int_val);
 }
 
 static int
 handle_sastore (u1 * bc, java_class_t * cls) {
-	HB_ERR("%s NOT IMPLEMENTED\n", __func__);
-	return -1;
+	DO_ARR_STORE(i2, int_val);
 }
 
 static int
@@ -1337,11 +1253,9 @@ static int
 handle_i2c (u1 * bc, java_class_t * cls) {
 	var_t c = pop_val();
 	var_t res;
-	char x;
 
-	x = (char)c.int_val;
-	
-	res.int_val = (int)(u1)x;
+	// Java chars are 16-bit
+	res.int_val = (int)(u2)c.int_val;
 	
 	push_val(res);
 
@@ -1599,6 +1513,10 @@ handle_putstatic (u1 * bc, java_class_t * cls) {
 		return -1;
 	}
 
+	if (fi->type == T_REF) {
+		gc_write_barrier(fi->value->obj);
+	}
+
 	*(fi->value) = val;
 
 	return 3;
@@ -1606,24 +1524,24 @@ handle_putstatic (u1 * bc, java_class_t * cls) {
 
 static int
 handle_getfield (u1 * bc, java_class_t * cls) {
+	op_stack_t * stack = cur_thread->cur_frame->op_stack;
 	field_info_t * fi = NULL;
 	obj_ref_t * oref = NULL;
 	native_obj_t * obj = NULL;
-	var_t oval;
-	int val_offset;
 	u2 idx;
 	
 	idx = GET_2B_IDX(bc);
 
-	oval = pop_val();
-	oref = oval.obj;
+	// resolution can run Java code (and the GC), so the 
+	// operands stay on the stack until we're done with it
+	oref = stack->oprs[stack->sp].obj;
 
 	if (!oref) {
 		hb_throw_and_create_excp(EXCP_NULL_PTR);
 		return -ESHOULD_BRANCH;
 	}
 
-	obj = (native_obj_t*)oref->heap_ptr;
+	obj = oref;
 
 	BC_DEBUG("Getting field from obj in class %s\n", hb_get_class_name(obj->class));
 
@@ -1633,48 +1551,53 @@ handle_getfield (u1 * bc, java_class_t * cls) {
 			HB_ERR("Could not resolve field ref in %s\n", __func__);
 			return -1;
 		}
-		hb_resolve_field(fi, obj, cls, idx);
+
+		if (fi->acc_flags & ACC_STATIC) {
+			hb_throw_and_create_excp(EXCP_INCMP_CLS_CH);
+			return -ESHOULD_BRANCH;
+		}
+
+		if (hb_resolve_field(fi, obj, cls, idx) != 0) {
+			HB_ERR("Could not resolve field ref in %s\n", __func__);
+			return -1;
+		}
 	} 
 
-	val_offset = (int)(MASK_RESOLVED_BIT(cls->const_pool[idx]));
-	fi = obj->field_infos[val_offset];
+	fi = (field_info_t*)MASK_RESOLVED_BIT(cls->const_pool[idx]);
 
-	if (fi->acc_flags & ACC_STATIC) {
-		hb_throw_and_create_excp(EXCP_INCMP_CLS_CH);
-		return -ESHOULD_BRANCH;
-	}
+	// the GC may have moved it while we were resolving
+	obj = stack->oprs[stack->sp].obj;
 
 	BC_DEBUG("Getting field %s in %s (name_idx=%d) (offset is %d)\n", 
 		hb_get_const_str(fi->name_idx, fi->owner),
-		hb_get_class_name(fi->owner), fi->name_idx, val_offset);
+		hb_get_class_name(fi->owner), fi->name_idx, fi->offset);
 	
-	push_val(obj->fields[val_offset]);
+	pop_val();
+	push_val(hb_get_field(obj, fi));
 
 	return 3;
 }
 
 static int
 handle_putfield (u1 * bc, java_class_t * cls) {
+	op_stack_t * stack = cur_thread->cur_frame->op_stack;
 	field_info_t * fi = NULL;
 	obj_ref_t * oref = NULL;
 	native_obj_t * obj = NULL;
-	int val_offset;
-	var_t oval;
 	var_t val;
 	u2 idx;
 	
 	idx = GET_2B_IDX(bc);
 
-	val  = pop_val();
-	oval = pop_val();
-	oref = oval.obj;
+	// see getfield
+	oref = stack->oprs[stack->sp - 1].obj;
 
 	if (!oref) {
 		hb_throw_and_create_excp(EXCP_NULL_PTR);
 		return -ESHOULD_BRANCH;
 	}
 
-	obj = (native_obj_t*)oref->heap_ptr;
+	obj = oref;
 
 	BC_DEBUG("Putting field in obj in class %s\n", hb_get_class_name(obj->class));
 
@@ -1684,22 +1607,39 @@ handle_putfield (u1 * bc, java_class_t * cls) {
 			HB_ERR("Could not resolve field ref in %s\n", __func__);
 			return -1;
 		}
-		hb_resolve_field(fi, obj, cls, idx);
+
+		if (fi->acc_flags & ACC_STATIC) {
+			hb_throw_and_create_excp(EXCP_INCMP_CLS_CH);
+			return -ESHOULD_BRANCH;
+		}
+
+		if (hb_resolve_field(fi, obj, cls, idx) != 0) {
+			HB_ERR("Could not resolve field ref in %s\n", __func__);
+			return -1;
+		}
 	} 
 
-	val_offset = (int)(MASK_RESOLVED_BIT(cls->const_pool[idx]));
-	fi = obj->field_infos[val_offset];
+	fi = (field_info_t*)MASK_RESOLVED_BIT(cls->const_pool[idx]);
 
-	if (fi->acc_flags & ACC_STATIC) {
-		hb_throw_and_create_excp(EXCP_INCMP_CLS_CH);
-		return -ESHOULD_BRANCH;
-	}
+	// the GC may have moved it while we were resolving
+	obj = stack->oprs[stack->sp - 1].obj;
 
 	BC_DEBUG("Putting field %s in %s (name_idx=%d)\n", 
 		hb_get_const_str(fi->name_idx, fi->owner),
 		hb_get_class_name(fi->owner), fi->name_idx);
 	
-	obj->fields[val_offset] = val;
+	val = pop_val();
+	pop_val();
+
+	if (fi->type == T_REF) {
+		gc_write_barrier(hb_load_ref(HB_FIELD_PTR(obj, fi->offset, hb_ref_t)));
+	}
+
+	hb_set_field(obj, fi, val);
+
+	if (fi->type == T_REF) {
+		gc_post_barrier(obj, val.obj);
+	}
 
 	return 3;
 }
@@ -1737,7 +1677,7 @@ __invokespecial (u1 * bc, java_class_t * cls, u1 type) {
 			hb_throw_and_create_excp(EXCP_NULL_PTR);
 			return -ESHOULD_BRANCH;
 		}
-		native_obj_t * obj = (native_obj_t*)ref->heap_ptr;
+		native_obj_t * obj = ref;
 		
 		mi2 = hb_find_method_by_desc(hb_get_const_str(mi->name_idx, mi->owner),
 					   hb_get_const_str(mi->desc_idx, mi->owner),
@@ -1827,7 +1767,7 @@ handle_new (u1 * bc, java_class_t * cls) {
     return -1;
   }
     
-  oa=gc_obj_alloc(target_cls);
+  oa=gc_obj_alloc(target_cls, gc_alloc_site(cur_thread->cur_frame->minfo, cur_thread->cur_frame->pc));
 
   ret.obj = oa;
   push_val(ret);
@@ -1843,14 +1783,14 @@ handle_newarray (u1 * bc, java_class_t * cls) {
     return -ESHOULD_BRANCH;
   }
   u1 type = (u1)(bc[1]);
-  if( type < 4 && type > 13 ){
+  if( type < T_BOOLEAN || type > T_LONG ){
     HB_ERR("Invalid type\n");
     return -1;
   }
   obj_ref_t *oa = NULL;
   var_t ret;
 
-  oa = gc_array_alloc(type, count.int_val);
+  oa = gc_array_alloc(type, count.int_val, gc_alloc_site(cur_thread->cur_frame->minfo, cur_thread->cur_frame->pc));
   if(!oa){
     hb_throw_and_create_excp(EXCP_OOM);
     return -ESHOULD_BRANCH;
@@ -1884,14 +1824,14 @@ handle_anewarray (u1 * bc, java_class_t * cls) {
 		return -ESHOULD_BRANCH;
 	}
 
-	oa = gc_array_alloc(T_REF, len.int_val);
+	oa = gc_array_alloc(T_REF, len.int_val, gc_alloc_site(cur_thread->cur_frame->minfo, cur_thread->cur_frame->pc));
 
 	if (!oa) {
 		hb_throw_and_create_excp(EXCP_OOM);
 		return -ESHOULD_BRANCH;
 	}
 
-	aobj = (native_obj_t*)oa->heap_ptr;
+	aobj = oa;
 	
 	aobj->class = target_cls;
 	
@@ -1910,19 +1850,19 @@ handle_arraylength (u1 * bc, java_class_t * cls) {
   obj_ref_t* oref = v.obj;
   native_obj_t * aref;
   var_t ret;
-  enum ref_types arr_type = OBJ_ARRAY;
-
-  if(oref->type != arr_type){
-    HB_ERR("%s Array is not of type reference\n", __func__);
-    return -1;
-  }
 
   if(!oref){
     hb_throw_and_create_excp(EXCP_NULL_PTR);
     return -ESHOULD_BRANCH;
   }
 
-  aref = (native_obj_t *)oref->heap_ptr;
+  aref = oref;
+
+  if(!aref->flags.array.isarray){
+    HB_ERR("%s Array is not of type reference\n", __func__);
+    return -1;
+  }
+
   ret.int_val = aref->flags.array.length;
   push_val(ret);
   return 1;
@@ -2106,6 +2046,15 @@ hb_exec (jthread_t * t)
 
 		int ret;
 
+		/*
+		 * see if its time to GC. We do this before the next
+		 * instruction runs so that the frame matches the stack
+		 * map for its pc
+		 */
+		if (gc_should_collect(t)) {
+			gc_collect(t);
+		}
+
 		bc_ptr = t->cur_frame->minfo->code_attr->code;
 	
 		u1 opcode = bc_ptr[t->cur_frame->pc];
@@ -2114,11 +2063,6 @@ hb_exec (jthread_t * t)
 
 		ret = handlers[opcode](&bc_ptr[t->cur_frame->pc], cls);
 
-		// see if its time to GC (only if we still have a frame)
-		if (t->cur_frame && gc_should_collect(t)) {
-			gc_collect(t);
-		}
-
 #if DEBUG == 1
 		// if we pop off main frame from return, can't do this
 		if (t->cur_frame) {
@@ -13,6 +13,7 @@
  * file "LICENSE.txt".
  */
 #include <string.h>
+#include <stdlib.h>
 
 #include <class.h>
 #include <constants.h>
@@ -37,8 +38,6 @@ hb_get_classmap (void)
 /* 
  * Gets a string from the constant pool given
  * an index into the pool and an associated class.
- * If the string is not resolved, we resolve it
- * so we don't have to do the lookup again.
  *
  * @return: The string on success, NULL otherwise.
  */
@@ -51,10 +50,6 @@ hb_get_const_str (u2 idx, java_class_t * cls)
 		return NULL;
 	}
 
-	if (IS_RESOLVED(cls->const_pool[idx])) {
-		return (char*)MASK_RESOLVED_BIT(cls->const_pool[idx]);
-	} 
-
 	if (cls->const_pool[idx]->tag != CONSTANT_Utf8) {
 	  HB_ERR("Non-UTF8 constant in %s (type = %d)\n", __func__,
 		 cls->const_pool[idx]->tag);
@@ -63,7 +58,6 @@ hb_get_const_str (u2 idx, java_class_t * cls)
 
 
 	u = (CONSTANT_Utf8_info_t*)cls->const_pool[idx];
-	cls->const_pool[idx] = (const_pool_info_t*)MARK_RESOLVED(u->bytes);
 	return (char*)u->bytes;
 }
 
@@ -131,7 +125,9 @@ hb_get_super_class (java_class_t * cls)
 		return NULL;
 	}
 
-	if (IS_RESOLVED(cls->const_pool[cls->super])) {
+	if (cls->super_cls) {
+		super = cls->super_cls;
+	} else if (IS_RESOLVED(cls->const_pool[cls->super])) {
 		super = (java_class_t*)MASK_RESOLVED_BIT(cls->const_pool[cls->super]);
 	} else {
 		super = hb_resolve_class(cls->super, cls);
@@ -142,62 +138,147 @@ hb_get_super_class (java_class_t * cls)
 
 
 /*
- * Gives the number of instance vars for this object. 
- * Note this recursively applies to superclasses.
- *
+ * Maps a field descriptor to the type 
+ * of value it holds (T_*)
  */
-int 
-hb_get_obj_field_count (java_class_t * cls)
+static u1
+desc_to_type (const char * desc)
 {
-	java_class_t * super = NULL;
-	int mfc = cls->fields_count;
-	
-	super = hb_get_super_class(cls);
-	if (super) {
-		mfc += hb_get_obj_field_count(super);
+	switch (desc[0]) {
+		case 'Z': return T_BOOLEAN;
+		case 'B': return T_BYTE;
+		case 'C': return T_CHAR;
+		case 'S': return T_SHORT;
+		case 'I': return T_INT;
+		case 'F': return T_FLOAT;
+		case 'J': return T_LONG;
+		case 'D': return T_DOUBLE;
+		default:  return T_REF;
 	}
-
-	return mfc;
 }
 
 
 /*
- * Walks backwords in this object's class hierarchy
- * to initialize the instance variables for the object.
- * Sets up the fields in such a way that the fields
- * for the most elder class will appear first.
+ * Lays out the instance variables for objects of
+ * this class. The fields for the most elder class will
+ * appear first, so a field has the same offset in
+ * subclass instances. This class's own fields are packed
+ * after those, widest first, each aligned to its width.
+ * Static fields don't take up room in the object.
  *
  * @return: 0 on succes, -1 otherwise.
  *
  */
-int
-hb_setup_obj_fields (native_obj_t * obj, java_class_t * cls)
+static int
+setup_inst_layout (java_class_t * cls)
 {
-	int fc = 0;
-	int start_idx;
-	int i;
 	java_class_t * super = NULL;
+	int count = 0;
+	int refs = 0;
+	u4 off = 0;
+	int width;
+	int i;
 	
 	super = hb_get_super_class(cls);
 
-	// recur
 	if (super) {
-		start_idx = hb_setup_obj_fields(obj, super);
-	} else {
-		start_idx = 0;
+		if (super->status < CLS_PREPPED && hb_prep_class(super) != 0) {
+			HB_ERR("Could not prep superclass of %s\n", hb_get_class_name(cls));
+			return -1;
+		}
+		cls->super_cls = super;
+		count = super->inst_field_count;
+		refs  = super->ref_count;
+		off   = super->inst_size;
 	}
-	
-	fc = cls->fields_count + start_idx;
 
-	// we only setup fields for this class
-	for (i = start_idx; i < fc; i++) {
-		var_t x;
-		x.long_val = 0;
-		obj->fields[i]      = x;
-		obj->field_infos[i] = &cls->fields[i-start_idx];
+	for (i = 0; i < cls->fields_count; i++) {
+		field_info_t * f = &cls->fields[i];
+
+		f->type = desc_to_type(hb_get_const_str(f->desc_idx, cls));
+
+		if (f->acc_flags & ACC_STATIC) {
+			continue;
+		}
+
+		count++;
+
+		if (f->type == T_REF) {
+			refs++;
+		}
 	}
-	
-	return fc;
+
+	cls->inst_field_count = count;
+	cls->ref_count        = refs;
+
+	if (count > 0) {
+		cls->inst_field_infos = hb_meta_alloc(&cls->meta, sizeof(field_info_t*)*count);
+		if (!cls->inst_field_infos) {
+			HB_ERR("Could not allocate instance layout for %s\n", hb_get_class_name(cls));
+			return -1;
+		}
+	}
+
+	if (refs > 0) {
+		cls->ref_offsets = hb_meta_alloc(&cls->meta, sizeof(u4)*refs);
+		if (!cls->ref_offsets) {
+			HB_ERR("Could not allocate ref offsets for %s\n", hb_get_class_name(cls));
+			return -1;
+		}
+	}
+
+	count = 0;
+	refs  = 0;
+
+	if (super) {
+		for (; count < super->inst_field_count; count++) {
+			cls->inst_field_infos[count] = super->inst_field_infos[count];
+		}
+		for (; refs < super->ref_count; refs++) {
+			cls->ref_offsets[refs] = super->ref_offsets[refs];
+		}
+	}
+
+	for (i = 0; i < cls->fields_count; i++) {
+		if (!(cls->fields[i].acc_flags & ACC_STATIC)) {
+			cls->inst_field_infos[count++] = &cls->fields[i];
+		}
+	}
+
+	for (width = 8; width > 0; width >>= 1) {
+		for (i = 0; i < cls->fields_count; i++) {
+			field_info_t * f = &cls->fields[i];
+
+			if ((f->acc_flags & ACC_STATIC) || hb_type_size(f->type) != width) {
+				continue;
+			}
+
+			off       = (off + width - 1) & ~(width - 1);
+			f->offset = off;
+			off      += width;
+
+			if (f->type == T_REF) {
+				cls->ref_offsets[refs++] = f->offset;
+			}
+		}
+	}
+
+	cls->inst_size = off;
+
+	/* 
+	 * all fields start out with their default (zero) value,
+	 * so a new object is a copy of this with the class set
+	 */
+	cls->inst_template = hb_meta_alloc(&cls->meta, sizeof(native_obj_t) + cls->inst_size);
+
+	if (!cls->inst_template) {
+		HB_ERR("Could not allocate instance template for %s\n", hb_get_class_name(cls));
+		return -1;
+	}
+
+	cls->inst_template->class = cls;
+
+	return 0;
 }
 
 
@@ -218,8 +299,10 @@ hb_get_method_idx (const char * name, java_class_t * cls)
 {
 	int i;
 
+	name = hb_intern_str(name);
+
 	for (i = 0; i < cls->methods_count; i++) {
-		if (strcmp(name, hb_get_const_str(cls->methods[i].name_idx, cls)) == 0) {
+		if (name == hb_get_const_str(cls->methods[i].name_idx, cls)) {
 			return i;
 		}
 	}
@@ -260,7 +343,7 @@ hb_resolve_class (u2 const_idx, java_class_t * src_cls)
     java_class_t *cls = hb_get_class(class_name);
 
     if(cls){
-      const_pool_entry = (const_pool_info_t *)MARK_RESOLVED(cls);
+      src_cls->const_pool[const_idx] = (const_pool_info_t *)MARK_RESOLVED(cls);
       return cls;
     }
     
@@ -290,7 +373,7 @@ hb_get_ctor_minfo (java_class_t * cls)
 	for (i = 0; i < cls->methods_count; i++) {
 		u2 nidx = cls->methods[i].name_idx;
 		const char * tnm = hb_get_const_str(nidx, cls);
-		if (strcmp(tnm, "<init>") == 0) {
+		if (tnm == hb_sym_ctor) {
 			return &cls->methods[i];
 		}
 	
@@ -302,8 +385,8 @@ hb_get_ctor_minfo (java_class_t * cls)
 
 /*
  * Resolves a method given the methods name and 
- * descriptor. Useful for looking for methods in class
- * that is not the current class.
+ * descriptor (both symbols). Useful for looking for
+ * methods in class that is not the current class.
  *
  * @return: the method info struct of the resolved method,
  * NULL otherwise
@@ -329,7 +412,7 @@ hb_find_method_by_desc (const char * mname,
 		u2 didx = cls->methods[i].desc_idx;
 		const char * tnm = hb_get_const_str(nidx, cls);
 		const char * tds = hb_get_const_str(didx, cls);
-		if (strcmp(tnm, mname) == 0 && strcmp(tds, mdesc) == 0) {
+		if (tnm == mname && tds == mdesc) {
 		  ret = &cls->methods[i];
 		  break;
 		}
@@ -387,8 +470,8 @@ hb_resolve_method (u2 const_idx,
   
   for(i = 0; i < target_cls->methods_count; i++){
     /* FROM Target class */
-    if( !strcmp(source_method_name, hb_get_const_str(target_cls->methods[i].name_idx, target_cls)) &&
-	!strcmp(source_method_desc, hb_get_const_str(target_cls->methods[i].desc_idx, target_cls)) ){
+    if( source_method_name == hb_get_const_str(target_cls->methods[i].name_idx, target_cls) &&
+	source_method_desc == hb_get_const_str(target_cls->methods[i].desc_idx, target_cls) ){
       method = target_cls->methods+i;
       return method;
     }
@@ -464,7 +547,7 @@ hb_find_field (u2 const_idx,
 		const char * tnm = hb_get_const_str(nidx, target_cls);
 		const char * tds = hb_get_const_str(didx, target_cls);
 
-		if (strcmp(tnm, field_nm) == 0 && strcmp(tds, field_desc) == 0) {
+		if (tnm == field_nm && tds == field_desc) {
 			ret = &target_cls->fields[i];
 			break;
 		}
@@ -501,8 +584,8 @@ hb_resolve_field (field_info_t * f,
 	void * const_entry = NULL;
 	
 	// match the field to one of the object's instance vars
-	for (i = 0; i < obj->field_count; i++) {
-		if (obj->field_infos[i] == f) {
+	for (i = 0; i < obj->class->inst_field_count; i++) {
+		if (obj->class->inst_field_infos[i] == f) {
 			rslvd = 1;
 			break;
 		}
@@ -514,11 +597,11 @@ hb_resolve_field (field_info_t * f,
 	}
 	
 	/* 
-	 * we now know that this field 
-         * corresponds to offset i in the object's 
-         * field array, update the constant pool.
-         */
-	const_entry = (void*)MARK_FIELD_RESOLVED(i);
+	 * we now know that this is one of the object's 
+	 * instance fields, so we can point the constant
+	 * pool entry directly at it (it knows its offset)
+	 */
+	const_entry = (void*)MARK_FIELD_RESOLVED(f);
 
 	cls->const_pool[const_idx] = (const_pool_info_t*)const_entry;
 	
@@ -625,6 +708,11 @@ hb_prep_class (java_class_t * cls)
 		}
 	}
 
+	if (setup_inst_layout(cls) != 0) {
+		HB_ERR("Could not lay out instance fields\n");
+		return -1;
+	}
+
 	CL_DEBUG("Class prepped (static fields initialized)\n");
 
 	cls->status = CLS_PREPPED;
@@ -677,20 +765,21 @@ hb_init_class (java_class_t * cls)
 }
 
 
+/*
+ * Class names are symbols, so the hash is already
+ * there and equal names are equal pointers.
+ */
 static unsigned
 class_map_hash_fn (unsigned long key) 
 {
-	char * buf = (char*)key;
-	return nk_hash_buffer((unsigned char*)buf, strlen(buf));
+	return hb_sym_hash((const char*)key);
 }
 
 
 static int
 class_map_eq_fn (unsigned long k1, unsigned long k2)
 {
-	char * nm1 = (char*)k1;
-	char * nm2 = (char*)k2;
-	return strcmp(nm1, nm2) == 0;
+	return k1 == k2;
 }
 
 
@@ -718,7 +807,8 @@ hb_classmap_init (void)
 
 /*
  * Adds a class to the class map (based on the 
- * class name recorded in the constant pool)
+ * class name recorded in the constant pool).
+ * The name must be a symbol (see symbol.c).
  */
 void
 hb_add_class (const char * class_nm, java_class_t * cls)
@@ -729,7 +819,7 @@ hb_add_class (const char * class_nm, java_class_t * cls)
 
 /*
  * Checks if a class has been loaded into the global
- * class map.
+ * class map. The name must be a symbol.
  *
  * @return: 1 if the class has been loaded already, 0 otherwise
  *
@@ -743,7 +833,7 @@ hb_class_is_loaded (const char * class_nm)
 
 /*
  * Gets a class pointer from the global class map
- * based on the class name. 
+ * based on the class name (a symbol). 
  *
  * @return: the class pointer if the class has been loaded,
  * NULL otherwise
@@ -759,7 +849,8 @@ hb_get_class (const char * class_nm)
 /*
  * Gets a class pointer from the class map,
  * or if it doesn't exist, will load, prep,
- * and initialize the class.
+ * and initialize the class. The name is a
+ * plain C string.
  *
  * @return: the class pointer if successful, NULL
  * otherwise
@@ -767,6 +858,18 @@ hb_get_class (const char * class_nm)
  */
 java_class_t *
 hb_get_or_load_class (const char * class_nm)
+{
+	return hb_get_or_load_class_sym(hb_intern_str(class_nm));
+}
+
+
+/*
+ * Same as hb_get_or_load_class(), but for a name that's
+ * already a symbol, so we skip interning it again.
+ *
+ */
+java_class_t *
+hb_get_or_load_class_sym (const char * class_nm)
 {
 	java_class_t * cls = hb_get_class(class_nm);
 	
@@ -82,11 +82,14 @@ hb_throw_and_create_excp (u1 type)
 {
   java_class_t *class_of_exception = hb_get_or_load_class(excp_strs[type]);
   
-  obj_ref_t *object_of_class = gc_obj_alloc(class_of_exception);
+  obj_ref_t *object_of_class = gc_obj_alloc(class_of_exception, 0);
+  // the ctor can run the GC, which might move the object
+  gc_protect(&object_of_class);
   if(hb_invoke_ctor(object_of_class)){
     HB_ERR("The constructor is failed to invoke\n");
     exit(EXIT_FAILURE);
   };
+  gc_unprotect();
   hb_throw_exception(object_of_class);
   return;
 }
@@ -104,9 +107,9 @@ static char *
 get_excp_str (obj_ref_t * eref)
 {
 	char * ret;
-	native_obj_t * obj = (native_obj_t*)eref->heap_ptr;
+	native_obj_t * obj = eref;
 		
-	obj_ref_t * str_ref = obj->fields[0].obj;
+	obj_ref_t * str_ref = hb_load_ref(HB_FIELD_PTR(obj, 0, hb_ref_t));
 	native_obj_t * str_obj;
 	obj_ref_t * arr_ref;
 	native_obj_t * arr_obj;
@@ -116,20 +119,20 @@ get_excp_str (obj_ref_t * eref)
 		return NULL;
 	}
 
-	str_obj = (native_obj_t*)str_ref->heap_ptr;
+	str_obj = str_ref;
 	
-	arr_ref = str_obj->fields[0].obj;
+	arr_ref = hb_load_ref(HB_FIELD_PTR(str_obj, 0, hb_ref_t));
 
 	if (!arr_ref) {
 		return NULL;
 	}
 
-	arr_obj = (native_obj_t*)arr_ref->heap_ptr;
+	arr_obj = arr_ref;
 
 	ret = malloc(arr_obj->flags.array.length+1);
 
 	for (i = 0; i < arr_obj->flags.array.length; i++) {
-		ret[i] = arr_obj->fields[i].char_val;
+		ret[i] = HB_ARRAY_ELEMS(arr_obj, u2)[i];
 	}
 
 	ret[i] = 0;
@@ -153,7 +156,7 @@ get_excp_str (obj_ref_t * eref)
 void
 hb_throw_exception (obj_ref_t * eref)
 {
-  native_obj_t *native_object = (native_obj_t *)(eref->heap_ptr);
+  native_obj_t *native_object = eref;
   java_class_t *class_of_object = (native_object->class);
   if(!class_of_object){
     exit(EXIT_FAILURE);
@@ -167,16 +170,23 @@ hb_throw_exception (obj_ref_t * eref)
   HB_ERR("Exception in thread %s %s at %s\n", cur_thread->name, class_name_of_object,hb_get_class_name(cur_thread->class) );
   for(i = 0; i < exception_table_length; i++){
     u2 catch_type_index = exception_table[i].catch_type;
-    CONSTANT_Class_info_t *class_of_exception_caught_by_handler = (CONSTANT_Class_info_t *)class_of_object->const_pool[catch_type_index];
-    u2 name_index = class_of_exception_caught_by_handler->name_idx;
     u2 low = exception_table[i].start_pc;
     u2 high= exception_table[i].end_pc;
     u2 pc = cur_thread->cur_frame->pc;
-    const char* exception_type = hb_get_const_str(name_index, class_of_object);
-      if( in_range(low,high,pc) && !strcmp(exception_type, class_name_of_object)){
+    const char* exception_type = NULL;
+    // catch_type indexes the handler's own constant pool, and 0
+    // (a finally block) catches everything
+    if(catch_type_index != 0){
+      java_class_t *owner = method_info->owner;
+      CONSTANT_Class_info_t *class_of_exception_caught_by_handler = (CONSTANT_Class_info_t *)owner->const_pool[catch_type_index];
+      exception_type = hb_get_const_str(class_of_exception_caught_by_handler->name_idx, owner);
+    }
+      if( in_range(low,high,pc) && (catch_type_index == 0 || exception_type == class_name_of_object)){
       var_t v;
       v.obj = eref;
       op_stack_t *stack = cur_thread->cur_frame->op_stack;
+      // the handler starts with just the exception on the stack
+      stack->sp = 0;
       stack->oprs[++(stack->sp)] = v;
       cur_thread->cur_frame->pc = exception_table[i].handler_pc;
       hb_exec(cur_thread);
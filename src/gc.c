@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <sched.h>
 
 #include <mm.h>
 #include <class.h>
@@ -22,40 +23,85 @@
 #include <hashtable.h>
 #include <thread.h>
 #include <stack.h>
+#include <stackmap.h>
 #include <time.h>
 #include <gc.h>
 
 /* 
- * This implements a somewhat-precise mark-and-sweep collector
- * for Hawkbeans. Note that it's not *actually* precise since
- * we don't actually know what a reference looks like. We get
- * precision by storing every reference we allocated in a reference
- * table (a hash table). Clearly inefficient.
+ * This implements a mark-and-sweep collector for Hawkbeans. 
  *
- * Root Set: - Base object (and static fields of its class)
- * 	     - Base thread's frame (including locals and op stack)
+ * References are direct pointers to object headers on the heap. The
+ * heap keeps a bitmap of object start addresses, so we can tell
+ * whether an arbitrary word is a reference to a live object
+ * (see heap_is_obj()). Locals and operand stack slots are scanned
+ * using the stack maps built at class load time (see stackmap.c),
+ * or conservatively for methods that don't have one. Object fields 
+ * are scanned precisely using the class's reference offsets.
  *
- * When an object is allocated from the *managed* heap, 
- * a reference is also allocated from the C *unmanaged* heap. 
- * The reference is inserted by address into the ref table, and its
- * entry status is set to PRESENT.
+ * Root Set: - Base object
+ * 	     - Base thread's frames (including locals and op stack)
+ * 	     - Static fields of all loaded classes
  *
- * In the Mark phase, the ref table is scanned, and all entries have
- * their status reset to ABSENT.
+ * In the Mark phase, every object reachable from the roots gets the
+ * mark bit in its header set. Marking is transitive: newly marked
+ * objects go on a mark deque, and we keep taking objects off and
+ * marking their children until there are none left. With more than 
+ * one mark thread, each has its own deque and steals from the others
+ * when it runs dry, and mark bits are set atomically.
  *
- * We then scan the roots, and perform lookups on the ref table. This
- * is currently done on every candidate, which is dumb. If found,
- * the ref table entry is set back to PRESENT.
+ * With --gc-concurrent, only the roots are marked in a pause. A
+ * marker thread then traces the heap while the program runs. To keep
+ * it from missing anything, a write barrier logs the old value of 
+ * any reference that gets overwritten (snapshot-at-the-beginning),
+ * and objects allocated during the cycle start out marked. A short
+ * remark pause traces whatever was logged at the end, then we sweep.
  *
- * In the Sweep phase, we scan the table again. All ABSENT entries
- * are garbage. We find the object on the heap and buddy_free() it,
- * and we subsequently free() the ref table entry and its reference.
+ * With --gc-pause-target-us, the same snapshot marking is done
+ * incrementally instead, in slices at safepoints that each stop once 
+ * they've used up the pause target. The heap is then swept lazily,
+ * a slice at a time, or by the allocator when it runs out of room.
+ *
+ * With --gc-regions, a stop-the-world collection also compacts: each 
+ * heap region keeps track of how much live data it has, and the 
+ * emptiest ones are evacuated (as many as fit in the pause target).
+ * A post-write barrier keeps a remembered set per region of the 
+ * objects elsewhere that point into it, so references to moved
+ * objects can be fixed up without scanning the whole heap. Objects
+ * we only know about conservatively pin their region.
+ *
+ * In the Sweep phase, we walk all allocated objects. Unmarked objects
+ * are garbage and are given back to the allocator. Marked objects 
+ * have their mark cleared for the next cycle.
+ *
+ * Collections start at a safepoint once the heap is close to full
+ * (see gc_should_collect()). How close depends on how fast the 
+ * program is allocating and on how long a cycle takes.
  *
  */
 
 
 extern jthread_t * cur_thread;
 
+// set while a concurrent mark is running, see gc_write_barrier()
+int gc_satb_active = 0;
+
+// set in region mode, see gc_post_barrier()
+int gc_remsets_active = 0;
+
+// allocation sites (see gc_alloc_site()), 0 is for unknown sites
+struct gc_site * gc_sites = NULL;
+static u4 gc_nsites = 0;
+static u4 gc_sites_size = 0;
+
+
+static inline u8
+now_ns (void)
+{
+	struct timespec s;
+	clock_gettime(CLOCK_MONOTONIC, &s);
+	return s.tv_sec*1000000000UL + s.tv_nsec;
+}
+
 /*
  * Scan all the root nodes that have been registered
  * with the GC.
@@ -82,599 +128,3002 @@ scan_roots (gc_state_t * state)
 
 
 /*
- * Insert a reference into the ref table.
+ * Grows a mark deque. Only the owner does this. Thieves
+ * may still be reading the old buffer, so we can't free it
+ * until marking is over.
  *
  */
-static int
-ref_tbl_insert_ref (obj_ref_t * ref)
+static struct gc_deque_buf *
+deque_grow (gc_deque_t * dq, struct gc_deque_buf * old, i8 top, i8 bottom)
 {
-	gc_state_t * state = cur_thread->gc_state;
-	ref_entry_t * entry = NULL;
-	
-	entry = malloc(sizeof(ref_entry_t));
+	i8 size = old ? old->size * 2 : GC_DEQUE_INIT;
+	struct gc_deque_buf * buf = malloc(sizeof(struct gc_deque_buf) + size * sizeof(native_obj_t*));
+	i8 i;
 
-	if (!entry) {
-		HB_ERR("Could not allocate ref entry\n");
-		return -1;
+	if (!buf) {
+		HB_ERR("Could not grow GC mark deque\n");
+		return NULL;
 	}
 
-	memset(entry, 0, sizeof(ref_entry_t));
+	buf->size = size;
+	buf->prev = old;
 
-	entry->state = GC_REF_PRESENT;
-
-	if (nk_htable_insert(state->ref_tbl->htable, (unsigned long)ref, (unsigned long)entry) == 0) {
-		HB_ERR("Could not insert ref entry\n");
-		return -1;
+	for (i = top; i < bottom; i++) {
+		buf->objs[i & (size - 1)] = old->objs[i & (old->size - 1)];
 	}
-	
-	return 0;
+
+	__atomic_store_n(&dq->buf, buf, __ATOMIC_RELEASE);
+
+	return buf;
 }
 
 
-/*
- * Remove a reference from the ref table.
- *
- */
 static int
-ref_tbl_remove_ref (obj_ref_t * ref)
+deque_push (gc_deque_t * dq, native_obj_t * obj)
 {
-	ref_entry_t * entry = NULL;
-	gc_state_t * state = cur_thread->gc_state;
+	i8 b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+	i8 t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+	struct gc_deque_buf * buf = __atomic_load_n(&dq->buf, __ATOMIC_RELAXED);
 
-	entry = (ref_entry_t*)nk_htable_remove(state->ref_tbl->htable, (unsigned long)ref, 0);
-
-	if (!entry) {
-		HB_ERR("No ref entry to remove\n");
-		return -1;
+	if (!buf || b - t >= buf->size) {
+		buf = deque_grow(dq, buf, t, b);
+		if (!buf) {
+			return -1;
+		}
 	}
 
-	free(entry);
+	__atomic_store_n(&buf->objs[b & (buf->size - 1)], obj, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
 
 	return 0;
 }
 
 
 /*
- * Set all entries in the reference table to not present
- * (GC_REF_ABSENT)
+ * Owner takes from the bottom. 
+ *
+ * @return: the object, NULL if the deque is empty
  *
  */
-static int
-clear_ref_tbl (gc_state_t * state)
+static native_obj_t *
+deque_take (gc_deque_t * dq)
 {
-	struct nk_hashtable_iter * iter = nk_create_htable_iter(state->ref_tbl->htable);
-	
-	if (!iter) {
-		HB_ERR("Could not create ref table iterator in %s\n", __func__);
-		return -1;
-	}
-
-	do {
-	       	ref_entry_t * entry = (ref_entry_t *)nk_htable_get_iter_value(iter);
-		if (entry) {
-			entry->state = GC_REF_ABSENT;
+	i8 b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+	struct gc_deque_buf * buf = __atomic_load_n(&dq->buf, __ATOMIC_RELAXED);
+	native_obj_t * obj = NULL;
+	i8 t;
+
+	__atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+	if (t <= b) {
+		obj = __atomic_load_n(&buf->objs[b & (buf->size - 1)], __ATOMIC_RELAXED);
+
+		if (t == b) {
+			// last one, race with the thieves for it
+			if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+				obj = NULL;
+			}
+			__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
 		}
+	} else {
+		__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+	}
 
-	} while (nk_htable_iter_advance(iter) != 0);
-
-	nk_destroy_htable_iter(iter);
-
-	return 0;
+	return obj;
 }
 
 
 /*
- * Mark phase of the GC. Clear the ref table (set
- * all its entries to not present), then
- * begin a scan of the heap beginning at root nodes. Live
- * object refs will be set back to present, preventing
- * their collection by the GC in the sweep phase.
+ * Another thread steals from the top. 
+ *
+ * @return: the object, NULL if there was nothing to
+ * steal or we lost a race for it
  *
  */
-static int
-mark (gc_state_t * state)
+static native_obj_t *
+deque_steal (gc_deque_t * dq)
 {
+	i8 t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+	i8 b;
 
-	GC_DEBUG("BEGIN MARK PHASE\n");
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
 
-	if (clear_ref_tbl(state) != 0) {
-		HB_ERR("Could not clear ref table\n");
-		return -1;
-	}
-	
-	// scan roots will reset the status for live refs
-	if (scan_roots(state) != 0) {
-		HB_ERR("Could not scan roots\n");
-		return -1;
+	if (t < b) {
+		struct gc_deque_buf * buf = __atomic_load_n(&dq->buf, __ATOMIC_ACQUIRE);
+		native_obj_t * obj = __atomic_load_n(&buf->objs[t & (buf->size - 1)], __ATOMIC_RELAXED);
+
+		if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			return NULL;
+		}
+
+		return obj;
 	}
 
-	return 0;
+	return NULL;
+}
+
+
+static inline int
+deque_empty (gc_deque_t * dq)
+{
+	return __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE) >= __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
 }
 
 
 /*
- * Wrapper for array allocation. Allocates 
- * an array on the heap and inserts its reference
- * into the ref table.
+ * Set the mark bit in an object's header. Several
+ * threads can race to mark the same object, only 
+ * one of them wins.
+ *
+ * @return: 1 if we marked it, 0 if it was already marked
  *
  */
-obj_ref_t * 
-gc_array_alloc (u1 type, i4 count)
+static inline int
+try_mark (native_obj_t * obj)
 {
-	obj_ref_t * ref = array_alloc(type, count);
-	
-	if (!ref) {
-		HB_ERR("GC could not allocate array object\n");
-		return NULL;
-	}
+	native_obj_t m;
 
-	if (ref_tbl_insert_ref(ref) != 0) {
-		return NULL;
+	// the mark bit lives in the first byte of the header flags
+	m.flags.val = 0;
+	m.flags.obj.gc_mark = 1;
+
+	if (obj->flags.obj.gc_mark) {
+		return 0;
 	}
 
-	return ref;
+	return !(__atomic_fetch_or((u1*)&obj->flags, (u1)m.flags.val, __ATOMIC_RELAXED) & (u1)m.flags.val);
 }
 
 
 /*
- * Wrapper for String object allocation. 
- * Allocates a String object on the heap 
- * and inserts its reference in the ref table.
+ * If this is a reference to a live object
+ * that hasn't been marked yet, mark it
+ * and queue it up for scanning.
  *
  */
-obj_ref_t * 
-gc_str_obj_alloc (const char * str)
+static inline int
+mark_obj (obj_ref_t * ref, gc_worker_t * w)
 {
-	obj_ref_t * ref = string_object_alloc(str);
-	
-	if (!ref) {
-		HB_ERR("GC could not allocate string object\n");
-		return NULL;
-	}
-
-	if (ref_tbl_insert_ref(ref) != 0) {
-		return NULL;
+	if (!heap_is_obj(ref) || !try_mark(ref)) {
+		return 0;
 	}
 
-	return ref;
+	return deque_push(&w->deque, ref);
 }
 
 
 /*
- * Wrapper for object allocation. Allocates an
- * object then inserts its reference in the 
- * ref table.
+ * Roots are all scanned by the collecting 
+ * thread (worker 0). The other workers pick up
+ * from there by stealing.
  *
  */
-obj_ref_t * 
-gc_obj_alloc (java_class_t * cls)
+static int
+mark_ref (obj_ref_t * ref, gc_state_t * state)
 {
-	obj_ref_t * ref = object_alloc(cls);
-	
-	if (!ref) {
-		HB_ERR("GC could not allocate object\n");
-		return NULL;
-	}
-
-	if (ref_tbl_insert_ref(ref) != 0) {
-		return NULL;
-	}
-
-	return ref;
+	return mark_obj(ref, &state->workers[0]);
 }
 
 
 /*
- * Sweeps the reference table, collecting
- * any dead refs and the objects they point
- * to on the heap.
+ * In region mode, an object we can't update references
+ * to (because we found it conservatively) pins its region.
  *
  */
-// WRITE ME
-static int 
-sweep (gc_state_t * state)
+static void
+pin_ref (obj_ref_t * ref, gc_state_t * state)
 {
-  struct nk_hashtable_iter *iter = nk_create_htable_iter(state->ref_tbl->htable);
-  static int count = 0;
-  if(!iter){
-    HB_ERR("Could not create an interator of the reference table \n");
-    return -1;
-  }
-  do{
-    ref_entry_t *entry = (ref_entry_t *)nk_htable_get_iter_value(iter);
-    if(entry && entry->state == GC_REF_ABSENT){
-      obj_ref_t *ref = (obj_ref_t *)nk_htable_get_iter_key(iter);
-      native_obj_t *n_obj = (native_obj_t *)ref->heap_ptr;
-    //  object_free(n_obj);
-      count++;
-      ref_tbl_remove_ref(ref);
-    }
-    state->collect_stats.obj_collected = count;
-   } while( nk_htable_iter_advance(iter) != 0);
-  nk_destroy_htable_iter(iter);
-  return 0;
+	int r;
+
+	if (!state->regions || !heap_is_obj(ref)) {
+		return;
+	}
+
+	r = heap_region_of(ref);
+
+	if (r >= 0) {
+		state->regions[r].pinned = 1;
+	}
 }
 
 
-static unsigned
-ref_hash_fn (unsigned long key)
+static inline u4
+remset_hash (native_obj_t * obj, u4 size)
 {
-	return nk_hash_long(key, sizeof(unsigned long)*8);
+	return ((((u8)obj >> 4) * 0x9e3779b97f4a7c15UL) >> 32) & (size - 1);
 }
 
 
-static int
-ref_eq_fn (unsigned long k1, unsigned long k2)
+static void
+remset_insert (struct gc_remset * rs, native_obj_t * obj)
 {
-	return (k1 == k2);
+	u4 i = remset_hash(obj, rs->size);
+
+	while (rs->objs[i]) {
+		if (rs->objs[i] == obj) {
+			return;
+		}
+		i = (i + 1) & (rs->size - 1);
+	}
+
+	rs->objs[i] = obj;
+	rs->count++;
 }
 
 
 /*
- * Initializes the reference tracking table
+ * Rehashes a remembered set into a table of the 
+ * given size, dropping entries keep() says no to.
  *
  */
 static int
-init_ref_tbl (gc_state_t * state)
+remset_rehash (struct gc_remset * rs, u4 size, int (*keep)(native_obj_t * obj))
 {
-	state->ref_tbl = malloc(sizeof(gc_ref_tbl_t));
-	if (!state->ref_tbl) {
-		HB_ERR("Could not allocate ref table\n");	
+	native_obj_t ** old = rs->objs;
+	u4 old_size = rs->size;
+	u4 i;
+
+	rs->objs = calloc(size, sizeof(native_obj_t*));
+
+	if (!rs->objs) {
+		rs->objs = old;
 		return -1;
 	}
-	memset(state->ref_tbl, 0, sizeof(gc_ref_tbl_t));
-	
-	state->ref_tbl->htable = nk_create_htable(0,
-						  ref_hash_fn,
-						  ref_eq_fn);
-	
-	if (!state->ref_tbl->htable) {
-		HB_ERR("Could not creater ref hashtable\n");	
-		return -1;
+
+	rs->size  = size;
+	rs->count = 0;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i] && (!keep || keep(old[i]))) {
+			remset_insert(rs, old[i]);
+		}
 	}
 
+	free(old);
+
 	return 0;
 }
 
 
-/*
- * creates a GC root struct and adds it to 
- * the root list
- *
- */
-static int 
-add_root (void * root_ptr, 
-	  int (*scan_fn)(gc_state_t * gc_state, void * priv_data),
-	  const char * name,
-	  gc_state_t * state)
+static int
+remset_add (struct gc_remset * rs, native_obj_t * obj)
 {
-	gc_root_t * root = NULL;
-	
-	if (!root_ptr) {
-		HB_ERR("Given bad root in %s\n", __func__);
+	if ((rs->count + 1) * 2 > rs->size &&
+	    remset_rehash(rs, rs->size ? rs->size * 2 : GC_REMSET_INIT, NULL) != 0) {
 		return -1;
 	}
 
-	root = malloc(sizeof(gc_root_t));
-	
-	if (!root) {
-		HB_ERR("Could not allocate root struct\n");
-		return -1;
-	}
-	
-	memset(root, 0, sizeof(gc_root_t));
-	
-	root->ptr  = root_ptr;
-	root->scan = scan_fn;
-	root->name = name;
-
-	// add it to the root list
-	list_add(&root->link, &state->root_list);
-
-	GC_DEBUG("GC added root (%s)\n", name);
+	remset_insert(rs, obj);
 
 	return 0;
 }
 
 
-/*
- * Scan the base object reference (always
- * sets it to present). This is the reference to
- * the object for the class passed in at the command
- * line
+/* 
+ * Records that obj points to ref, if 
+ * that reference crosses regions.
  *
  */
-static int
-scan_base_ref (gc_state_t * gc_state, void * priv_data)
+static void
+remember (gc_state_t * state, native_obj_t * obj, obj_ref_t * ref)
 {
-	obj_ref_t * ref = (obj_ref_t*)priv_data;
-	ref_entry_t * ref_ent = NULL;
+	int to = heap_region_of(ref);
 
-	ref_ent = (ref_entry_t*)nk_htable_search(gc_state->ref_tbl->htable, (unsigned long) ref);
-	
-	if (!ref_ent) {
-		HB_ERR("Could not find base object reference in hash!\n");
-		return -1;
+	if (to < 0 || to == heap_region_of(obj)) {
+		return;
 	}
 
-	ref_ent->state = GC_REF_PRESENT;
-	
-	return 0;
+	if (remset_add(&state->regions[to].remset, obj) != 0) {
+		HB_ERR("Could not grow remembered set\n");
+		exit(EXIT_FAILURE);
+	}
 }
 
 
-/*
- * If this is a valid reference (i.e.,
- * it exists in the reference table), 
- * return 1, otherwise 0
- *
- */
-static inline int
-is_valid_ref (obj_ref_t * ref, gc_state_t * state)
+void
+gc_remember (native_obj_t * obj, obj_ref_t * ref)
 {
-	return nk_htable_search(state->ref_tbl->htable, (unsigned long)ref) != 0;
+	remember(cur_thread->gc_state, obj, ref);
 }
 
 
 /*
- * Mark a reference in the reference table as
- * present (alive).
+ * Where a reference points now that we've
+ * (maybe) evacuated the object.
  *
  */
-static int
-mark_ref (obj_ref_t * ref, gc_state_t * state)
+static obj_ref_t *
+forward (gc_state_t * state, obj_ref_t * ref)
 {
-	ref_entry_t * entry = NULL;
-	
-	entry = (ref_entry_t*)nk_htable_search(state->ref_tbl->htable, (unsigned long)ref);
+	u4 lo = 0;
+	u4 hi = state->nfwd;
+	int r;
 
-	if (!entry) {
-		HB_ERR("GC could not mark non-present ref\n");	
-		return -1;
+	if (!ref || (r = heap_region_of(ref)) < 0 || !state->regions[r].in_cset) {
+		return ref;
 	}
 
-	entry->state = GC_REF_PRESENT;
+	while (lo < hi) {
+		u4 mid = (lo + hi) / 2;
 
-	return 0;
-}
+		if (state->fwd[mid].from < ref) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
 
+	if (lo < state->nfwd && state->fwd[lo].from == ref) {
+		return state->fwd[lo].to;
+	}
 
+	return ref;
+}
 
 
 /*
- * look at all fields of the base object
+ * Points the given object's references at wherever
+ * their targets went, and records the ones that cross
+ * regions.
  *
- * Also look at its class static fields
  */
-// WRITE ME
-static int
-scan_base_obj (gc_state_t * gc_state, void * priv_data)
+static void
+update_refs (gc_state_t * state, native_obj_t * obj)
 {
-  native_obj_t *obj = (native_obj_t *)priv_data;
-  u2 field_count = obj->field_count;
-  u2 i;
+	hb_ref_t * slot = NULL;
+	int i;
 
-  for(i = 0; i < field_count; i++){
-    obj_ref_t *ref = obj->fields[i].obj;
-    if(is_valid_ref(ref, gc_state)){
-      mark_ref(ref, gc_state);
-    }
-  }
-  return 0;
-}
+	if (obj->flags.array.isarray) {
 
+		if (obj->flags.array.type != T_REF) {
+			return;
+		}
 
-/*
- * Scan stack frames
- */
-// WRITE ME
-static int
-scan_base_frame (gc_state_t * gc_state, void * priv_data)
-{
-  stack_frame_t *frame = (stack_frame_t *)priv_data;
-  while(frame){
-    u4 i;
-    for(i = 0; i < frame->max_locals; i++){
-      if(is_valid_ref(frame->locals[i].obj, gc_state)){
-	mark_ref(frame->locals[i].obj, gc_state);
-      }
-    }
-    op_stack_t *op_stack = frame->op_stack;
-    int current_sp = op_stack->sp;
-    while(op_stack->oprs[op_stack->sp].obj){
+		for (i = 0; i < obj->flags.array.length; i++) {
+			slot = &HB_ARRAY_ELEMS(obj, hb_ref_t)[i];
+			hb_store_ref(slot, forward(state, hb_load_ref(slot)));
+			remember(state, obj, hb_load_ref(slot));
+		}
 
-      if(is_valid_ref(op_stack->oprs[op_stack->sp].obj, gc_state)){
-	mark_ref(op_stack->oprs[op_stack->sp].obj, gc_state);
-      }
+		return;
+	}
 
-      op_stack->sp--;
-    }
-    op_stack->sp = current_sp;
-    frame = frame->next;
-  }
-  return 0;
+	for (i = 0; i < obj->class->ref_count; i++) {
+		slot = HB_FIELD_PTR(obj, obj->class->ref_offsets[i], hb_ref_t);
+		hb_store_ref(slot, forward(state, hb_load_ref(slot)));
+		remember(state, obj, hb_load_ref(slot));
+	}
 }
 
+
 /*
- * Scan the static fields for all classes that
- * have been loaded by the bootstrap loader.
+ * Mark everything the given object
+ * points to.
+ *
  */
-// WRITE ME
 static int
-scan_class_map (gc_state_t * gc_state, void * priv_data)
+scan_obj (gc_worker_t * w, native_obj_t * obj)
 {
-	
-  struct nk_hashtable *class_map = (struct nk_hashtable *)priv_data;
-  struct nk_hashtable_iter *iter = nk_create_htable_iter(class_map);
-  u2 i;
-  u2 static_fields_count = 0;
-
-  if(!iter){
-    HB_ERR("Could not create ref table iterator in %s\n", __func__);
-    return -1;
-  }
-
-  do {
-    ref_entry_t *entry = (ref_entry_t *)nk_htable_get_iter_value(iter);
-    if(entry){
-      java_class_t *class_of_object = (java_class_t *)entry;
-      for(i = 0 ; i < class_of_object->fields_count; i++){
-        if( class_of_object->fields[i].acc_flags == ACC_STATIC ){
-          static_fields_count++;
-        }
-      }
-      for(i = 0; i < static_fields_count; i++){
-        if( is_valid_ref(class_of_object->field_vals[i].obj, gc_state) ){
-          mark_ref(class_of_object->field_vals[i].obj, gc_state);
-        }
-      }
-    }
-  } while( nk_htable_iter_advance(iter) != 0);
-  nk_destroy_htable_iter(iter);
-
-  return 0;
-	
-}
+	int i;
 
+	w->scanned++;
 
-/* 
- * Determines whether or not its time to collect garbage.
- * The GC will default to a 20ms timeout. 
- *
- * @return: 1 if we should collect, 0 otherwise
- *
- */
-int
-gc_should_collect(jthread_t * t)
-{
-	gc_time_t * time = &t->gc_state->time_info;
-	struct timespec s;
-	
-	clock_gettime(CLOCK_REALTIME, &s);
+	if (obj->flags.array.isarray) {
 
-	time->time_since_collect += (s.tv_nsec/1000000) + (s.tv_sec*1000);
+		if (obj->flags.array.type != T_REF) {
+			return 0;
+		}
 
-	if (time->time_since_collect > time->interval_ms) {
-		return 1;
+		for (i = 0; i < obj->flags.array.length; i++) {
+			if (mark_obj(hb_load_ref(&HB_ARRAY_ELEMS(obj, hb_ref_t)[i]), w) != 0) {
+				return -1;
+			}
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < obj->class->ref_count; i++) {
+		obj_ref_t * ref = hb_load_ref(HB_FIELD_PTR(obj, obj->class->ref_offsets[i], hb_ref_t));
+
+		if (mark_obj(ref, w) != 0) {
+			return -1;
+		}
 	}
 
 	return 0;
 }
 
 
-/*
- * The main interface to the GC. Calling this function will
- * initiate the mark and sweep process.
- * 
- * If dump_stats is one, we will also get some verbose output
- * including how much was collected, and how much time it took.
- *
- */
-int
-gc_collect (jthread_t * t)
+static native_obj_t *
+steal_work (gc_worker_t * w)
 {
-	struct timespec s, e;
-	gc_stats_t * stats = &t->gc_state->collect_stats;
+	gc_state_t * state = w->state;
+	int i;
 
-	memset(stats, 0, sizeof(gc_stats_t));
+	if (state->nactive == 1) {
+		return NULL;
+	}
 
-	clock_gettime(CLOCK_REALTIME, &s);
+	// start from somewhere random so we don't all pile onto one victim
+	w->seed = w->seed * 1103515245 + 12345;
 
-	if (mark(t->gc_state) != 0) {
-		HB_ERR("GC could not mark\n");
-		return -1;
-	}
+	for (i = 0; i < state->nworkers; i++) {
+		gc_worker_t * victim = &state->workers[(w->seed + i) % state->nworkers];
+		native_obj_t * obj = NULL;
 
-	clock_gettime(CLOCK_REALTIME, &e);
+		if (victim == w) {
+			continue;
+		}
 
-	stats->mark_time = (e.tv_sec - s.tv_sec)*1000000000UL + (e.tv_nsec - s.tv_nsec);
-	clock_gettime(CLOCK_REALTIME, &s);
+		obj = deque_steal(&victim->deque);
 
-	if (sweep(t->gc_state) != 0) {
-		HB_ERR("GC could not sweep\n");
-		return -1;
+		if (obj) {
+			return obj;
+		}
 	}
 
-	clock_gettime(CLOCK_REALTIME, &e);
+	return NULL;
+}
 
-	stats->sweep_time = (e.tv_sec - s.tv_sec)*1000000000UL + (e.tv_nsec - s.tv_nsec);
 
-	stats->gc_time = stats->mark_time + stats->sweep_time;
+static int
+work_available (gc_state_t * state)
+{
+	int i;
 
-	if (t->gc_state->trace) {
-		HB_INFO("GC STATS:\n");
-		HB_INFO("  Objects collected: %d\n", stats->obj_collected);
-		HB_INFO("  Heap Reclaimed:    %dB\n", stats->bytes_reclaimed);
-		HB_INFO("  GC Time:           %lu.%lums\n", stats->gc_time / 1000000, stats->gc_time % 1000000);
-		HB_INFO("  |__Mark:           %lu.%lums\n", stats->mark_time / 1000000, stats->mark_time % 1000000);
-		HB_INFO("  |__Sweep:          %lu.%lums\n", stats->sweep_time / 1000000, stats->sweep_time % 1000000);
+	for (i = 0; i < state->nworkers; i++) {
+		if (!deque_empty(&state->workers[i].deque)) {
+			return 1;
+		}
 	}
 
-	// reset the timer
-	t->gc_state->time_info.time_since_collect = 0;
-
 	return 0;
 }
 
 
 /*
- * KCH NOTE: this is used for 
- * references to objects that were allocated 
- * before the GC was initialized
+ * Trace the heap from whatever is in our deque, 
+ * stealing from other workers when we run out. When 
+ * every worker is out of work at once, marking is done.
+ *
  */
-int
-gc_insert_ref (obj_ref_t * ref)
+static void
+trace_heap (gc_worker_t * w)
 {
-	return ref_tbl_insert_ref(ref);
+	gc_state_t * state = w->state;
+
+	while (1) {
+		native_obj_t * obj = NULL;
+
+		while ((obj = deque_take(&w->deque)) || (obj = steal_work(w))) {
+			if (scan_obj(w, obj) != 0) {
+				__atomic_store_n(&state->mark_failed, 1, __ATOMIC_RELAXED);
+			}
+		}
+
+		__atomic_add_fetch(&state->nidle, 1, __ATOMIC_SEQ_CST);
+
+		while (1) {
+
+			if (__atomic_load_n(&state->nidle, __ATOMIC_SEQ_CST) == state->nactive) {
+				return;
+			}
+
+			if (work_available(state)) {
+				__atomic_sub_fetch(&state->nidle, 1, __ATOMIC_SEQ_CST);
+				break;
+			}
+
+			sched_yield();
+		}
+	}
 }
 
 
 /*
- * The base object has already been allocated *outside*
- * of the GC system. We have to keep track of its reference,
- * else it will be collected (it should never be)
+ * Mark threads (other than worker 0) wait here
+ * for a collection to start.
  *
  */
-int 
-gc_init (jthread_t * main, obj_ref_t * base_obj, int trace, int interval)
+static void *
+mark_thread (void * arg)
 {
-	native_obj_t * obj = (native_obj_t*)base_obj->heap_ptr;
+	gc_worker_t * w = (gc_worker_t*)arg;
+	gc_state_t * state = w->state;
+	u4 epoch = 0;
 
-	main->gc_state = malloc(sizeof(gc_state_t));
+	while (1) {
 
-	if (!main->gc_state) {
-		HB_ERR("Could not create GC state\n");
+		pthread_mutex_lock(&state->lock);
+
+		while (state->mark_epoch == epoch) {
+			pthread_cond_wait(&state->start_cond, &state->lock);
+		}
+
+		epoch = state->mark_epoch;
+
+		pthread_mutex_unlock(&state->lock);
+
+		trace_heap(w);
+
+		pthread_mutex_lock(&state->lock);
+		state->ndone++;
+		pthread_cond_signal(&state->done_cond);
+		pthread_mutex_unlock(&state->lock);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Free the deque buffers that were 
+ * retired during marking.
+ *
+ */
+static void
+release_retired (gc_state_t * state)
+{
+	int i;
+
+	for (i = 0; i < state->nworkers; i++) {
+		struct gc_deque_buf * buf = state->workers[i].deque.buf;
+		struct gc_deque_buf * prev = buf ? buf->prev : NULL;
+
+		while (prev) {
+			struct gc_deque_buf * p = prev->prev;
+			free(prev);
+			prev = p;
+		}
+
+		if (buf) {
+			buf->prev = NULL;
+		}
+	}
+}
+
+
+/*
+ * Trace from whatever is in the mark deques until
+ * everything reachable is marked. This thread acts as
+ * worker 0, the mark threads (if any) join in.
+ *
+ */
+static void
+parallel_trace (gc_state_t * state)
+{
+	state->nidle   = 0;
+	state->ndone   = 0;
+	state->nactive = state->nworkers;
+
+	if (state->nworkers > 1) {
+		pthread_mutex_lock(&state->lock);
+		state->mark_epoch++;
+		pthread_cond_broadcast(&state->start_cond);
+		pthread_mutex_unlock(&state->lock);
+	}
+
+	trace_heap(&state->workers[0]);
+
+	if (state->nworkers > 1) {
+		pthread_mutex_lock(&state->lock);
+		while (state->ndone < state->nworkers - 1) {
+			pthread_cond_wait(&state->done_cond, &state->lock);
+		}
+		pthread_mutex_unlock(&state->lock);
+	}
+}
+
+
+static void
+begin_mark (gc_state_t * state)
+{
+	int i;
+
+	GC_DEBUG("BEGIN MARK PHASE\n");
+
+	state->mark_failed = 0;
+
+	for (i = 0; i < state->nworkers; i++) {
+		state->workers[i].scanned = 0;
+	}
+
+	for (i = 0; state->regions && i < state->nregions; i++) {
+		state->regions[i].pinned = 0;
+	}
+}
+
+
+static int
+finish_mark (gc_state_t * state)
+{
+	release_retired(state);
+
+	if (state->mark_failed) {
+		HB_ERR("Could not trace heap\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Mark phase of the GC. Begin a scan of the heap 
+ * at the root nodes. Everything reachable will
+ * have its mark bit set, preventing its collection
+ * by the GC in the sweep phase.
+ *
+ * The roots are scanned by this thread, then all
+ * the mark threads trace the heap in parallel.
+ *
+ */
+static int
+mark (gc_state_t * state)
+{
+	begin_mark(state);
+
+	if (scan_roots(state) != 0) {
+		HB_ERR("Could not scan roots\n");
+		return -1;
+	}
+
+	parallel_trace(state);
+
+	return finish_mark(state);
+}
+
+
+/*
+ * Log a reference that the mutator is about to overwrite
+ * during a concurrent mark. Filled buffers are handed off
+ * to the marker.
+ *
+ */
+void
+gc_satb_enqueue (obj_ref_t * obj)
+{
+	gc_state_t * state = cur_thread->gc_state;
+	struct gc_satb_buf * buf = state->satb_cur;
+
+	if (!buf || buf->count == GC_SATB_BUF_SIZE) {
+
+		if (buf) {
+			pthread_mutex_lock(&state->lock);
+			buf->next = state->satb_full;
+			state->satb_full = buf;
+			pthread_mutex_unlock(&state->lock);
+		}
+
+		buf = malloc(sizeof(struct gc_satb_buf));
+
+		if (!buf) {
+			HB_ERR("Could not allocate SATB buffer\n");
+			exit(EXIT_FAILURE);
+		}
+
+		buf->next  = NULL;
+		buf->count = 0;
+
+		state->satb_cur = buf;
+	}
+
+	buf->objs[buf->count++] = obj;
+}
+
+
+/*
+ * Mark everything in the filled SATB buffers.
+ *
+ * @return: the number of references we picked up
+ *
+ */
+static u4
+drain_satb (gc_state_t * state)
+{
+	struct gc_satb_buf * buf = NULL;
+	u4 n = 0;
+
+	pthread_mutex_lock(&state->lock);
+	buf = state->satb_full;
+	state->satb_full = NULL;
+	pthread_mutex_unlock(&state->lock);
+
+	while (buf) {
+		struct gc_satb_buf * next = buf->next;
+		u4 i;
+
+		for (i = 0; i < buf->count; i++) {
+			if (mark_obj(buf->objs[i], &state->workers[0]) != 0) {
+				state->mark_failed = 1;
+			}
+		}
+
+		n += buf->count;
+		free(buf);
+		buf = next;
+	}
+
+	return n;
+}
+
+
+/*
+ * The concurrent marker. Once the roots have been
+ * scanned (in the initial mark pause) this traces the
+ * heap while the mutator keeps running, picking up 
+ * references logged by the write barrier as it goes.
+ *
+ */
+static void *
+conc_mark_thread (void * arg)
+{
+	gc_state_t * state = (gc_state_t*)arg;
+
+	while (1) {
+		u8 start;
+
+		pthread_mutex_lock(&state->lock);
+
+		while (!state->conc_request) {
+			pthread_cond_wait(&state->conc_cond, &state->lock);
+		}
+
+		state->conc_request = 0;
+
+		pthread_mutex_unlock(&state->lock);
+
+		start = now_ns();
+
+		do {
+			parallel_trace(state);
+		} while (drain_satb(state) > 0);
+
+		state->collect_stats.mark_time += now_ns() - start;
+
+		__atomic_store_n(&state->conc_done, 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Starts a mark that runs alongside the mutator. We mark the
+ * roots, turn on the write barrier and start allocating
+ * objects marked.
+ *
+ */
+static int
+begin_snapshot (gc_state_t * state)
+{
+	memset(&state->collect_stats, 0, sizeof(gc_stats_t));
+
+	begin_mark(state);
+
+	if (scan_roots(state) != 0) {
+		HB_ERR("Could not scan roots\n");
+		return -1;
+	}
+
+	heap_set_alloc_marked(1);
+	gc_satb_active = 1;
+
+	return 0;
+}
+
+
+/*
+ * Hands the mutator's partly filled SATB buffer
+ * over, so it gets drained along with the rest.
+ *
+ */
+static void
+flush_satb (gc_state_t * state)
+{
+	if (state->satb_cur) {
+		state->satb_cur->next = state->satb_full;
+		state->satb_full = state->satb_cur;
+		state->satb_cur = NULL;
+	}
+}
+
+
+static int
+end_snapshot (gc_state_t * state)
+{
+	gc_satb_active = 0;
+	heap_set_alloc_marked(0);
+
+	return finish_mark(state);
+}
+
+
+/*
+ * Initial mark pause of a concurrent cycle. Once the
+ * roots are marked, we let the marker loose.
+ *
+ */
+static int
+initial_mark (gc_state_t * state)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u8 start = now_ns();
+
+	if (begin_snapshot(state) != 0) {
+		return -1;
+	}
+
+	state->conc_active = 1;
+
+	stats->mark_time  += now_ns() - start;
+	stats->pause_time += now_ns() - start;
+
+	pthread_mutex_lock(&state->lock);
+	state->conc_request = 1;
+	pthread_cond_signal(&state->conc_cond);
+	pthread_mutex_unlock(&state->lock);
+
+	return 0;
+}
+
+
+/*
+ * Remark pause. The marker is done, so all that's left
+ * are references logged since it last looked, which we 
+ * trace here.
+ *
+ */
+static int
+remark (gc_state_t * state)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u8 start = now_ns();
+
+	flush_satb(state);
+	drain_satb(state);
+
+	// the mark threads are idle, so this is just us
+	state->nidle   = 0;
+	state->nactive = 1;
+
+	trace_heap(&state->workers[0]);
+
+	state->conc_active = 0;
+	state->conc_done   = 0;
+
+	stats->mark_time  += now_ns() - start;
+	stats->pause_time += now_ns() - start;
+
+	return end_snapshot(state);
+}
+
+
+/*
+ * Wrapper for array allocation. Allocates 
+ * an array on the heap. If there's no room, we
+ * collect (see gc_collect_full()) and try again.
+ * Running out is up to the caller to report.
+ *
+ */
+obj_ref_t * 
+gc_array_alloc (u1 type, i4 count, u4 site)
+{
+	obj_ref_t * ref = array_alloc_site(type, count, site);
+
+	// the policy might not have caught up with garbage in the LOS
+	if (!ref && gc_collect_full(cur_thread) == 0) {
+		ref = array_alloc_site(type, count, site);
+	}
+	
+	if (!ref) {
+		GC_DEBUG("GC could not allocate array object\n");
+		return NULL;
+	}
+
+	return ref;
+}
+
+
+/*
+ * Wrapper for String object allocation. 
+ * Allocates a String object on the heap.
+ *
+ */
+obj_ref_t * 
+gc_str_obj_alloc (const char * str)
+{
+	obj_ref_t * ref = string_object_alloc(str);
+	
+	if (!ref) {
+		GC_DEBUG("GC could not allocate string object\n");
+		return NULL;
+	}
+
+	return ref;
+}
+
+
+/*
+ * Wrapper for object allocation. Allocates an
+ * object on the heap, collecting first if need be.
+ *
+ */
+obj_ref_t * 
+gc_obj_alloc (java_class_t * cls, u4 site)
+{
+	obj_ref_t * ref = object_alloc_site(cls, site);
+
+	if (!ref && gc_collect_full(cur_thread) == 0) {
+		ref = object_alloc_site(cls, site);
+	}
+	
+	if (!ref) {
+		GC_DEBUG("GC could not allocate object\n");
+		return NULL;
+	}
+
+	return ref;
+}
+
+
+/*
+ * Returns the id of the allocation site at the given
+ * pc of a method, creating it the first time around. Sites 
+ * are only tracked in region mode (see gc_pretenure()),
+ * otherwise this is always 0.
+ *
+ */
+u4
+gc_alloc_site (method_info_t * mi, u2 pc)
+{
+	struct gc_site * site = NULL;
+
+	if (!gc_sites) {
+		return 0;
+	}
+
+	if (!mi->alloc_sites) {
+		mi->alloc_sites = calloc(mi->code_attr->code_len, sizeof(u4));
+		if (!mi->alloc_sites) {
+			return 0;
+		}
+	}
+
+	if (mi->alloc_sites[pc]) {
+		return mi->alloc_sites[pc];
+	}
+
+	if (gc_nsites == GC_MAX_SITES) {
+		return 0;
+	}
+
+	if (gc_nsites == gc_sites_size) {
+		struct gc_site * sites = realloc(gc_sites, sizeof(struct gc_site) * gc_sites_size * 2);
+
+		if (!sites) {
+			return 0;
+		}
+
+		gc_sites       = sites;
+		gc_sites_size *= 2;
+	}
+
+	site = &gc_sites[gc_nsites];
+
+	memset(site, 0, sizeof(struct gc_site));
+	site->mi = mi;
+	site->pc = pc;
+
+	mi->alloc_sites[pc] = gc_nsites;
+
+	return gc_nsites++;
+}
+
+
+/*
+ * Keeps the object the given C variable points to
+ * alive (and the variable up to date, should the object 
+ * move) until the matching gc_unprotect(). Use this when
+ * holding a reference across something that can run Java
+ * code. Calls nest. Before gc_init() there's nothing
+ * that could move the object, so these do nothing.
+ *
+ */
+void
+gc_protect (obj_ref_t ** ref)
+{
+	gc_state_t * state = cur_thread->gc_state;
+
+	if (!state) {
+		return;
+	}
+
+	if (state->nhandles == GC_MAX_HANDLES) {
+		HB_ERR("Too many GC handles\n");
+		exit(EXIT_FAILURE);
+	}
+
+	state->handles[state->nhandles++] = ref;
+}
+
+
+void
+gc_unprotect (void)
+{
+	if (cur_thread->gc_state) {
+		cur_thread->gc_state->nhandles--;
+	}
+}
+
+
+/*
+ * Remembers a String that just survived its first
+ * collection, so we can deduplicate it when the sweep
+ * is done (see dedup_strings()).
+ *
+ */
+static void
+queue_dedup (gc_state_t * state, native_obj_t * str)
+{
+	if (state->dedup_nqueue == state->dedup_qsize) {
+		u4 size = state->dedup_qsize ? state->dedup_qsize * 2 : GC_DEDUP_INIT;
+		native_obj_t ** queue = realloc(state->dedup_queue, sizeof(native_obj_t*) * size);
+
+		// we'll just miss out on this one
+		if (!queue) {
+			return;
+		}
+
+		state->dedup_queue = queue;
+		state->dedup_qsize = size;
+	}
+
+	state->dedup_queue[state->dedup_nqueue++] = str;
+}
+
+
+static u4
+dedup_hash (native_obj_t * arr)
+{
+	u2 * chars = HB_ARRAY_ELEMS(arr, u2);
+	u4 hash = 2166136261u; // FNV-1a
+	i4 i;
+
+	for (i = 0; i < arr->flags.array.length; i++) {
+		hash = (hash ^ chars[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+
+static inline int
+same_chars (native_obj_t * a, native_obj_t * b)
+{
+	return a->flags.array.length == b->flags.array.length &&
+	       memcmp(a->fields, b->fields, a->flags.array.length * sizeof(u2)) == 0;
+}
+
+
+/*
+ * Finds the slot for an array with the given hash and 
+ * contents: either the one holding an array just like it,
+ * or the empty one where it would go.
+ *
+ */
+static struct gc_dedup_ent *
+dedup_lookup (struct gc_dedup_ent * tab, u4 size, u4 hash, native_obj_t * arr)
+{
+	u4 i = hash & (size - 1);
+
+	while (tab[i].arr && (tab[i].hash != hash || !same_chars(tab[i].arr, arr))) {
+		i = (i + 1) & (size - 1);
+	}
+
+	return &tab[i];
+}
+
+
+/*
+ * Rebuilds the dedup table at the given size, dropping
+ * arrays that didn't survive marking (if prune is set).
+ *
+ * @return: 0 on success, -1 otherwise
+ *
+ */
+static int
+dedup_rehash (gc_state_t * state, u4 size, int prune)
+{
+	struct gc_dedup_ent * tab = calloc(size, sizeof(struct gc_dedup_ent));
+	u4 i;
+
+	if (!tab) {
+		return -1;
+	}
+
+	state->dedup_count = 0;
+
+	for (i = 0; i < state->dedup_size; i++) {
+		struct gc_dedup_ent * e = &state->dedup_tab[i];
+
+		if (!e->arr || (prune && !e->arr->flags.obj.gc_mark)) {
+			continue;
+		}
+
+		*dedup_lookup(tab, size, e->hash, e->arr) = *e;
+		state->dedup_count++;
+	}
+
+	free(state->dedup_tab);
+
+	state->dedup_tab  = tab;
+	state->dedup_size = size;
+
+	return 0;
+}
+
+
+/*
+ * Is this String's constructor still running? Its
+ * array might not be filled in yet, so we leave it be.
+ * Past that, String never writes to its array (the
+ * library builds the array first and hands it to a
+ * constructor), so sharing it is safe.
+ *
+ */
+static int
+under_construction (gc_state_t * state, native_obj_t * str)
+{
+	stack_frame_t * frame = cur_thread->cur_frame;
+
+	for (; frame; frame = frame->prev) {
+		if (frame->cls == state->string_cls && 
+		    frame->max_locals > 0 &&
+		    frame->locals[0].obj == str &&
+		    hb_get_const_str(frame->minfo->name_idx, frame->cls) == hb_sym_ctor) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Makes the Strings that survived their first collection
+ * share character arrays with any others that have the same
+ * contents. Whatever arrays this frees up go in the next cycle. 
+ *
+ */
+static void
+dedup_strings (gc_state_t * state)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u4 i;
+
+	for (i = 0; i < state->dedup_nqueue; i++) {
+		native_obj_t * str = state->dedup_queue[i];
+		native_obj_t * arr = hb_load_ref(HB_FIELD_PTR(str, 0, hb_ref_t));
+		struct gc_dedup_ent * e = NULL;
+		u4 hash;
+
+		if (!arr || under_construction(state, str)) {
+			continue;
+		}
+
+		hash = dedup_hash(arr);
+		e    = dedup_lookup(state->dedup_tab, state->dedup_size, hash, arr);
+
+		if (e->arr == arr) {
+			continue;
+		}
+
+		if (e->arr) {
+			hb_store_ref(HB_FIELD_PTR(str, 0, hb_ref_t), e->arr);
+			gc_post_barrier(str, e->arr);
+
+			stats->strings_deduped++;
+			stats->dedup_bytes += object_size(arr);
+
+			continue;
+		}
+
+		e->hash = hash;
+		e->arr  = arr;
+
+		// keep it at most 3/4 full
+		if (++state->dedup_count * 4 >= state->dedup_size * 3 && 
+		    dedup_rehash(state, state->dedup_size * 2, 0) != 0) {
+			HB_ERR("Could not grow string dedup table\n");
+			break;
+		}
+	}
+
+	state->dedup_nqueue = 0;
+}
+
+
+/*
+ * Sweeps one space (given by its object iterator), 
+ * freeing any objects that weren't marked, and clearing
+ * the mark on those that were.
+ *
+ */
+static inline void
+sweep_obj (gc_state_t * state, native_obj_t * obj)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u4 site;
+	int r;
+
+	// first time we've seen it, so it counts towards its site's survival rate
+	if (gc_sites && !obj->flags.obj.survived && (site = hb_obj_site(obj))) {
+		if (obj->flags.obj.gc_mark) {
+			gc_sites[site].survived++;
+		} else {
+			gc_sites[site].died++;
+		}
+	}
+
+	if (obj->flags.obj.gc_mark) {
+
+		if (state->dedup && !obj->flags.obj.survived && obj->class == state->string_cls) {
+			queue_dedup(state, obj);
+		}
+
+		obj->flags.obj.gc_mark  = 0;
+		obj->flags.obj.survived = 1;
+
+		if (state->regions && (r = heap_region_of(obj)) >= 0) {
+			state->regions[r].live += object_size(obj);
+		}
+	} else {
+		stats->obj_collected++;
+		stats->bytes_reclaimed += object_size(obj);
+		object_free(obj);
+	}
+}
+
+
+static void
+sweep_space (gc_state_t * state, native_obj_t * (*next_obj)(native_obj_t * obj))
+{
+	native_obj_t * obj = next_obj(NULL);
+
+	while (obj) {
+		native_obj_t * next = next_obj(obj);
+		sweep_obj(state, obj);
+		obj = next;
+	}
+}
+
+
+/*
+ * Sweeps the heap and then the large
+ * object space.
+ *
+ */
+static int 
+sweep (gc_state_t * state)
+{
+	int i;
+
+	for (i = 0; state->regions && i < state->nregions; i++) {
+		state->regions[i].live = 0;
+	}
+
+	sweep_space(state, heap_next_obj);
+	sweep_space(state, los_next_obj);
+
+	return 0;
+}
+
+
+/*
+ * Incremental mode. One slice of marking: we trace 
+ * from what the mutator's write barrier logged and what's
+ * left in our deque until we run out of time.
+ *
+ * @return: 1 if marking is done, 0 otherwise
+ *
+ */
+static int
+mark_slice (gc_state_t * state, u8 deadline)
+{
+	gc_worker_t * w = &state->workers[0];
+	native_obj_t * obj = NULL;
+	u4 n = 0;
+
+	flush_satb(state);
+	drain_satb(state);
+
+	while ((obj = deque_take(&w->deque))) {
+
+		if (scan_obj(w, obj) != 0) {
+			state->mark_failed = 1;
+		}
+
+		if (++n % GC_SLICE_CHECK == 0 && now_ns() >= deadline) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/*
+ * Lazily sweeps the heap until the deadline passes 
+ * or (if bytes isn't zero) we've reclaimed at least 
+ * that much.
+ *
+ * @return: 1 if the sweep is done, 0 otherwise
+ *
+ */
+static int
+sweep_slice (gc_state_t * state, u8 deadline, u4 bytes)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u8 goal = stats->bytes_reclaimed + bytes;
+	native_obj_t * obj = NULL;
+	u4 n = 0;
+
+	while ((obj = heap_sweep_next())) {
+
+		sweep_obj(state, obj);
+
+		if (bytes && stats->bytes_reclaimed >= goal) {
+			return 0;
+		}
+
+		if (++n % GC_SLICE_CHECK == 0 && now_ns() >= deadline) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+
+/*
+ * Called by the allocator when it runs out of room. If
+ * an incremental cycle hasn't finished sweeping, we sweep 
+ * until there's (hopefully) enough free for the allocation.
+ *
+ * @return: 0 if we swept anything, -1 if there was
+ * nothing left to sweep.
+ *
+ */
+int
+gc_sweep_some (u4 bytes)
+{
+	gc_state_t * state = cur_thread ? cur_thread->gc_state : NULL;
+	gc_stats_t * stats = NULL;
+	u8 start;
+
+	// the heap is in use before the GC is up
+	if (!state || state->phase != GC_PHASE_SWEEP || !heap_sweep_pending()) {
+		return -1;
+	}
+
+	stats = &state->collect_stats;
+	start = now_ns();
+
+	sweep_slice(state, (u8)-1, bytes);
+
+	stats->sweep_time += now_ns() - start;
+	stats->pause_time += now_ns() - start;
+
+	return 0;
+}
+
+
+/*
+ * Decides which allocation sites to pretenure, based
+ * on how many of their objects survived so far.
+ *
+ */
+static void
+update_sites (gc_state_t * state)
+{
+	u4 i;
+
+	for (i = 1; i < gc_nsites; i++) {
+		struct gc_site * site = &gc_sites[i];
+		u4 samples = site->survived + site->died;
+		int pretenure;
+
+		if (samples < GC_PRETENURE_SAMPLES) {
+			continue;
+		}
+
+		pretenure = site->survived * 100UL >= GC_PRETENURE_SURVIVAL * (u8)samples;
+
+		if (pretenure != site->pretenure) {
+
+			site->pretenure = pretenure;
+			state->nr_pretenured += pretenure ? 1 : -1;
+
+			if (state->trace) {
+				HB_INFO("  %s %s.%s @%u (%lu%% survived)\n",
+					pretenure ? "Pretenuring:      " : "Not pretenuring:  ",
+					hb_get_class_name(site->mi->owner),
+					hb_get_const_str(site->mi->name_idx, site->mi->owner),
+					site->pc,
+					site->survived * 100UL / samples);
+			}
+		}
+
+		if (samples >= GC_PRETENURE_WINDOW) {
+			site->survived /= 2;
+			site->died     /= 2;
+		}
+	}
+}
+
+
+static int
+still_live (native_obj_t * obj)
+{
+	return heap_is_obj(obj) && obj->flags.obj.gc_mark;
+}
+
+
+/*
+ * Drops remembered set entries for objects that
+ * didn't survive marking.
+ *
+ */
+static void
+prune_remsets (gc_state_t * state)
+{
+	int i;
+
+	for (i = 0; i < state->nregions; i++) {
+		struct gc_remset * rs = &state->regions[i].remset;
+
+		if (rs->count && remset_rehash(rs, rs->size, still_live) != 0) {
+			HB_ERR("Could not prune remembered set\n");
+		}
+	}
+}
+
+
+/*
+ * Records every cross-region reference already on
+ * the heap (objects allocated before the GC came up
+ * didn't go through the write barrier).
+ *
+ */
+static void
+seed_remsets (gc_state_t * state)
+{
+	native_obj_t * obj = NULL;
+
+	for (obj = heap_next_obj(NULL); obj; obj = heap_next_obj(obj)) {
+		update_refs(state, obj);
+	}
+
+	for (obj = los_next_obj(NULL); obj; obj = los_next_obj(obj)) {
+		update_refs(state, obj);
+	}
+}
+
+
+struct region_live {
+	u4 idx;
+	u4 live;
+};
+
+
+static int
+cmp_live (const void * a, const void * b)
+{
+	const struct region_live * x = (const struct region_live*)a;
+	const struct region_live * y = (const struct region_live*)b;
+
+	return (x->live > y->live) - (x->live < y->live);
+}
+
+
+static int
+cmp_idx (const void * a, const void * b)
+{
+	return (*(const u4*)a > *(const u4*)b) - (*(const u4*)a < *(const u4*)b);
+}
+
+
+/*
+ * Picks the regions to evacuate: the ones with the least
+ * live data first, as long as we expect to copy them within
+ * the pause target and there's room for the copies elsewhere.
+ *
+ * @return: the number of regions picked (their indices
+ * go in cset, lowest first)
+ *
+ */
+static u4
+select_cset (gc_state_t * state, u4 * cset)
+{
+	struct region_live * cand = NULL;
+	u4 nregions = heap_committed() >> HB_REGION_ORDER;
+	u8 budget   = state->evac_rate * state->pause_target_ns / 1000;
+	u8 room     = heap_committed() - heap_used();
+	u8 copied   = 0;
+	u4 ncand    = 0;
+	u4 n        = 0;
+	u4 i;
+
+	cand = malloc(sizeof(struct region_live) * nregions);
+
+	if (!cand) {
+		return 0;
+	}
+
+	for (i = 0; i < nregions; i++) {
+		gc_region_t * r = &state->regions[i];
+
+		if (r->pinned || !r->live || r->live * 100UL >= GC_EVAC_LIVE * HB_REGION_SIZE || 
+		    heap_region_is_old(i)) {
+			continue;
+		}
+
+		cand[ncand].idx  = i;
+		cand[ncand].live = r->live;
+		ncand++;
+	}
+
+	qsort(cand, ncand, sizeof(struct region_live), cmp_live);
+
+	for (i = 0; i < ncand; i++) {
+		// free space in the region itself can't take copies
+		u8 lost = HB_REGION_SIZE - cand[i].live;
+
+		if (copied + cand[i].live > budget || 
+		    room < lost || copied + cand[i].live > room - lost) {
+			break;
+		}
+
+		room   -= lost;
+		copied += cand[i].live;
+
+		cset[n++] = cand[i].idx;
+	}
+
+	free(cand);
+
+	qsort(cset, n, sizeof(u4), cmp_idx);
+
+	return n;
+}
+
+
+static int
+add_fwd (gc_state_t * state, native_obj_t * obj)
+{
+	if (state->nfwd == state->fwd_size) {
+		u4 size = state->fwd_size ? state->fwd_size * 2 : 1024;
+		struct gc_fwd * fwd = realloc(state->fwd, sizeof(struct gc_fwd) * size);
+
+		if (!fwd) {
+			return -1;
+		}
+
+		state->fwd      = fwd;
+		state->fwd_size = size;
+	}
+
+	state->fwd[state->nfwd].from = obj;
+	state->fwd[state->nfwd].to   = obj;
+	state->nfwd++;
+
+	return 0;
+}
+
+
+/*
+ * Evacuates the regions with the most garbage. Everything 
+ * live in them is copied elsewhere, then we fix up references
+ * to the copies: from the roots, from objects outside the
+ * collection set (which we find in the regions' remembered sets),
+ * and from the copies themselves. The regions are left empty, 
+ * so their space can be coalesced and reused (or given back).
+ *
+ * An object we can't find room for stays where it is.
+ *
+ */
+static int
+evacuate (gc_state_t * state)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	struct gc_remset * old_rs = NULL;
+	u4 * cset = NULL;
+	gc_root_t * root = NULL;
+	u8 start = now_ns();
+	u8 bytes = 0;
+	u8 elapsed;
+	u4 ncset;
+	u4 i, j;
+
+	cset = malloc(sizeof(u4) * state->nregions);
+
+	if (!cset) {
+		HB_ERR("Could not allocate collection set\n");
+		return -1;
+	}
+
+	ncset = select_cset(state, cset);
+
+	if (!ncset) {
+		free(cset);
+		return 0;
+	}
+
+	old_rs = malloc(sizeof(struct gc_remset) * ncset);
+
+	if (!old_rs) {
+		HB_ERR("Could not allocate collection set\n");
+		free(cset);
+		return -1;
+	}
+
+	state->nfwd = 0;
+
+	/* 
+	 * take stock of what's in the collection set. The regions' 
+	 * remembered sets get rebuilt as we fix up references
+	 */
+	for (i = 0; i < ncset; i++) {
+		gc_region_t * r = &state->regions[cset[i]];
+		native_obj_t * obj = NULL;
+
+		r->in_cset = 1;
+		heap_set_evacuating(cset[i], 1);
+
+		old_rs[i] = r->remset;
+		memset(&r->remset, 0, sizeof(struct gc_remset));
+
+		while ((obj = heap_region_next_obj(cset[i], obj))) {
+			if (add_fwd(state, obj) != 0) {
+				HB_ERR("Could not allocate forwarding table\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	for (i = 0; i < state->nfwd; i++) {
+		native_obj_t * copy = heap_copy_obj(state->fwd[i].from);
+
+		if (copy) {
+			state->fwd[i].to = copy;
+			bytes += object_size(copy);
+		}
+	}
+
+	list_for_each_entry(root, &state->root_list, link) {
+		if (root->update) {
+			root->update(state, root->ptr);
+		}
+	}
+
+	for (i = 0; i < ncset; i++) {
+		for (j = 0; j < old_rs[i].size; j++) {
+			native_obj_t * obj = old_rs[i].objs[j];
+			int r;
+
+			if (!obj) {
+				continue;
+			}
+
+			// stale, or in the collection set itself (we get to those below)
+			r = heap_region_of(obj);
+			if ((r >= 0 && state->regions[r].in_cset) || !heap_is_obj(obj)) {
+				continue;
+			}
+
+			update_refs(state, obj);
+		}
+	}
+
+	for (i = 0; i < state->nfwd; i++) {
+		update_refs(state, state->fwd[i].to);
+	}
+
+	for (i = 0; i < state->nfwd; i++) {
+		if (state->fwd[i].to != state->fwd[i].from) {
+			object_free(state->fwd[i].from);
+		}
+	}
+
+	for (i = 0; i < ncset; i++) {
+		state->regions[cset[i]].in_cset = 0;
+		heap_set_evacuating(cset[i], 0);
+		free(old_rs[i].objs);
+	}
+
+	state->nfwd = 0;
+
+	elapsed = (now_ns() - start) / 1000;
+
+	// don't trust the timing of tiny evacuations
+	if (bytes >= HB_REGION_SIZE / 4 && elapsed) {
+		state->evac_rate = (state->evac_rate + bytes / elapsed) / 2;
+	}
+
+	stats->bytes_evacuated   = bytes;
+	stats->regions_evacuated = ncset;
+
+	free(old_rs);
+	free(cset);
+
+	return 0;
+}
+
+
+/*
+ * creates a GC root struct and adds it to 
+ * the root list
+ *
+ */
+static int 
+add_root (void * root_ptr, 
+	  int (*scan_fn)(gc_state_t * gc_state, void * priv_data),
+	  void (*update_fn)(gc_state_t * gc_state, void * priv_data),
+	  const char * name,
+	  gc_state_t * state)
+{
+	gc_root_t * root = NULL;
+	
+	if (!root_ptr) {
+		HB_ERR("Given bad root in %s\n", __func__);
+		return -1;
+	}
+
+	root = malloc(sizeof(gc_root_t));
+	
+	if (!root) {
+		HB_ERR("Could not allocate root struct\n");
+		return -1;
+	}
+	
+	memset(root, 0, sizeof(gc_root_t));
+	
+	root->ptr    = root_ptr;
+	root->scan   = scan_fn;
+	root->update = update_fn;
+	root->name   = name;
+
+	// add it to the root list
+	list_add(&root->link, &state->root_list);
+
+	GC_DEBUG("GC added root (%s)\n", name);
+
+	return 0;
+}
+
+
+/*
+ * Scan the base object. This is the object 
+ * for the class passed in at the command line
+ * (it should never be collected).
+ *
+ */
+static int
+scan_base_obj (gc_state_t * gc_state, void * priv_data)
+{
+	// we only have the one pointer to it, so it can't move
+	pin_ref((obj_ref_t*)priv_data, gc_state);
+
+	return mark_ref((obj_ref_t*)priv_data, gc_state);
+}
+
+
+/*
+ * References C code has asked us to look after
+ * (see gc_protect()).
+ *
+ */
+static int
+scan_handles (gc_state_t * gc_state, void * priv_data)
+{
+	int i;
+
+	for (i = 0; i < gc_state->nhandles; i++) {
+		if (mark_ref(*gc_state->handles[i], gc_state) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+static void
+update_handles (gc_state_t * gc_state, void * priv_data)
+{
+	int i;
+
+	for (i = 0; i < gc_state->nhandles; i++) {
+		*gc_state->handles[i] = forward(gc_state, *gc_state->handles[i]);
+	}
+}
+
+
+/*
+ * The dedup table is weak: it doesn't keep arrays alive
+ * (dead ones are dropped before sweeping), but has to 
+ * follow the ones that move.
+ *
+ */
+static int
+scan_dedup (gc_state_t * gc_state, void * priv_data)
+{
+	return 0;
+}
+
+
+static void
+update_dedup (gc_state_t * gc_state, void * priv_data)
+{
+	u4 i;
+
+	for (i = 0; i < gc_state->dedup_size; i++) {
+		gc_state->dedup_tab[i].arr = forward(gc_state, gc_state->dedup_tab[i].arr);
+	}
+}
+
+
+/*
+ * Scan a frame for a method we have no stack map for. 
+ * We don't know which locals and operand stack slots hold 
+ * references, so anything that looks like a pointer to an 
+ * object is treated as one.
+ *
+ */
+static int
+scan_frame_conservative (gc_state_t * gc_state, stack_frame_t * frame)
+{
+	op_stack_t * op_stack = frame->op_stack;
+	int i;
+
+	for (i = 0; i < frame->max_locals; i++) {
+		pin_ref(frame->locals[i].obj, gc_state);
+		if (mark_ref(frame->locals[i].obj, gc_state) != 0) {
+			return -1;
+		}
+	}
+
+	// slot 0 is never used, sp points to the top element
+	for (i = 1; op_stack && i <= op_stack->sp; i++) {
+		pin_ref(op_stack->oprs[i].obj, gc_state);
+		if (mark_ref(op_stack->oprs[i].obj, gc_state) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * The stack map for a frame's current pc. Frames below 
+ * the top one are stopped in the middle of an invoke (or a 
+ * class init), which only ever pops operands, so the map from
+ * the start of the instruction still describes what's left on
+ * their stack.
+ *
+ * @return: the map bits, NULL if there's no map we can use
+ *
+ */
+static u1 *
+frame_map (stack_frame_t * frame)
+{
+	method_info_t * mi = frame->minfo;
+
+	if (!mi->map_bits || 
+	    frame->pc >= mi->code_attr->code_len ||
+	    mi->map_depth[frame->pc] == SM_UNREACHED ||
+	    frame->op_stack->sp > mi->map_depth[frame->pc]) {
+		return NULL;
+	}
+
+	return hb_stack_map_bits(mi, frame->pc);
+}
+
+
+/*
+ * Scans a frame using the stack map for its current pc,
+ * so we only look at slots that actually hold references.
+ *
+ */
+static int
+scan_frame (gc_state_t * gc_state, stack_frame_t * frame)
+{
+	op_stack_t * op_stack = frame->op_stack;
+	u1 * bits = frame_map(frame);
+	int i;
+
+	if (!bits) {
+		return scan_frame_conservative(gc_state, frame);
+	}
+
+	for (i = 0; i < frame->max_locals; i++) {
+		if (hb_stack_map_is_ref(bits, i) &&
+		    mark_ref(frame->locals[i].obj, gc_state) != 0) {
+			return -1;
+		}
+	}
+
+	for (i = 1; i <= op_stack->sp; i++) {
+		if (hb_stack_map_is_ref(bits, frame->max_locals + i - 1) &&
+		    mark_ref(op_stack->oprs[i].obj, gc_state) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+ * Scan all the stack frames, starting from the base frame.
+ *
+ */
+static int
+scan_base_frame (gc_state_t * gc_state, void * priv_data)
+{
+	stack_frame_t * frame = (stack_frame_t*)priv_data;
+
+	while (frame) {
+
+		if (scan_frame(gc_state, frame) != 0) {
+			return -1;
+		}
+
+		frame = frame->next;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Fixes up references in a frame after evacuation. Frames
+ * without a usable map were scanned conservatively, which 
+ * pinned anything they point to, so there's nothing to do.
+ *
+ */
+static void
+update_frame (gc_state_t * gc_state, stack_frame_t * frame)
+{
+	op_stack_t * op_stack = frame->op_stack;
+	u1 * bits = frame_map(frame);
+	int i;
+
+	if (!bits) {
+		return;
+	}
+
+	for (i = 0; i < frame->max_locals; i++) {
+		if (hb_stack_map_is_ref(bits, i)) {
+			frame->locals[i].obj = forward(gc_state, frame->locals[i].obj);
+		}
+	}
+
+	for (i = 1; i <= op_stack->sp; i++) {
+		if (hb_stack_map_is_ref(bits, frame->max_locals + i - 1)) {
+			op_stack->oprs[i].obj = forward(gc_state, op_stack->oprs[i].obj);
+		}
+	}
+}
+
+
+static void
+update_base_frame (gc_state_t * gc_state, void * priv_data)
+{
+	stack_frame_t * frame = (stack_frame_t*)priv_data;
+
+	while (frame) {
+		update_frame(gc_state, frame);
+		frame = frame->next;
+	}
+}
+
+
+/*
+ * Scan the static fields for all classes that
+ * have been loaded by the bootstrap loader.
+ */
+static int
+scan_class_map (gc_state_t * gc_state, void * priv_data)
+{
+	struct nk_hashtable * class_map = (struct nk_hashtable*)priv_data;
+	struct nk_hashtable_iter * iter = nk_create_htable_iter(class_map);
+	int i;
+
+	if (!iter) {
+		HB_ERR("Could not create class map iterator in %s\n", __func__);
+		return -1;
+	}
+
+	do {
+		java_class_t * cls = (java_class_t*)nk_htable_get_iter_value(iter);
+
+		if (!cls || !cls->field_vals) {
+			continue;
+		}
+
+		for (i = 0; i < cls->fields_count; i++) {
+			if (!(cls->fields[i].acc_flags & ACC_STATIC)) {
+				continue;
+			}
+
+			if (mark_ref(cls->field_vals[i].obj, gc_state) != 0) {
+				nk_destroy_htable_iter(iter);
+				return -1;
+			}
+		}
+
+	} while (nk_htable_iter_advance(iter) != 0);
+
+	nk_destroy_htable_iter(iter);
+
+	return 0;
+}
+
+
+static void
+update_class_map (gc_state_t * gc_state, void * priv_data)
+{
+	struct nk_hashtable * class_map = (struct nk_hashtable*)priv_data;
+	struct nk_hashtable_iter * iter = nk_create_htable_iter(class_map);
+	int i;
+
+	if (!iter) {
+		HB_ERR("Could not create class map iterator in %s\n", __func__);
+		exit(EXIT_FAILURE);
+	}
+
+	do {
+		java_class_t * cls = (java_class_t*)nk_htable_get_iter_value(iter);
+
+		if (!cls || !cls->field_vals) {
+			continue;
+		}
+
+		for (i = 0; i < cls->fields_count; i++) {
+			if ((cls->fields[i].acc_flags & ACC_STATIC) && cls->fields[i].type == T_REF) {
+				cls->field_vals[i].obj = forward(gc_state, cls->field_vals[i].obj);
+			}
+		}
+
+	} while (nk_htable_iter_advance(iter) != 0);
+
+	nk_destroy_htable_iter(iter);
+}
+
+
+/*
+ * The share of run time (in percent) that the
+ * mutator has spent stopped for the GC.
+ *
+ */
+static u8
+gc_overhead (gc_state_t * state, u8 now)
+{
+	gc_policy_t * p = &state->policy;
+
+	return p->pause_ns * 100 / (now - p->start_ns + 1);
+}
+
+
+/*
+ * Works out how full the heap can get before we start
+ * the next collection. Ideally that's GC_TRIGGER_OCCUPANCY
+ * percent, but the mutator keeps allocating until we
+ * look again (and in concurrent and incremental mode,
+ * until the cycle is done), so we start early enough for
+ * that to fit. 
+ *
+ */
+static void
+set_trigger (gc_state_t * state, u8 now)
+{
+	gc_policy_t * p = &state->policy;
+	u8 committed = heap_committed();
+	u8 limit     = committed * GC_TRIGGER_OCCUPANCY / 100;
+	u8 floor     = p->used_after + committed * GC_MIN_ALLOC / 100;
+	u8 horizon   = GC_POLICY_TICK_US * 1000;
+	u8 headroom;
+
+	if (state->mode == GC_MODE_CONCURRENT || state->mode == GC_MODE_INCREMENTAL) {
+		horizon += p->cycle_ns;
+	}
+
+	headroom = p->alloc_rate * horizon / 1000000;
+
+	// starting early would only make things worse
+	if (gc_overhead(state, now) > GC_GROW_OVERHEAD) {
+		headroom = 0;
+	}
+
+	p->heap_trigger = (limit > headroom) ? limit - headroom : 0;
+
+	if (p->heap_trigger < floor) {
+		p->heap_trigger = floor;
+	}
+}
+
+
+/*
+ * Takes a new sample of the allocation rate.
+ *
+ */
+static void
+sample_alloc_rate (gc_state_t * state, u8 now)
+{
+	gc_policy_t * p = &state->policy;
+	u8 alloc = heap_total_alloc();
+	u8 rate  = (alloc - p->tick_alloc) * 1000000 / (now - p->tick_ns);
+
+	p->alloc_rate = p->alloc_rate ? (3 * p->alloc_rate + rate) / 4 : rate;
+	p->tick_ns    = now;
+	p->tick_alloc = alloc;
+}
+
+
+/* 
+ * Determines whether or not its time to collect garbage.
+ * Outside of a cycle, that's when the heap (or the large
+ * object space) fills up past the trigger set by the policy
+ * (see set_trigger()), or when the interval given with 
+ * --gc-interval is up. We look at the clock only every 
+ * GC_POLICY_CHECK safepoints.
+ *
+ * @return: 1 if we should collect, 0 otherwise
+ *
+ */
+int
+gc_should_collect(jthread_t * t)
+{
+	gc_state_t * state = t->gc_state;
+	gc_policy_t * p = &state->policy;
+	u8 now;
+
+	// in a concurrent cycle, we're waiting on the marker
+	if (state->conc_active) {
+		return __atomic_load_n(&state->conc_done, __ATOMIC_ACQUIRE);
+	}
+
+	// in an incremental cycle, the next slice is due
+	if (state->phase != GC_PHASE_IDLE) {
+		return now_ns() >= state->next_slice_ns;
+	}
+
+	if (heap_used() >= p->heap_trigger) {
+		p->reason = "occupancy";
+		return 1;
+	}
+
+	if (heap_los_used() >= p->los_trigger) {
+		p->reason = "large objects";
+		return 1;
+	}
+
+	if (--p->countdown > 0) {
+		return 0;
+	}
+
+	p->countdown = GC_POLICY_CHECK;
+
+	now = now_ns();
+
+	if (now - p->tick_ns >= GC_POLICY_TICK_US * 1000) {
+
+		sample_alloc_rate(state, now);
+		set_trigger(state, now);
+
+		if (heap_used() >= p->heap_trigger) {
+			p->reason = "allocation rate";
+			return 1;
+		}
+	}
+
+	if (state->time_info.interval_ms &&
+	    (now - state->time_info.last_collect_ns) / 1000000 >= (u8)state->time_info.interval_ms) {
+		p->reason = "interval";
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Adjusts the heap size after a collection. If the
+ * heap is getting full, or we're spending too much 
+ * time in the GC, we grow it. If it's been nearly empty 
+ * for a while we shrink it. Either way we size it so that
+ * live data takes up GC_TARGET_OCCUPANCY percent.
+ *
+ */
+static void
+resize_heap (gc_state_t * state, u8 mutator_ns)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u8 used      = heap_used();
+	u8 committed = heap_committed();
+	u8 target    = used * 100 / GC_TARGET_OCCUPANCY;
+	u8 occupancy = used * 100 / committed;
+	u8 overhead  = stats->gc_time * 100 / (stats->gc_time + mutator_ns + 1);
+
+	/* 
+	 * a bigger heap means fewer collections, but there's no
+	 * point growing it if we'll just shrink it again
+	 */
+	if (occupancy > GC_GROW_OCCUPANCY || 
+	    (overhead > GC_GROW_OVERHEAD && occupancy > GC_TARGET_OCCUPANCY)) {
+
+		state->idle_cycles = 0;
+
+		if (target <= committed) {
+			target = committed + HB_REGION_SIZE;
+		}
+
+		if (heap_grow(target - committed) == 0 && state->trace) {
+			HB_INFO("  Heap grown:        %luKB -> %luKB\n", committed >> 10, heap_committed() >> 10);
+		}
+
+	} else if (occupancy < GC_SHRINK_OCCUPANCY) {
+
+		if (++state->idle_cycles < GC_SHRINK_CYCLES) {
+			return;
+		}
+
+		state->idle_cycles = 0;
+
+		if (heap_shrink(committed - target) && state->trace) {
+			HB_INFO("  Heap shrunk:       %luKB -> %luKB\n", committed >> 10, heap_committed() >> 10);
+		}
+
+	} else {
+		state->idle_cycles = 0;
+	}
+}
+
+
+/*
+ * Print out stats for the last collection.
+ *
+ */
+static void
+report (gc_state_t * state)
+{
+	gc_stats_t * stats = &state->collect_stats;
+
+	HB_INFO("GC STATS:\n");
+	HB_INFO("  Trigger:           %s\n", state->policy.reason);
+	HB_INFO("  Objects collected: %d\n", stats->obj_collected);
+	HB_INFO("  Heap Reclaimed:    %luB\n", stats->bytes_reclaimed);
+	HB_INFO("  GC Time:           %lu.%lums\n", stats->gc_time / 1000000, stats->gc_time % 1000000);
+	HB_INFO("  |__Mark:           %lu.%lums\n", stats->mark_time / 1000000, stats->mark_time % 1000000);
+	HB_INFO("  |__Sweep:          %lu.%lums\n", stats->sweep_time / 1000000, stats->sweep_time % 1000000);
+	if (state->mode == GC_MODE_REGIONS) {
+		HB_INFO("  |__Evacuate:       %lu.%lums\n", stats->evac_time / 1000000, stats->evac_time % 1000000);
+		HB_INFO("  Heap Evacuated:    %luB\n", stats->bytes_evacuated);
+		HB_INFO("  Old regions:       %u (%u sites pretenured)\n", heap_old_regions(), state->nr_pretenured);
+	}
+	if (state->dedup) {
+		HB_INFO("  Strings deduped:   %u (%luB)\n", stats->strings_deduped, stats->dedup_bytes);
+	}
+	HB_INFO("  Pause Time:        %lu.%lums\n", stats->pause_time / 1000000, stats->pause_time % 1000000);
+	HB_INFO("  Mark threads:      %d\n", state->nworkers);
+}
+
+
+/*
+ * Print out what the trigger policy has to go on,
+ * and what it decided.
+ *
+ */
+static void
+report_policy (gc_state_t * state, u8 now)
+{
+	gc_policy_t * p = &state->policy;
+
+	HB_INFO("GC POLICY:\n");
+	HB_INFO("  Alloc rate:        %luKB/ms\n", p->alloc_rate >> 10);
+	HB_INFO("  Occupancy:         %luKB/%luKB\n", p->used_after >> 10, heap_committed() >> 10);
+	HB_INFO("  GC overhead:       %lu%%\n", gc_overhead(state, now));
+	HB_INFO("  Cycle time:        %lu.%lums\n", p->cycle_ns / 1000000, p->cycle_ns % 1000000);
+	HB_INFO("  Next trigger:      %luKB heap, %luKB LOS\n", p->heap_trigger >> 10, p->los_trigger >> 10);
+}
+
+
+static void
+end_cycle (gc_state_t * state, u8 mutator_ns)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	gc_policy_t * p = &state->policy;
+	u8 now;
+
+	stats->gc_time = stats->mark_time + stats->sweep_time + stats->evac_time;
+
+	if (state->trace) {
+		report(state);
+	}
+
+	resize_heap(state, mutator_ns);
+
+	now = now_ns();
+
+	p->pause_ns += stats->pause_time;
+
+	state->log.gc_ns      += stats->gc_time;
+	state->log.cycle_ended = 1;
+	p->cycle_ns  = p->cycle_ns ? (3 * p->cycle_ns + now - p->cycle_start_ns) / 4 : now - p->cycle_start_ns;
+
+	p->used_after  = heap_used();
+	p->los_trigger = heap_los_used() + (heap_los_size() - heap_los_used()) / 2;
+
+	set_trigger(state, now);
+
+	if (state->trace) {
+		report_policy(state, now);
+	}
+
+	// reset the timer
+	state->time_info.last_collect_ns = now;
+}
+
+
+/*
+ * Sweep, then wrap up the cycle.
+ *
+ */
+static int
+finish_collect (gc_state_t * state, u8 mutator_ns)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u8 start;
+
+	if (state->regions) {
+		prune_remsets(state);
+	}
+
+	start = now_ns();
+
+	if (state->dedup) {
+		dedup_rehash(state, state->dedup_size, 1);
+	}
+
+	if (sweep(state) != 0) {
+		HB_ERR("GC could not sweep\n");
+		return -1;
+	}
+
+	if (state->dedup) {
+		dedup_strings(state);
+	}
+
+	stats->sweep_time  = now_ns() - start;
+	stats->pause_time += stats->sweep_time;
+
+	if (state->mode == GC_MODE_REGIONS) {
+
+		update_sites(state);
+
+		start = now_ns();
+
+		if (evacuate(state) != 0) {
+			HB_ERR("GC could not evacuate\n");
+			return -1;
+		}
+
+		stats->evac_time   = now_ns() - start;
+		stats->pause_time += stats->evac_time;
+	}
+
+	end_cycle(state, mutator_ns);
+
+	return 0;
+}
+
+
+/*
+ * Runs one slice of an incremental cycle. The first
+ * marks the roots, the rest trace the heap until marking
+ * is done. The large object space is swept right away, the
+ * heap lazily, in slices here and by the allocator when it
+ * needs room (see gc_sweep_some()).
+ *
+ */
+static int
+incremental_collect (gc_state_t * state)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u8 start = now_ns();
+	u8 deadline = start + state->pause_target_ns;
+	u8 * phase_time = &stats->mark_time;
+	u8 end;
+
+	switch (state->phase) {
+
+		case GC_PHASE_IDLE:
+
+			if (begin_snapshot(state) != 0) {
+				return -1;
+			}
+
+			state->phase = GC_PHASE_MARK;
+
+			break;
+
+		case GC_PHASE_MARK:
+
+			if (!mark_slice(state, deadline)) {
+				break;
+			}
+
+			if (end_snapshot(state) != 0) {
+				HB_ERR("GC could not mark\n");
+				return -1;
+			}
+
+			if (state->dedup) {
+				dedup_rehash(state, state->dedup_size, 1);
+			}
+
+			sweep_space(state, los_next_obj);
+			heap_begin_sweep();
+
+			state->phase = GC_PHASE_SWEEP;
+
+			break;
+
+		case GC_PHASE_SWEEP:
+
+			phase_time = &stats->sweep_time;
+
+			if (sweep_slice(state, deadline, 0)) {
+
+				if (state->dedup) {
+					dedup_strings(state);
+				}
+
+				state->phase = GC_PHASE_IDLE;
+			}
+
+			break;
+	}
+
+	end = now_ns();
+
+	*phase_time       += end - start;
+	stats->pause_time += end - start;
+
+	if (state->phase == GC_PHASE_IDLE) {
+		end_cycle(state, end - state->time_info.last_collect_ns - stats->pause_time);
+		return 0;
+	}
+
+	// give the mutator at least as long as we just took
+	state->next_slice_ns = end + (end - start);
+
+	return 0;
+}
+
+
+/*
+ * Does one pause worth of work (see gc_collect()).
+ *
+ */
+static int
+collect (gc_state_t * state)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	u8 mutator_ns = now_ns() - state->time_info.last_collect_ns;
+	u8 start;
+
+	if (state->mode == GC_MODE_INCREMENTAL) {
+		return incremental_collect(state);
+	}
+
+	if (state->mode == GC_MODE_CONCURRENT) {
+
+		if (!state->conc_active) {
+			return initial_mark(state);
+		}
+
+		if (remark(state) != 0) {
+			HB_ERR("GC could not mark\n");
+			return -1;
+		}
+
+		return finish_collect(state, mutator_ns - stats->pause_time);
+	}
+
+	memset(stats, 0, sizeof(gc_stats_t));
+
+	start = now_ns();
+
+	if (mark(state) != 0) {
+		HB_ERR("GC could not mark\n");
 		return -1;
 	}
 
-	memset(main->gc_state, 0, sizeof(gc_state_t));
+	stats->mark_time  = now_ns() - start;
+	stats->pause_time = stats->mark_time;
+
+	return finish_collect(state, mutator_ns);
+}
+
+
+/*
+ * Keeps track of a pause for the summary at exit.
+ *
+ */
+static void
+record_pause (gc_state_t * state, u8 ns)
+{
+	gc_log_t * log = &state->log;
 
-	if (init_ref_tbl(main->gc_state) != 0) {
-		HB_ERR("Could not init ref table\n");
+	if (ns > log->max_pause) {
+		log->max_pause = ns;
+	}
+
+	if (log->npauses == log->pauses_size) {
+		u4 size = log->pauses_size ? log->pauses_size * 2 : 64;
+		u8 * pauses = realloc(log->pauses, sizeof(u8) * size);
+
+		if (!pauses) {
+			return;
+		}
+
+		log->pauses      = pauses;
+		log->pauses_size = size;
+	}
+
+	log->pauses[log->npauses++] = ns;
+}
+
+
+static const char *
+mode_name (int mode)
+{
+	switch (mode) {
+		case GC_MODE_CONCURRENT:
+			return "concurrent";
+		case GC_MODE_INCREMENTAL:
+			return "incremental";
+		case GC_MODE_REGIONS:
+			return "regions";
+		default:
+			return "stw";
+	}
+}
+
+
+/*
+ * Writes out one JSON line to the GC log for the
+ * cycle that just ended.
+ *
+ */
+static void
+log_cycle (gc_state_t * state)
+{
+	gc_stats_t * stats = &state->collect_stats;
+	gc_log_t * log = &state->log;
+	FILE * f = log->file;
+	u4 nregions;
+	u4 i;
+
+	fprintf(f, "{\"cycle\":%u,\"mode\":\"%s\",\"cause\":\"%s\",\"start_ms\":%.3f,",
+		log->cycles,
+		mode_name(state->mode),
+		state->policy.reason,
+		(double)(state->policy.cycle_start_ns - state->policy.start_ns) / 1e6);
+
+	fprintf(f, "\"heap_before\":%lu,\"heap_after\":%lu,\"heap_committed\":%lu,",
+		log->heap_before, heap_used(), heap_committed());
+
+	fprintf(f, "\"los_before\":%lu,\"los_after\":%lu,",
+		log->los_before, heap_los_used());
+
+	fprintf(f, "\"bytes_reclaimed\":%lu,\"objects_freed\":%u,",
+		stats->bytes_reclaimed, stats->obj_collected);
+
+	if (state->dedup) {
+		fprintf(f, "\"strings_deduped\":%u,\"dedup_bytes\":%lu,",
+			stats->strings_deduped, stats->dedup_bytes);
+	}
+
+	fprintf(f, "\"mark_ms\":%.3f,\"sweep_ms\":%.3f,\"evac_ms\":%.3f,\"pause_ms\":%.3f,\"max_pause_ms\":%.3f",
+		(double)stats->mark_time / 1e6,
+		(double)stats->sweep_time / 1e6,
+		(double)stats->evac_time / 1e6,
+		(double)stats->pause_time / 1e6,
+		(double)log->max_pause / 1e6);
+
+	if (state->mode == GC_MODE_REGIONS) {
+
+		fprintf(f, ",\"bytes_evacuated\":%lu,\"regions_evacuated\":%u,\"old_regions\":%u,\"pretenured_sites\":%u,\"regions\":[",
+			stats->bytes_evacuated, stats->regions_evacuated, heap_old_regions(), state->nr_pretenured);
+
+		// live bytes are as of the sweep, before evacuation
+		nregions = heap_committed() >> HB_REGION_ORDER;
+
+		for (i = 0; i < nregions; i++) {
+			fprintf(f, "%s{\"region\":%u,\"live\":%u,\"pinned\":%d,\"old\":%d,\"remset\":%u}",
+				i ? "," : "",
+				i,
+				state->regions[i].live,
+				state->regions[i].pinned,
+				heap_region_is_old(i),
+				state->regions[i].remset.count);
+		}
+
+		fprintf(f, "]");
+	}
+
+	fprintf(f, "}\n");
+	fflush(f);
+}
+
+
+/*
+ * The main interface to the GC. Calling this function will
+ * initiate the mark and sweep process. The mutator is
+ * stopped for as long as it takes.
+ * 
+ * In concurrent mode, the first call starts a cycle (the
+ * initial mark pause) and the one after the marker is done
+ * (see gc_should_collect()) finishes it. In incremental mode,
+ * each call does one bounded slice of the work.
+ *
+ * If tracing is on, we will also get some verbose output
+ * including how much was collected, and how much time it took.
+ * With --gc-log (-L; lowercase -l is --loader-threads),
+ * each cycle also gets a line in the log.
+ *
+ */
+int
+gc_collect (jthread_t * t)
+{
+	gc_state_t * state = t->gc_state;
+	gc_log_t * log = &state->log;
+	u8 start = now_ns();
+	int ret;
+
+	if (!state->conc_active && state->phase == GC_PHASE_IDLE) {
+		state->policy.cycle_start_ns = start;
+		log->heap_before = heap_used();
+		log->los_before  = heap_los_used();
+		log->max_pause   = 0;
+	}
+
+	ret = collect(state);
+
+	record_pause(state, now_ns() - start);
+
+	if (log->cycle_ended) {
+
+		if (log->file) {
+			log_cycle(state);
+		}
+
+		log->cycle_ended = 0;
+		log->cycles++;
+	}
+
+	return ret;
+}
+
+
+/*
+ * Runs a whole collection right now, for an allocation
+ * that failed. A cycle that's already underway is finished
+ * first, but its snapshot might predate the garbage we need
+ * back, so then we run another. This only returns once the
+ * sweep is done, and evacuation can move objects, so the
+ * caller must not be holding any references of its own (the
+ * allocation bytecodes only ever have them on the stack).
+ *
+ * @return: 0 on success, -1 if we couldn't collect
+ *
+ */
+int
+gc_collect_full (jthread_t * t)
+{
+	gc_state_t * state = t ? t->gc_state : NULL;
+	int cycles;
+
+	// the heap is in use before the GC is up
+	if (!state) {
 		return -1;
 	}
 
-	INIT_LIST_HEAD(&main->gc_state->root_list);
-	
-	// add the base obj ref to root list
-	add_root(base_obj, scan_base_ref, "Base Object Ref.", main->gc_state);
-	add_root(obj, scan_base_obj, "Base Object", main->gc_state);
-	add_root(main->cur_frame, scan_base_frame, "Base Frame", main->gc_state);
-	add_root(hb_get_classmap(), scan_class_map, "Class Map", main->gc_state);
-
-	if (ref_tbl_insert_ref(base_obj) != 0) {
-		HB_ERR("Could not insert base object ref into ref table\n");
+	cycles = (state->conc_active || state->phase != GC_PHASE_IDLE) ? 2 : 1;
+
+	state->policy.reason = "allocation failure";
+
+	while (cycles > 0) {
+
+		// wait for the concurrent marker to get to the remark
+		if (state->conc_active && !__atomic_load_n(&state->conc_done, __ATOMIC_ACQUIRE)) {
+			sched_yield();
+			continue;
+		}
+
+		if (gc_collect(t) != 0) {
+			return -1;
+		}
+
+		if (!state->conc_active && state->phase == GC_PHASE_IDLE) {
+			cycles--;
+		}
+	}
+
+	return 0;
+}
+
+
+static int
+cmp_pause (const void * a, const void * b)
+{
+	u8 x = *(const u8*)a;
+	u8 y = *(const u8*)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/*
+ * The pause at the given percentile (nearest rank).
+ * The pauses must be sorted.
+ *
+ */
+static u8
+percentile (gc_log_t * log, u4 pct)
+{
+	u4 rank = (log->npauses * pct + 99) / 100;
+
+	if (!log->npauses) {
+		return 0;
+	}
+
+	return log->pauses[rank ? rank - 1 : 0];
+}
+
+
+/*
+ * Prints a summary of all the pauses at exit, and
+ * writes it to the GC log.
+ *
+ */
+static void
+gc_summary (void)
+{
+	gc_state_t * state = cur_thread ? cur_thread->gc_state : NULL;
+	gc_log_t * log = NULL;
+	u8 runtime;
+	u8 share;
+
+	if (!state || (!state->trace && !state->log.file)) {
+		return;
+	}
+
+	log     = &state->log;
+	runtime = now_ns() - state->policy.start_ns;
+	share   = log->gc_ns * 10000 / (runtime + 1);
+
+	qsort(log->pauses, log->npauses, sizeof(u8), cmp_pause);
+
+	if (state->trace) {
+		HB_INFO("GC SUMMARY:\n");
+		HB_INFO("  Cycles:            %u\n", log->cycles);
+		HB_INFO("  Pauses:            %u\n", log->npauses);
+		HB_INFO("  Pause p50:         %.3fms\n", (double)percentile(log, 50) / 1e6);
+		HB_INFO("  Pause p99:         %.3fms\n", (double)percentile(log, 99) / 1e6);
+		HB_INFO("  Pause max:         %.3fms\n", (double)percentile(log, 100) / 1e6);
+		HB_INFO("  GC share:          %lu.%02lu%%\n", share / 100, share % 100);
+	}
+
+	if (log->file) {
+		fprintf(log->file, "{\"summary\":true,\"mode\":\"%s\",\"cycles\":%u,\"pauses\":%u,"
+			"\"p50_pause_ms\":%.3f,\"p99_pause_ms\":%.3f,\"max_pause_ms\":%.3f,"
+			"\"gc_ms\":%.3f,\"runtime_ms\":%.3f,\"gc_share\":%.4f}\n",
+			mode_name(state->mode),
+			log->cycles,
+			log->npauses,
+			(double)percentile(log, 50) / 1e6,
+			(double)percentile(log, 99) / 1e6,
+			(double)percentile(log, 100) / 1e6,
+			(double)log->gc_ns / 1e6,
+			(double)runtime / 1e6,
+			(double)log->gc_ns / (runtime + 1));
+
+		fclose(log->file);
+		log->file = NULL;
+	}
+}
+
+
+/*
+ * Turns on String deduplication (--gc-dedup-strings).
+ *
+ */
+int
+gc_enable_dedup (jthread_t * t)
+{
+	gc_state_t * state = t->gc_state;
+
+	state->string_cls = hb_get_or_load_class_sym(hb_sym_string);
+	state->dedup_tab  = calloc(GC_DEDUP_INIT, sizeof(struct gc_dedup_ent));
+
+	if (!state->string_cls || !state->dedup_tab) {
+		HB_ERR("Could not set up string deduplication\n");
+		return -1;
+	}
+
+	state->dedup_size = GC_DEDUP_INIT;
+
+	if (add_root(state, scan_dedup, update_dedup, "String Dedup Table", state) != 0) {
+		return -1;
+	}
+
+	state->dedup = 1;
+
+	return 0;
+}
+
+
+/*
+ * Opens the GC log (--gc-log, or -L; -l is the
+ * loader thread count). Each cycle gets a JSON
+ * line, with a summary at exit.
+ *
+ */
+int
+gc_open_log (jthread_t * t, const char * path)
+{
+	t->gc_state->log.file = fopen(path, "w");
+
+	if (!t->gc_state->log.file) {
+		HB_ERR("Could not open GC log (%s)\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * The base object has already been allocated *outside*
+ * of the GC system. We have to keep track of its reference,
+ * else it will be collected (it should never be)
+ *
+ */
+int 
+gc_init (jthread_t * main, obj_ref_t * base_obj, int trace, int interval, int nthreads, int mode, int pause_target_us)
+{
+	gc_state_t * state = NULL;
+	int i;
+
+	main->gc_state = malloc(sizeof(gc_state_t));
+
+	if (!main->gc_state) {
+		HB_ERR("Could not create GC state\n");
 		return -1;
 	}
+
+	memset(main->gc_state, 0, sizeof(gc_state_t));
+
+	INIT_LIST_HEAD(&main->gc_state->root_list);
 	
+	// add the base obj to root list
+	add_root(base_obj, scan_base_obj, NULL, "Base Object", main->gc_state);
+	add_root(main->cur_frame, scan_base_frame, update_base_frame, "Base Frame", main->gc_state);
+	add_root(hb_get_classmap(), scan_class_map, update_class_map, "Class Map", main->gc_state);
+	add_root(main->gc_state, scan_handles, update_handles, "Handles", main->gc_state);
+
 	main->gc_state->trace = trace;
 
-	if (interval) {
-		main->gc_state->time_info.interval_ms = interval;
-	} else {
-		main->gc_state->time_info.interval_ms = GC_DEFAULT_INTERVAL;
+	state = main->gc_state;
+
+	if (nthreads < 1) {
+		nthreads = GC_DEFAULT_THREADS;
+	} else if (nthreads > GC_MAX_THREADS) {
+		nthreads = GC_MAX_THREADS;
+	}
+
+	if (posix_memalign((void**)&state->workers, sizeof(gc_worker_t), sizeof(gc_worker_t) * nthreads) != 0) {
+		HB_ERR("Could not create GC workers\n");
+		return -1;
 	}
 
+	memset(state->workers, 0, sizeof(gc_worker_t) * nthreads);
+
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->start_cond, NULL);
+	pthread_cond_init(&state->done_cond, NULL);
+
+	state->nworkers = nthreads;
+
+	for (i = 0; i < nthreads; i++) {
+		state->workers[i].id    = i;
+		state->workers[i].state = state;
+		state->workers[i].seed  = i + 1;
+
+		// worker 0 is the collecting thread itself
+		if (i == 0) {
+			continue;
+		}
+
+		if (pthread_create(&state->workers[i].thread, NULL, mark_thread, &state->workers[i]) != 0) {
+			HB_ERR("Could not create GC mark thread\n");
+			return -1;
+		}
+	}
+
+	state->mode = mode;
+	state->pause_target_ns = (u8)(pause_target_us ? pause_target_us : GC_DEFAULT_PAUSE_TARGET_US) * 1000;
+
+	pthread_cond_init(&state->conc_cond, NULL);
+
+	if (mode == GC_MODE_REGIONS) {
+
+		state->nregions  = heap_max_regions();
+		state->regions   = calloc(state->nregions, sizeof(gc_region_t));
+		state->evac_rate = GC_EVAC_DEFAULT_RATE;
+
+		if (!state->regions) {
+			HB_ERR("Could not create GC regions\n");
+			return -1;
+		}
+
+		seed_remsets(state);
+
+		gc_remsets_active = 1;
+
+		gc_sites = calloc(GC_SITES_INIT, sizeof(struct gc_site));
+
+		if (!gc_sites) {
+			HB_ERR("Could not create allocation site table\n");
+			return -1;
+		}
+
+		gc_sites_size = GC_SITES_INIT;
+		gc_nsites     = 1;
+	}
+
+	if (mode == GC_MODE_CONCURRENT &&
+	    pthread_create(&state->conc_thread, NULL, conc_mark_thread, state) != 0) {
+		HB_ERR("Could not create concurrent mark thread\n");
+		return -1;
+	}
+
+	state->time_info.last_collect_ns = now_ns();
+	state->time_info.interval_ms     = interval;
+
+	state->policy.start_ns    = state->time_info.last_collect_ns;
+	state->policy.tick_ns     = state->policy.start_ns;
+	state->policy.tick_alloc  = heap_total_alloc();
+	state->policy.used_after  = heap_used();
+	state->policy.los_trigger = heap_los_size() / 2;
+	state->policy.countdown   = GC_POLICY_CHECK;
+	state->policy.reason      = "none";
+
+	set_trigger(state, state->policy.start_ns);
+
+	atexit(gc_summary);
+
 	GC_DEBUG("GC Initialized.\n");
 
 	return 0;
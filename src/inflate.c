@@ -0,0 +1,501 @@
+/*
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the
+ * file "LICENSE.txt".
+ */
+
+/*
+ * A raw DEFLATE (RFC 1951) decoder, for compressed entries
+ * in jar files. We always know how big the output is (the
+ * zip directory tells us), so everything goes straight into
+ * the caller's buffer.
+ *
+ * Huffman codes are decoded with a table indexed by the next
+ * INFL_FAST_BITS bits of input, which covers almost every code
+ * in practice. Longer codes fall back to walking the canonical
+ * code one bit at a time.
+ */
+#include <string.h>
+#include <pthread.h>
+
+#include <hawkbeans.h>
+#include <types.h>
+#include <inflate.h>
+
+#define INFL_MAX_BITS  15
+#define INFL_FAST_BITS 9
+#define INFL_FAST_MASK ((1 << INFL_FAST_BITS) - 1)
+#define INFL_MAX_LCODES 288
+#define INFL_MAX_DCODES 30
+
+struct huff {
+	u2 fast[1 << INFL_FAST_BITS]; // (symbol << 4) | length, 0 if the code is longer
+	u2 count[INFL_MAX_BITS + 1];  // number of codes of each length
+	u2 symbol[INFL_MAX_LCODES];   // symbols in canonical code order
+};
+
+struct inflater {
+	const u1 * src;
+	const u1 * src_end;
+	u8 bits;  // input bits we've read but not used, lsb first
+	u4 nbits;
+
+	u1 * dst;
+	u4 pos;
+	u4 len;
+};
+
+static const u2 len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const u1 len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const u2 dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+
+static const u1 dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* order the code length code lengths come in */
+static const u1 clen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static struct huff fixed_lit;
+static struct huff fixed_dist;
+static pthread_once_t fixed_once = PTHREAD_ONCE_INIT;
+
+
+static inline void
+refill (struct inflater * s)
+{
+	while (s->nbits <= 56 && s->src < s->src_end) {
+		s->bits  |= (u8)*s->src++ << s->nbits;
+		s->nbits += 8;
+	}
+}
+
+
+static inline int
+get_bits (struct inflater * s, u4 n, u4 * val)
+{
+	if (s->nbits < n) {
+		refill(s);
+		if (s->nbits < n) {
+			return -1;
+		}
+	}
+
+	*val      = s->bits & ((1UL << n) - 1);
+	s->bits >>= n;
+	s->nbits -= n;
+
+	return 0;
+}
+
+
+/*
+ * Builds a decoding table from a list of code lengths
+ * (one per symbol, 0 if the symbol isn't used).
+ *
+ * @return: 0 on success, -1 if the lengths don't
+ * make a valid code
+ *
+ */
+static int
+build_huff (struct huff * h, const u1 * lengths, u4 n)
+{
+	u2 offs[INFL_MAX_BITS + 1];
+	u2 next[INFL_MAX_BITS + 1];
+	int left = 1;
+	u4 code = 0;
+	u4 sym, len;
+
+	memset(h->count, 0, sizeof(h->count));
+	memset(h->fast, 0, sizeof(h->fast));
+
+	for (sym = 0; sym < n; sym++) {
+		h->count[lengths[sym]]++;
+	}
+
+	// over-subscribed codes are bad, incomplete ones are allowed
+	for (len = 1; len <= INFL_MAX_BITS; len++) {
+		left <<= 1;
+		left  -= h->count[len];
+		if (left < 0) {
+			return -1;
+		}
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < INFL_MAX_BITS; len++) {
+		offs[len + 1] = offs[len] + h->count[len];
+	}
+
+	h->count[0] = 0;
+	for (len = 1; len <= INFL_MAX_BITS; len++) {
+		code      = (code + h->count[len - 1]) << 1;
+		next[len] = code;
+	}
+
+	for (sym = 0; sym < n; sym++) {
+		u4 rev = 0;
+		u4 c, i;
+
+		len = lengths[sym];
+
+		if (!len) {
+			continue;
+		}
+
+		h->symbol[offs[len]++] = sym;
+
+		c = next[len]++;
+
+		if (len > INFL_FAST_BITS) {
+			continue;
+		}
+
+		// codes go in msb first, but we read bits lsb first
+		for (i = 0; i < len; i++) {
+			rev = (rev << 1) | ((c >> i) & 1);
+		}
+
+		for (i = rev; i < (1 << INFL_FAST_BITS); i += (1 << len)) {
+			h->fast[i] = (sym << 4) | len;
+		}
+	}
+
+	return 0;
+}
+
+
+static int
+decode (struct inflater * s, struct huff * h)
+{
+	int code = 0, first = 0, index = 0;
+	u4 len, e;
+
+	if (s->nbits < INFL_MAX_BITS) {
+		refill(s);
+	}
+
+	e = h->fast[s->bits & INFL_FAST_MASK];
+
+	if (e && (e & 15) <= s->nbits) {
+		s->bits  >>= (e & 15);
+		s->nbits  -= (e & 15);
+		return e >> 4;
+	}
+
+	for (len = 1; len <= INFL_MAX_BITS && len <= s->nbits; len++) {
+		int count = h->count[len];
+
+		code |= (s->bits >> (len - 1)) & 1;
+
+		if (code - count < first) {
+			s->bits  >>= len;
+			s->nbits  -= len;
+			return h->symbol[index + (code - first)];
+		}
+
+		index  += count;
+		first  += count;
+		first <<= 1;
+		code  <<= 1;
+	}
+
+	return -1;
+}
+
+
+static int
+inflate_stored (struct inflater * s)
+{
+	u4 len, nlen;
+
+	// stored blocks start on a byte boundary
+	s->bits  >>= (s->nbits & 7);
+	s->nbits  -= (s->nbits & 7);
+
+	if (get_bits(s, 16, &len) != 0 || get_bits(s, 16, &nlen) != 0) {
+		return -1;
+	}
+
+	if (len != (~nlen & 0xffff) || len > s->len - s->pos) {
+		return -1;
+	}
+
+	// some of it might already be in the bit buffer
+	while (len && s->nbits >= 8) {
+		s->dst[s->pos++] = s->bits & 0xff;
+		s->bits  >>= 8;
+		s->nbits  -= 8;
+		len--;
+	}
+
+	if (len > s->src_end - s->src) {
+		return -1;
+	}
+
+	memcpy(s->dst + s->pos, s->src, len);
+	s->pos += len;
+	s->src += len;
+
+	return 0;
+}
+
+
+static int
+inflate_codes (struct inflater * s, struct huff * lit, struct huff * dist)
+{
+	while (1) {
+		int sym = decode(s, lit);
+		u4 extra, len, d;
+
+		if (sym < 0) {
+			return -1;
+		}
+
+		if (sym < 256) {
+			if (s->pos == s->len) {
+				return -1;
+			}
+			s->dst[s->pos++] = sym;
+			continue;
+		}
+
+		if (sym == 256) {
+			return 0;
+		}
+
+		sym -= 257;
+
+		if (sym >= 29 || get_bits(s, len_extra[sym], &extra) != 0) {
+			return -1;
+		}
+
+		len = len_base[sym] + extra;
+		sym = decode(s, dist);
+
+		if (sym < 0 || sym >= 30 || get_bits(s, dist_extra[sym], &extra) != 0) {
+			return -1;
+		}
+
+		d = dist_base[sym] + extra;
+
+		if (d > s->pos || len > s->len - s->pos) {
+			return -1;
+		}
+
+		if (d >= len) {
+			memcpy(s->dst + s->pos, s->dst + s->pos - d, len);
+			s->pos += len;
+		} else {
+			// the copy overlaps what it's writing
+			while (len--) {
+				s->dst[s->pos] = s->dst[s->pos - d];
+				s->pos++;
+			}
+		}
+	}
+}
+
+
+static void
+build_fixed (void)
+{
+	u1 lengths[INFL_MAX_LCODES];
+	int i;
+
+	for (i = 0; i < 144; i++) lengths[i] = 8;
+	for (; i < 256; i++)      lengths[i] = 9;
+	for (; i < 280; i++)      lengths[i] = 7;
+	for (; i < 288; i++)      lengths[i] = 8;
+
+	build_huff(&fixed_lit, lengths, INFL_MAX_LCODES);
+
+	for (i = 0; i < INFL_MAX_DCODES; i++) {
+		lengths[i] = 5;
+	}
+
+	build_huff(&fixed_dist, lengths, INFL_MAX_DCODES);
+}
+
+
+static int
+inflate_fixed (struct inflater * s)
+{
+	// the loader threads can get here at the same time
+	pthread_once(&fixed_once, build_fixed);
+
+	return inflate_codes(s, &fixed_lit, &fixed_dist);
+}
+
+
+static int
+inflate_dynamic (struct inflater * s)
+{
+	u1 lengths[INFL_MAX_LCODES + INFL_MAX_DCODES];
+	struct huff lit, dist;
+	u4 nlen, ndist, ncode;
+	u4 i, v;
+
+	if (get_bits(s, 5, &nlen) != 0 ||
+	    get_bits(s, 5, &ndist) != 0 ||
+	    get_bits(s, 4, &ncode) != 0) {
+		return -1;
+	}
+
+	nlen  += 257;
+	ndist += 1;
+	ncode += 4;
+
+	if (nlen > INFL_MAX_LCODES || ndist > INFL_MAX_DCODES) {
+		return -1;
+	}
+
+	memset(lengths, 0, sizeof(lengths));
+
+	for (i = 0; i < ncode; i++) {
+		if (get_bits(s, 3, &v) != 0) {
+			return -1;
+		}
+		lengths[clen_order[i]] = v;
+	}
+
+	// the code lengths are themselves Huffman coded
+	if (build_huff(&lit, lengths, 19) != 0) {
+		return -1;
+	}
+
+	i = 0;
+	while (i < nlen + ndist) {
+		int sym = decode(s, &lit);
+		u4 rep = 0;
+		u1 len = 0;
+
+		if (sym < 0) {
+			return -1;
+		}
+
+		if (sym < 16) {
+			lengths[i++] = sym;
+			continue;
+		}
+
+		if (sym == 16) {
+			if (i == 0 || get_bits(s, 2, &rep) != 0) {
+				return -1;
+			}
+			len  = lengths[i - 1];
+			rep += 3;
+		} else if (sym == 17) {
+			if (get_bits(s, 3, &rep) != 0) {
+				return -1;
+			}
+			rep += 3;
+		} else {
+			if (get_bits(s, 7, &rep) != 0) {
+				return -1;
+			}
+			rep += 11;
+		}
+
+		if (i + rep > nlen + ndist) {
+			return -1;
+		}
+
+		while (rep--) {
+			lengths[i++] = len;
+		}
+	}
+
+	// there has to be an end of block code
+	if (lengths[256] == 0) {
+		return -1;
+	}
+
+	if (build_huff(&lit, lengths, nlen) != 0 ||
+	    build_huff(&dist, lengths + nlen, ndist) != 0) {
+		return -1;
+	}
+
+	return inflate_codes(s, &lit, &dist);
+}
+
+
+/*
+ * Decompresses raw DEFLATE data.
+ *
+ * @dst: where the output goes
+ * @dst_len: exactly how much output there should be
+ * @src: the compressed data
+ * @src_len: how much of it there is
+ *
+ * @return: 0 on success, -1 if the data is corrupt
+ * or doesn't decompress to exactly dst_len bytes.
+ *
+ */
+int
+hb_inflate (u1 * dst, u4 dst_len, const u1 * src, u4 src_len)
+{
+	struct inflater s;
+	u4 last, type;
+
+	memset(&s, 0, sizeof(s));
+
+	s.src     = src;
+	s.src_end = src + src_len;
+	s.dst     = dst;
+	s.len     = dst_len;
+
+	do {
+		int ret;
+
+		if (get_bits(&s, 1, &last) != 0 || get_bits(&s, 2, &type) != 0) {
+			return -1;
+		}
+
+		switch (type) {
+			case 0:
+				ret = inflate_stored(&s);
+				break;
+			case 1:
+				ret = inflate_fixed(&s);
+				break;
+			case 2:
+				ret = inflate_dynamic(&s);
+				break;
+			default:
+				ret = -1;
+				break;
+		}
+
+		if (ret != 0) {
+			return -1;
+		}
+
+	} while (!last);
+
+	return s.pos == s.len ? 0 : -1;
+}
@@ -0,0 +1,180 @@
+/* 
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the 
+ * file "LICENSE.txt".
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <hawkbeans.h>
+#include <metaspace.h>
+#include <class.h>
+#include <symbol.h>
+#include <hashtable.h>
+#include <hb_util.h>
+
+
+static struct meta_chunk *
+new_chunk (metaspace_t * ms, u8 size)
+{
+	struct meta_chunk * c = malloc(sizeof(struct meta_chunk) + size);
+
+	if (!c) {
+		HB_ERR("Could not allocate metaspace chunk\n");
+		return NULL;
+	}
+
+	memset(c->data, 0, size);
+
+	c->size = size;
+
+	ms->reserved += size;
+	ms->nchunks++;
+
+	return c;
+}
+
+
+/*
+ * Allocates zeroed, 8-byte aligned memory from a metaspace.
+ * Chunks start out small (most classes only need a few KB)
+ * and double as the class grows. Anything too big to fit
+ * comfortably in the next chunk gets a chunk of its own, so
+ * we don't strand the rest of the current one.
+ *
+ * @return: the memory, NULL on error
+ *
+ */
+void *
+hb_meta_alloc (metaspace_t * ms, u8 size)
+{
+	struct meta_chunk * c = NULL;
+	void * ret = NULL;
+	u8 csize;
+
+	size = (size + META_ALIGN - 1) & ~(u8)(META_ALIGN - 1);
+
+	if (size == 0) {
+		size = META_ALIGN;
+	}
+
+	if ((u8)(ms->end - ms->cur) < size) {
+
+		csize = ms->chunks ? min(ms->chunks->size * 2, (u8)META_CHUNK_MAX) : META_CHUNK_MIN;
+
+		if (size > csize / 2) {
+
+			if (!(c = new_chunk(ms, size))) {
+				return NULL;
+			}
+
+			// keep bumping in the current chunk
+			if (ms->chunks) {
+				c->next = ms->chunks->next;
+				ms->chunks->next = c;
+			} else {
+				ms->chunks = c;
+				ms->cur    = ms->end = c->data + size;
+			}
+
+			ms->used += size;
+
+			return c->data;
+		}
+
+		if (!(c = new_chunk(ms, csize))) {
+			return NULL;
+		}
+
+		c->next    = ms->chunks;
+		ms->chunks = c;
+		ms->cur    = c->data;
+		ms->end    = c->data + csize;
+	}
+
+	ret       = ms->cur;
+	ms->cur  += size;
+	ms->used += size;
+
+	return ret;
+}
+
+
+void
+hb_meta_free (metaspace_t * ms)
+{
+	struct meta_chunk * c = ms->chunks;
+
+	while (c) {
+		struct meta_chunk * next = c->next;
+		free(c);
+		c = next;
+	}
+
+	memset(ms, 0, sizeof(metaspace_t));
+}
+
+
+/*
+ * -XX:+PrintMetaspace. Classes that came out of a CDS archive
+ * show only what was allocated for them after they were mapped
+ * in; the rest lives in the archive.
+ */
+void
+hb_print_metaspace (void)
+{
+	struct nk_hashtable * map = hb_get_classmap();
+	struct nk_hashtable_iter * iter = NULL;
+	const metaspace_t * syms = NULL;
+	u8 used = 0, reserved = 0;
+	u4 nchunks = 0, nclasses = 0;
+
+	if (!map || !(iter = nk_create_htable_iter(map))) {
+		return;
+	}
+
+	HB_INFO("METASPACE:\n");
+	HB_INFO("  %-40s %10s %10s %6s\n", "Class", "Used", "Reserved", "Chunks");
+
+	do {
+		java_class_t * cls = (java_class_t*)nk_htable_get_iter_value(iter);
+
+		if (!cls) {
+			break;
+		}
+
+		HB_INFO("  %-40s %10lu %10lu %6u\n",
+			hb_get_class_name(cls),
+			cls->meta.used,
+			cls->meta.reserved,
+			cls->meta.nchunks);
+
+		used     += cls->meta.used;
+		reserved += cls->meta.reserved;
+		nchunks  += cls->meta.nchunks;
+		nclasses++;
+
+	} while (nk_htable_iter_advance(iter) != 0);
+
+	nk_destroy_htable_iter(iter);
+
+	syms = hb_symtab_meta();
+
+	HB_INFO("  %-40s %10lu %10lu %6u\n", "(symbols)", syms->used, syms->reserved, syms->nchunks);
+
+	used     += syms->used;
+	reserved += syms->reserved;
+	nchunks  += syms->nchunks;
+
+	HB_INFO("  %-40s %10lu %10lu %6u\n", "Total", used, reserved, nchunks);
+	HB_INFO("  Classes: %u, Symbols: %u\n", nclasses, hb_symtab_count());
+}
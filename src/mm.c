@@ -28,26 +28,116 @@
 
 struct heap_info * heap;
 
+#if HB_COMPRESSED_REFS == 1
+u8 hb_ref_base;
+#endif
+
+static void * slab_alloc (u4 size, int old);
+static void slab_free (void * addr);
+static inline int is_slab_obj (void * addr);
+static inline struct slab * addr_to_slab (void * addr);
+static inline void set_obj_start (native_obj_t * obj);
+static inline void clear_obj_start (native_obj_t * obj);
+static native_obj_t * alloc_raw (const u8 size, int old);
+static int los_init (void * region);
+static void * trim_mapping (void * ptr, u8 size, u8 align);
+static void prefault (void * addr, u8 len);
+static void * los_alloc (u8 size);
+static void los_free (void * addr);
+static inline int is_los_obj (void * addr);
+static u8 los_run_pages (u8 start);
+static inline int alloc_mark (native_obj_t * obj);
+static inline int in_evac_region (void * addr);
+static inline int in_old_region (void * addr);
+static void * old_alloc (u2 order);
+
+/*
+ * Sizes of objects as they are laid out on the heap.
+ * Array lengths go up to 2^31 - 1, so the size of
+ * one doesn't necessarily fit in 32 bits.
+ */
+static inline u8
+array_bytes (u1 type, i4 count)
+{
+	return sizeof(native_obj_t) + (u8)hb_type_size(type) * (u4)count;
+}
+
+
+static inline u4
+inst_bytes (java_class_t * cls)
+{
+	return sizeof(native_obj_t) + cls->inst_size;
+}
+
+
+static inline u8
+obj_bytes (native_obj_t * obj)
+{
+	if (obj->flags.array.isarray) {
+		return array_bytes(obj->flags.array.type, obj->flags.array.length);
+	}
+
+	return inst_bytes(obj->class);
+}
+
+
 /*
- * Initializes the JVM heap. the heap will
- * be mapped anonymously and is required to be
- * a power of two. This heap size is currently
- * determined statically at compile-time. 
+ * Initializes the JVM heap. Address space for
+ * max_size bytes is mapped anonymously up front, and
+ * init_size bytes of it are committed to the allocator. 
+ * Pages are only backed when first touched unless 
+ * HB_HEAP_PRETOUCH is given in flags. A size of 0 picks 
+ * the default.
  *
  * @return: 0 on success, -1 otherwise.
  * 
  */
 int
-heap_init (int heap_size_megs)
+heap_init (u8 init_size, u8 max_size, int flags)
 {
 	void * heap_ptr = NULL;
+	u8 reserve;
+	u8 span;
 	int i;
-	int size = heap_size_megs ? (heap_size_megs*1024*1024) : HB_DEFAULT_HEAP_SIZE;
+
+	init_size = init_size ? init_size : HB_DEFAULT_HEAP_SIZE;
+	max_size  = max_size ? max_size : HB_DEFAULT_MAX_HEAP_SIZE;
+
+	// the heap is made up of whole regions
+	init_size = (init_size + HB_REGION_SIZE - 1) & ~(HB_REGION_SIZE - 1);
+	max_size  = (max_size + HB_REGION_SIZE - 1) & ~(HB_REGION_SIZE - 1);
+
+	if (max_size < init_size) {
+		max_size = init_size;
+	}
+
+	/* 
+	 * we reserve enough address space for the maximum heap size
+	 * up front, so that the heap stays contiguous as it grows. 
+	 * Nothing is backed until we touch it. We reserve a bit extra
+	 * so we can start the heap on a huge page boundary.
+	 */
+	reserve = roundup_pow_of_two(max_size);
+	span    = reserve;
+
+#if HB_COMPRESSED_REFS == 1
+	/*
+	 * compressed references have to reach large objects
+	 * too, so the LOS goes right after the heap in the same
+	 * reservation and the whole thing has to fit in their reach
+	 */
+	span += HB_LOS_DEFAULT_SIZE;
+
+	if (span > HB_REF_REACH - HB_OBJ_ALIGN) {
+		HB_ERR("Max heap size (%lu MB) too large for compressed references\n", max_size >> 20);
+		return -1;
+	}
+#endif
 
 	heap_ptr = mmap(NULL,
-			roundup_pow_of_two(size),
+			span + HB_HUGE_PAGE_SIZE,
 			PROT_READ|PROT_WRITE,
-			MAP_PRIVATE|MAP_ANONYMOUS,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,
 			-1,
 			0);
 
@@ -55,8 +145,22 @@ heap_init (int heap_size_megs)
 		HB_ERR("Could not allocate JVM heap\n");
 		return -1;
 	}
+
+	heap_ptr = trim_mapping(heap_ptr, span, HB_HUGE_PAGE_SIZE);
+
+#ifdef MADV_HUGEPAGE
+	if (flags & HB_HEAP_HUGEPAGES) {
+		if (madvise(heap_ptr, reserve, MADV_HUGEPAGE) != 0) {
+			HB_ERR("Could not enable huge pages for heap, continuing without them\n");
+		}
+	}
+#else
+	if (flags & HB_HEAP_HUGEPAGES) {
+		HB_ERR("Huge pages not supported on this system, continuing without them\n");
+	}
+#endif
 	     
-	MM_DEBUG("Allocated %d.%d MB of heap space\n", size/1000000, size%1000000);
+	MM_DEBUG("Reserved %lu MB of heap space\n", max_size >> 20);
 
 	heap = malloc(sizeof(struct heap_info));
 	if (!heap) {
@@ -65,11 +169,14 @@ heap_init (int heap_size_megs)
 	}
 	memset(heap, 0, sizeof(struct heap_info));
 	
-	heap->heap_region = heap_ptr;
-	heap->obj_count   = 0;
-	heap->order       = ilog2(roundup_pow_of_two(size));
-	heap->allocated   = (1UL << heap->order);
-	heap->min_order   = ilog2(roundup_pow_of_two(sizeof(native_obj_t)));
+	heap->heap_region   = heap_ptr;
+	heap->flags         = flags;
+	heap->obj_count     = 0;
+	heap->order         = ilog2(roundup_pow_of_two(max_size));
+	heap->allocated     = 0;
+	heap->min_order     = ilog2(roundup_pow_of_two(sizeof(struct buddy_block)));
+	heap->max_size      = max_size;
+	heap->min_committed = init_size;
 
 	heap->free_lists =  malloc((heap->order + 1) * sizeof(struct list_head));
 
@@ -83,26 +190,72 @@ heap_init (int heap_size_megs)
 		INIT_LIST_HEAD(&(heap->free_lists[i]));
 	}
 
-	/* bitmap for minimum sized chunks */
-	heap->num_min_blocks = (1 << heap->order) / (1 << heap->min_order);
-	heap->tag_bits       = malloc(BITS_TO_LONGS(heap->num_min_blocks) * sizeof(long));
+	/* 
+	 * bitmap for minimum sized chunks. All min blocks start out
+	 * as allocated, i.e. not part of the heap until their region
+	 * is committed. The bitmaps are big for a big reservation, 
+	 * calloc lets the OS zero them lazily.
+	 */
+	heap->num_min_blocks = (1UL << heap->order) / (1UL << heap->min_order);
+	heap->tag_bits       = calloc(BITS_TO_LONGS(heap->num_min_blocks), sizeof(long));
 
 	if (!heap->tag_bits) {
 		HB_ERR("Could not allocate tag bits\n");
 		return -1;
 	}
 
+	/* slabs start out empty */
+	for (i = 0; i < HB_SLAB_CLASSES; i++) {
+		INIT_LIST_HEAD(&(heap->slab_partial[i]));
+		INIT_LIST_HEAD(&(heap->old_slab_partial[i]));
+	}
+
+	/* there are no old regions yet */
+	for (i = 0; i <= HB_REGION_ORDER; i++) {
+		INIT_LIST_HEAD(&(heap->old_lists[i]));
+	}
+
+	heap->slab_bits = calloc(BITS_TO_LONGS(1UL << (heap->order - HB_SLAB_ORDER)), sizeof(long));
+
+	if (!heap->slab_bits) {
+		HB_ERR("Could not allocate slab bits\n");
+		return -1;
+	}
+
+	heap->evac_bits = calloc(BITS_TO_LONGS(heap_max_regions()), sizeof(long));
+	heap->old_bits  = calloc(BITS_TO_LONGS(heap_max_regions()), sizeof(long));
+
+	if (!heap->evac_bits || !heap->old_bits) {
+		HB_ERR("Could not allocate region bits\n");
+		return -1;
+	}
+
+	heap->num_obj_granules = (1UL << heap->order) / HB_OBJ_ALIGN;
+	heap->obj_bits         = calloc(BITS_TO_LONGS(heap->num_obj_granules), sizeof(long));
+
+	if (!heap->obj_bits) {
+		HB_ERR("Could not allocate object bits\n");
+		return -1;
+	}
+
+#if HB_COMPRESSED_REFS == 1
+	hb_ref_base = (u8)heap_ptr - HB_OBJ_ALIGN;
+
+	if (los_init((u1*)heap_ptr + reserve) != 0) {
+#else
+	if (los_init(NULL) != 0) {
+#endif
+		HB_ERR("Could not initialize large object space\n");
+		return -1;
+	}
+
 	BUDDY_DEBUG("buddy allocator: num_blocks=%lu, tag_bits=%p, alloc=%lu\n", 
 		  heap->num_min_blocks, heap->tag_bits, BITS_TO_LONGS(heap->num_min_blocks)*sizeof(long));
 
-	/* mark all min blocks as allocated */
-	bitmap_zero(heap->tag_bits, heap->num_min_blocks);
-
-	/* now we free them up. free will automatically coalesce adjacent blocks */
-	u8 addr = (u8)heap->heap_region;
-	for (i = 0; i < heap->num_min_blocks; i++) {
-		buddy_free((void*)addr, heap->min_order);
-		addr += (1 << heap->min_order);
+	/* now we commit the initial heap */
+	if (heap_grow(init_size) != 0) {
+		HB_ERR("Could not commit initial heap\n");
+		return -1;
 	}
 
 	return 0;
@@ -121,46 +274,42 @@ heap_init (int heap_size_megs)
 obj_ref_t *
 array_alloc (u1 type, i4 count)
 {
-	obj_ref_t * ref = NULL;
+	return array_alloc_site(type, count, 0);
+}
+
+
+/*
+ * Same as array_alloc(), but records the allocation 
+ * site (see gc_alloc_site()). Arrays from sites the GC
+ * has decided to pretenure go in an old region.
+ *
+ */
+obj_ref_t *
+array_alloc_site (u1 type, i4 count, u4 site)
+{
 	native_obj_t * obj = NULL;
-	int sz;
 
 	MM_DEBUG("Allocating array of type %d length %d\n", type, count);
-	ref = malloc(sizeof(obj_ref_t));
-	if (!ref) {
-		HB_ERR("Could not allocate object ref\n");
-		return NULL;
-	}
-	memset(ref, 0, sizeof(obj_ref_t));
 
-	sz = sizeof(native_obj_t) + (sizeof(var_t)*(count+1));
-	
-	obj = alloc_checked(sz);
+	obj = alloc_checked(array_bytes(type, count), gc_pretenure(site));
 
+	// the caller decides whether to collect or throw
 	if (!obj) {
-		HB_ERR("THROWING OUT OF MEMORY EXCEPTION in %s\n", __func__);
-		// throw_exception();
+		MM_DEBUG("Out of memory in %s\n", __func__);
 		return HB_NULL;
 	}
 
-	obj->fields = (var_t*)((u8)obj + sizeof(native_obj_t));
-	obj->field_infos = NULL;
-	obj->field_count = count;
-
-	// set all entries to zero by default
-	memset(obj->fields, 0, sizeof(var_t)*(count+1));
-
 	// specify this is an array
 	obj->flags.array.isarray = 1;
 	obj->flags.array.type    = type;
 	obj->flags.array.length  = count;
+	obj->flags.array.gc_mark = alloc_mark(obj);
+
+	hb_set_obj_site(obj, site);
 
 	obj->class             = NULL;
 
-	ref->heap_ptr = (u8)obj;
-	ref->type     = OBJ_ARRAY;
-	
-	return ref;
+	return obj;
 }
 
 
@@ -179,7 +328,7 @@ string_object_alloc (const char * str)
 	native_obj_t * obj = NULL;
 	obj_ref_t * arr_ref = NULL;
 	native_obj_t * arr = NULL;
-	java_class_t * cls = hb_get_or_load_class("java/lang/String");
+	java_class_t * cls = hb_get_or_load_class_sym(hb_sym_string);
 	int i;
 
 	if (!cls) { 
@@ -187,29 +336,37 @@ string_object_alloc (const char * str)
 		return NULL;
 	}
 
-	ref = object_alloc(cls);
-	if (!ref) {
-		HB_ERR("Could not allocate string object\n");
+	/*
+	 * the array goes first: allocating it can run the GC,
+	 * and we're not holding on to anything yet. Note we 
+	 * don't create room for the null terminator
+	 */
+	arr_ref = gc_array_alloc(T_CHAR, strlen(str), 0);
+
+	if (!arr_ref) {
+		MM_DEBUG("Could not allocate character array for String object\n");
 		return NULL;
 	}
 
-	obj = (native_obj_t*)ref->heap_ptr;
-
-	// note we don't create room for the null terminator
-	arr_ref = gc_array_alloc(T_CHAR, strlen(str));
+	// allocating the String can collect, which might move the array
+	gc_protect(&arr_ref);
+	ref = gc_obj_alloc(cls, 0);
+	gc_unprotect();
 
-	if (!arr_ref) {
-		HB_ERR("Could not allocate character array for String object\n");
+	if (!ref) {
+		MM_DEBUG("Could not allocate string object\n");
 		return NULL;
 	}
 
-	arr = (native_obj_t*)arr_ref->heap_ptr;
+	arr = arr_ref;
+	obj = ref;
 
 	for (i = 0; i < strlen(str); i++) {
-		arr->fields[i].char_val = str[i];
+		HB_ARRAY_ELEMS(arr, u2)[i] = str[i];
 	}
 	
-	obj->fields[0].obj = arr_ref;
+	hb_store_ref(HB_FIELD_PTR(obj, 0, hb_ref_t), arr_ref);
+	gc_post_barrier(obj, arr_ref);
 
 	MM_DEBUG("String object allocated at %p (%s)\n", ref, str);
 
@@ -219,96 +376,187 @@ string_object_alloc (const char * str)
 
 
 /*
- * Allocates an object for the given class
+ * Allocates an object for the given class. The class
+ * must have been prepped, which gives us its instance
+ * template (header plus default field values) to copy.
  *
  * @return: a pointer to an object reference on
  * success, NULL otherwise.
  *
  * TODO: exceptions exceptions!
  *
- * TODO: instance vars should be set to their default values
- * based on constant pool
- *
  * Will be called from GC
  *
  */
 obj_ref_t * 
 object_alloc (java_class_t * cls)
 {
-	obj_ref_t * ref = NULL;
-	native_obj_t * obj = NULL;
-	int sz;
-	int field_count;
+	return object_alloc_site(cls, 0);
+}
 
-	ref = malloc(sizeof(obj_ref_t));
-	if (!ref) {
-		HB_ERR("Could not allocate object ref\n");
-		return NULL;
-	}
-	memset(ref, 0, sizeof(obj_ref_t));
 
-	field_count = hb_get_obj_field_count(cls);
+/*
+ * Same as object_alloc(), but records the allocation
+ * site, and pretenures the object if the GC says so.
+ *
+ */
+obj_ref_t * 
+object_alloc_site (java_class_t * cls, u4 site)
+{
+	native_obj_t * obj = NULL;
+	u4 size = inst_bytes(cls);
 
-	sz = sizeof(native_obj_t) + (sizeof(var_t)*field_count) + (sizeof(field_info_t*)*field_count);
+	if (!cls->inst_template) {
+		HB_ERR("Tried to instantiate unprepped class %s\n", hb_get_class_name(cls));
+		return HB_NULL;
+	}
 
-	obj = alloc_checked(sz);
+	obj = alloc_raw(size, gc_pretenure(site));
 
 	if (!obj) {
-		HB_ERR("THROWING OUT OF MEMORY EXCEPTION\n");
-		// throw_exception();
+		MM_DEBUG("Out of memory in %s\n", __func__);
 		return HB_NULL;
 	}
 
-	memset(obj, 0, sz);
+	memcpy(obj, cls->inst_template, size);
 
-	obj->class       = cls;
-	obj->field_count = field_count;
-	obj->fields      = (var_t*)((u8)obj + sizeof(native_obj_t));
-	obj->field_infos = (field_info_t**)((u8)obj->fields + (sizeof(var_t)*field_count));
+	obj->flags.obj.gc_mark = alloc_mark(obj);
 
-	if (hb_setup_obj_fields(obj, obj->class) < 0) {
-		HB_ERR("Could not setup fields for new object in class %s\n", hb_get_class_name(obj->class));
-		return HB_NULL;
+	hb_set_obj_site(obj, site);
+
+	return obj;
+}
+
+
+/*
+ * Makes a copy of an object somewhere else on the 
+ * heap (outside any region being evacuated). Used by
+ * the GC to move objects.
+ *
+ * @return: the copy, NULL if there's no room for it.
+ *
+ */
+native_obj_t *
+heap_copy_obj (native_obj_t * obj)
+{
+	u8 size = obj_bytes(obj);
+	native_obj_t * copy = alloc_raw(size, 0);
+
+	if (!copy) {
+		return NULL;
 	}
 
-	ref->heap_ptr = (u8)obj;
-	ref->type     = OBJ_OBJ;
-	
-	return ref;
+	memcpy(copy, obj, size);
+
+	return copy;
 }
 
 
 void
 object_free (native_obj_t * obj) {
-	buddy_free((void*)obj, obj->order);
+	if (is_los_obj(obj)) {
+		los_free(obj);
+		return;
+	}
+
+	clear_obj_start(obj);
+
+	if (is_slab_obj(obj)) {
+		slab_free(obj);
+	} else {
+		buddy_free((void*)obj, ilog2(roundup_pow_of_two(obj_bytes(obj))));
+	}
 }
 
 
 /*
- * Allocates an object with the given size.
- * The size will be rounded up to the nearest power of 2
- * so as to be amenable to the buddy allocator. 
+ * Allocates an object with the given size. Small
+ * objects come from the slab of their size class, large
+ * ones from the large object space. Anything in between is
+ * rounded up to the nearest power of 2 so as to be amenable 
+ * to the buddy allocator. If old is set, we try to
+ * put it in an old region first.
+ *
+ * The returned object is *not* initialized.
  *
  * @return: a pointer to a native object structure on success,
  * NULL otherwise.
  *
  */
-native_obj_t *
-alloc_checked (const u4 size)
+static native_obj_t *
+alloc_raw (const u8 size, int old)
 {
 	native_obj_t * obj = NULL;
-	u2 order = ilog2(roundup_pow_of_two(size));
+	u2 order;
+
+	// there's nowhere we could ever put it
+	if (size > heap_los_size() || size > heap->max_size) {
+		MM_DEBUG("Object of size %lu is too big for the heap\n", size);
+		return NULL;
+	}
 
-	MM_DEBUG("Allocating size %u (rounded up to %lu)\n", size, 1UL<<order);
+	if (size >= HB_LOS_MIN_OBJ) {
+		MM_DEBUG("Allocating size %lu from LOS\n", size);
+		obj = (native_obj_t*)los_alloc(size);
+		if (obj) {
+			heap->total_alloc += size;
+		}
+		return obj;
+	}
 
-	obj = (native_obj_t*)buddy_alloc(order);
+	if (old) {
+		obj = (native_obj_t*)((size <= HB_SLAB_MAX_OBJ) ? 
+				      slab_alloc(size, 1) : 
+				      old_alloc(ilog2(roundup_pow_of_two(size))));
+	}
 
-	if (!obj) {
-		return NULL;
+	while (!obj) {
+
+		if (size <= HB_SLAB_MAX_OBJ) {
+			MM_DEBUG("Allocating size %lu from slab\n", size);
+			obj = (native_obj_t*)slab_alloc(size, 0);
+		} else {
+			order = ilog2(roundup_pow_of_two(size));
+			MM_DEBUG("Allocating size %lu (rounded up to %lu)\n", size, 1UL<<order);
+			obj = (native_obj_t*)buddy_alloc(order);
+		}
+
+		if (obj) {
+			break;
+		}
+
+		/* 
+		 * out of room. If the GC hasn't finished sweeping yet, 
+		 * have it sweep some more, otherwise see if we can grow 
+		 * the heap instead of failing
+		 */
+		if (gc_sweep_some(size) != 0 && heap_grow(size) != 0) {
+			return NULL;
+		}
 	}
 
-	obj->flags.val = 0;
-	obj->order     = order;
+	set_obj_start(obj);
+
+	heap->total_alloc += size;
+
+	return obj;
+}
+
+
+/*
+ * Same as alloc_raw(), but the returned
+ * object is zeroed.
+ *
+ */
+native_obj_t *
+alloc_checked (const u8 size, int old)
+{
+	native_obj_t * obj = alloc_raw(size, old);
+
+	// LOS pages are always fresh (zero-filled) when handed out
+	if (obj && !is_los_obj(obj)) {
+		memset(obj, 0, size);
+	}
 
 	return obj;
 }
@@ -367,7 +615,7 @@ clearb (u8 nr, volatile char *addr)
  * A block's index is used to find the block's tag bit, mp->tag_bits[block_id].
  */
 static inline u8
-block_to_id (native_obj_t *block)
+block_to_id (struct buddy_block *block)
 {
     u8 block_id =
         ((u8)block - (u8)heap->heap_region) >> heap->min_order;
@@ -380,9 +628,9 @@ block_to_id (native_obj_t *block)
  * Marks a block as free by setting its tag bit to one.
  */
 static inline void
-mark_available (native_obj_t *blk)
+mark_available (struct buddy_block *blk)
 {
-    if (blk == (native_obj_t*)0xdfa00000ULL) {
+    if (blk == (struct buddy_block*)0xdfa00000ULL) {
 	BUDDY_DEBUG("Magic block %p: block_to_id=%lu\n", blk, block_to_id(blk));
     }
 
@@ -394,7 +642,7 @@ mark_available (native_obj_t *blk)
  * Marks a block as allocated by setting its tag bit to zero.
  */
 static inline void
-mark_allocated (native_obj_t *blk)
+mark_allocated (struct buddy_block *blk)
 {
     __clear_bit(block_to_id(blk), (volatile char *)heap->tag_bits);
 }
@@ -404,7 +652,7 @@ mark_allocated (native_obj_t *blk)
  * Returns true if block is free, false if it is allocated.
  */
 static inline int
-is_available (native_obj_t *blk)
+is_available (struct buddy_block *blk)
 {
     return test_bit(block_to_id(blk), heap->tag_bits);
 }
@@ -414,7 +662,7 @@ is_available (native_obj_t *blk)
  * Returns the address of the block's buddy block.
  */
 static void *
-find_buddy (native_obj_t *blk, u2 order)
+find_buddy (struct buddy_block *blk, u2 order)
 {
     u8 _block;
     u8 _buddy;
@@ -430,17 +678,22 @@ find_buddy (native_obj_t *blk, u2 order)
 }
 
 
-void *
-buddy_alloc (u2 order)
+/*
+ * Allocates a block from the given set of free lists, 
+ * which hold blocks of up to order top.
+ *
+ */
+static void *
+block_alloc (struct list_head * lists, u2 top, u2 order)
 {
     u2 j;
     struct list_head *list;
-    native_obj_t *blk;
-    native_obj_t *buddy_blk;
+    struct buddy_block *blk;
+    struct buddy_block *buddy_blk;
 
     BUDDY_DEBUG("BUDDY ALLOC order: %u\n", order);
 
-    if (order > heap->order) {
+    if (order > top) {
 	BUDDY_DEBUG("order is too big\n");
         return NULL;
     }
@@ -451,17 +704,36 @@ buddy_alloc (u2 order)
 	BUDDY_DEBUG("order expanded to %u\n",order);
     }
 
-    for (j = order; j <= heap->order; j++) {
+    for (j = order; j <= top; j++) {
 
         /* Try to allocate the first block in the order j list */
-        list = &heap->free_lists[j];
+        list = &lists[j];
 
         if (list_empty(list)) {
 	    BUDDY_DEBUG("Skipping order %u as the list is empty\n", j);
             continue;
         }
 
-        blk = list_entry(list->next, native_obj_t, link);
+        blk = list_entry(list->next, struct buddy_block, link);
+
+        /* Don't hand out space in a region the GC is emptying */
+        if (heap->nr_evac && in_evac_region(blk)) {
+            struct buddy_block * b = NULL;
+
+            blk = NULL;
+
+            list_for_each_entry(b, list, link) {
+                if (!in_evac_region(b)) {
+                    blk = b;
+                    break;
+                }
+            }
+
+            if (!blk) {
+                continue;
+            }
+        }
+
         list_del_init(&blk->link);
         mark_allocated(blk);
 
@@ -470,11 +742,11 @@ buddy_alloc (u2 order)
         /* Trim if a higher order block than necessary was allocated */
         while (j > order) {
             --j;
-            buddy_blk = (native_obj_t*)((u8)blk + (1UL << j));
+            buddy_blk = (struct buddy_block*)((u8)blk + (1UL << j));
             buddy_blk->order = j;
             mark_available(buddy_blk);
 	    BUDDY_DEBUG("Inserted buddy block %p into order %u\n", buddy_blk, j);
-            list_add(&buddy_blk->link, &heap->free_lists[j]);
+            list_add(&buddy_blk->link, &lists[j]);
         }
 
 	blk->order = j;
@@ -491,10 +763,62 @@ buddy_alloc (u2 order)
     return NULL;
 }
 
-void
-buddy_free (void * addr, u2 order)
+void *
+buddy_alloc (u2 order)
+{
+	return block_alloc(heap->free_lists, heap->order, order);
+}
+
+
+/*
+ * Allocates a block in an old region. If none of them
+ * have room, we take an entirely free region from the rest 
+ * of the heap and make it old.
+ *
+ */
+static void *
+old_alloc (u2 order)
+{
+	struct buddy_block * region = NULL;
+	void * blk = block_alloc(heap->old_lists, HB_REGION_ORDER, order);
+
+	if (blk) {
+		return blk;
+	}
+
+	region = buddy_alloc(HB_REGION_ORDER);
+
+	if (!region) {
+		return NULL;
+	}
+
+	__set_bit(((u8)region - (u8)heap->heap_region) >> HB_REGION_ORDER, (volatile char*)heap->old_bits);
+	heap->nr_old++;
+
+	// it's free space again, just in the old lists
+	heap->allocated -= HB_REGION_SIZE;
+
+	region->order = HB_REGION_ORDER;
+	mark_available(region);
+	list_add(&region->link, &heap->old_lists[HB_REGION_ORDER]);
+
+	MM_DEBUG("Region at %p is now old\n", region);
+
+	return block_alloc(heap->old_lists, HB_REGION_ORDER, order);
+}
+
+
+/*
+ * Gives a block back to the given set of free lists,
+ * coalescing it with its buddies up to order top.
+ *
+ * @return: the (coalesced) free block
+ *
+ */
+static struct buddy_block *
+block_free (struct list_head * lists, u2 top, void * addr, u2 order)
 {
-	native_obj_t * blk = NULL;
+	struct buddy_block * blk = NULL;
 
 	BUDDY_DEBUG("BUDDY FREE on addr=%p, order=%u\n", addr, order);
 
@@ -503,20 +827,20 @@ buddy_free (void * addr, u2 order)
 		BUDDY_DEBUG("order updated to %u\n", heap->min_order);
 	}
 
-	if (order > heap->order) {
+	if (order > top) {
 		HB_ERR("Tried to free block bigger than heap!\n");
-		return;
+		return NULL;
 	}
 
-	blk = (native_obj_t*)addr;
+	blk = (struct buddy_block*)addr;
 
 	/* TODO: make sure this is not an already free block */
 
 	heap->allocated -= (1UL << order);
 
 	/* coalescing stage */
-	while (order < heap->order) {
-		native_obj_t * buddy = find_buddy(blk, order);
+	while (order < top) {
+		struct buddy_block * buddy = find_buddy(blk, order);
 		BUDDY_DEBUG("buddy at order %u is %p\n", order, buddy);
 		
 		if (!is_available(buddy)) {
@@ -532,6 +856,9 @@ buddy_free (void * addr, u2 order)
 		BUDDY_DEBUG("Buddy merge\n");
 		
 		list_del_init(&(buddy->link));
+
+		// it's no longer the head of a free block
+		mark_allocated(buddy);
 		if (buddy < blk) {
 			blk = buddy;
 		}
@@ -541,15 +868,887 @@ buddy_free (void * addr, u2 order)
 	blk->order = order;
 
 	BUDDY_DEBUG("End of search: block=%p order=%u heap order=%u block->order=%u\n",
-			blk, order, heap->order, blk->order);
+			blk, order, top, blk->order);
 
 	mark_available(blk);
 
-	list_add(&(blk->link), &(heap->free_lists[order]));
+	list_add(&(blk->link), &(lists[order]));
 	
 	if (blk->order == -1) {
 		HB_ERR("FAIL: block order went nuts\n");
 	}
+
+	return blk;
+}
+
+
+void
+buddy_free (void * addr, u2 order)
+{
+	struct buddy_block * blk = NULL;
+
+	if (!heap->nr_old || !in_old_region(addr)) {
+		block_free(heap->free_lists, heap->order, addr, order);
+		return;
+	}
+
+	blk = block_free(heap->old_lists, HB_REGION_ORDER, addr, order);
+
+	if (!blk || blk->order != HB_REGION_ORDER) {
+		return;
+	}
+
+	// the whole region is free, it goes back to the rest of the heap
+	list_del_init(&blk->link);
+	mark_allocated(blk);
+
+	__clear_bit(((u8)blk - (u8)heap->heap_region) >> HB_REGION_ORDER, (volatile char*)heap->old_bits);
+	heap->nr_old--;
+
+	heap->allocated += HB_REGION_SIZE;
+
+	block_free(heap->free_lists, heap->order, blk, HB_REGION_ORDER);
+}
+
+
+
+
+
+static inline void
+set_obj_start (native_obj_t * obj)
+{
+	__set_bit(((u8)obj - (u8)heap->heap_region) / HB_OBJ_ALIGN, (volatile char*)heap->obj_bits);
+}
+
+
+static inline void
+clear_obj_start (native_obj_t * obj)
+{
+	__clear_bit(((u8)obj - (u8)heap->heap_region) / HB_OBJ_ALIGN, (volatile char*)heap->obj_bits);
+}
+
+
+/*
+ * Trims an over-sized mapping so that what's left
+ * is size bytes starting on an align boundary. The
+ * mapping must be size + align bytes long.
+ *
+ */
+static void *
+trim_mapping (void * ptr, u8 size, u8 align)
+{
+	u8 start = ((u8)ptr + align - 1) & ~(align - 1);
+	u8 head  = start - (u8)ptr;
+
+	if (head) {
+		munmap(ptr, head);
+	}
+
+	munmap((void*)(start + size), align - head);
+
+	return (void*)start;
+}
+
+
+/*
+ * Backs the given range of the heap with memory up front
+ * so that we don't take the page faults later on during 
+ * allocation or GC. 
+ *
+ */
+static void
+prefault (void * addr, u8 len)
+{
+	u8 i;
+
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(addr, len, MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+
+	// older kernels, just touch every page
+	for (i = 0; i < len; i += HB_PAGE_SIZE) {
+		((volatile char*)addr)[i] = 0;
+	}
+}
+
+
+/*
+ * Takes the (entirely free) region at the given address
+ * out of the buddy allocator. We find the free block that 
+ * covers it and split that down to the region, giving the 
+ * other halves back to the free lists.
+ *
+ * @return: 0 on success, -1 if the region isn't free.
+ *
+ */
+static int
+carve_region (void * addr)
+{
+	u8 off = (u8)addr - (u8)heap->heap_region;
+	struct buddy_block * blk = NULL;
+	u2 order;
+
+	for (order = HB_REGION_ORDER; order <= heap->order; order++) {
+		struct buddy_block * b = (struct buddy_block*)((u8)heap->heap_region + (off & ~((1UL << order) - 1)));
+
+		if (is_available(b) && b->order == order) {
+			blk = b;
+			break;
+		}
+	}
+
+	if (!blk) {
+		return -1;
+	}
+
+	list_del_init(&blk->link);
+	mark_allocated(blk);
+
+	while (order > HB_REGION_ORDER) {
+		struct buddy_block * hi = NULL;
+		struct buddy_block * other = NULL;
+
+		--order;
+
+		hi = (struct buddy_block*)((u8)blk + (1UL << order));
+
+		if ((u8)addr >= (u8)hi) {
+			other = blk;
+			blk   = hi;
+		} else {
+			other = hi;
+		}
+
+		other->order = order;
+		mark_available(other);
+		list_add(&other->link, &heap->free_lists[order]);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Grows the heap by committing at least the
+ * given number of bytes worth of regions at the
+ * top of the heap.
+ *
+ * @return: 0 if the heap grew, -1 if it's already
+ * at its maximum size.
+ *
+ */
+int
+heap_grow (u8 bytes)
+{
+	u8 start = heap->committed;
+	u8 end   = heap->committed + ((bytes + HB_REGION_SIZE - 1) & ~(HB_REGION_SIZE - 1));
+
+	if (end > heap->max_size) {
+		end = heap->max_size;
+	}
+
+	if (end <= start) {
+		return -1;
+	}
+
+	/* 
+	 * we hand the new space to the buddy allocator in the biggest
+	 * aligned blocks that fit, so a big heap is a handful of free 
+	 * list insertions rather than one per region
+	 */
+	while (heap->committed < end) {
+		u8 off = heap->committed;
+		u2 order = HB_REGION_ORDER;
+
+		while (order < heap->order &&
+		       !(off & ((1UL << (order + 1)) - 1)) &&
+		       off + (1UL << (order + 1)) <= end) {
+			order++;
+		}
+
+		// buddy_free() takes this back off
+		heap->allocated += (1UL << order);
+
+		buddy_free((void*)((u8)heap->heap_region + off), order);
+
+		heap->committed += (1UL << order);
+	}
+
+	if (heap->flags & HB_HEAP_PRETOUCH) {
+		prefault((void*)((u8)heap->heap_region + start), end - start);
+	}
+
+	MM_DEBUG("Heap grew to %lu KB\n", heap->committed >> 10);
+
+	return 0;
+}
+
+
+/*
+ * Shrinks the heap by giving up to the given number
+ * of bytes worth of regions at the top of the heap back
+ * to the OS. Only regions that are entirely free can go, 
+ * and we never go below the initial heap size.
+ *
+ * @return: the number of bytes released
+ *
+ */
+u8
+heap_shrink (u8 bytes)
+{
+	u8 released = 0;
+
+	while (released < bytes && heap->committed >= heap->min_committed + HB_REGION_SIZE) {
+		void * region = (void*)((u8)heap->heap_region + heap->committed - HB_REGION_SIZE);
+
+		if (carve_region(region) != 0) {
+			break;
+		}
+
+		madvise(region, HB_REGION_SIZE, MADV_DONTNEED);
+
+		heap->committed -= HB_REGION_SIZE;
+		released += HB_REGION_SIZE;
+	}
+
+	MM_DEBUG("Heap shrunk to %lu KB\n", heap->committed >> 10);
+
+	return released;
+}
+
+
+/*
+ * While the GC is marking concurrently, objects
+ * allocated by the mutator have to start out marked
+ * (they weren't part of the snapshot marking is
+ * working from).
+ *
+ */
+void
+heap_set_alloc_marked (int on)
+{
+	heap->alloc_marked = on;
+}
+
+
+/*
+ * Starts a lazy sweep of the heap as it is now (the
+ * GC will walk it with heap_sweep_next()). Until the sweep 
+ * passes them, objects allocated in the part that hasn't
+ * been swept start out marked, so they aren't mistaken for
+ * garbage.
+ *
+ */
+void
+heap_begin_sweep (void)
+{
+	heap->sweep_cursor = 0;
+	heap->sweep_limit  = heap->committed;
+}
+
+
+/*
+ * Moves the lazy sweep past the next allocated object.
+ *
+ * @return: the object, NULL if the sweep is done.
+ *
+ */
+native_obj_t *
+heap_sweep_next (void)
+{
+	u8 end = heap->sweep_limit / HB_OBJ_ALIGN;
+	u8 idx;
+
+	if (!heap_sweep_pending()) {
+		return NULL;
+	}
+
+	idx = find_next_bit((unsigned long*)heap->obj_bits, end, heap->sweep_cursor / HB_OBJ_ALIGN);
+
+	if (idx >= end) {
+		heap->sweep_cursor = heap->sweep_limit;
+		return NULL;
+	}
+
+	heap->sweep_cursor = (idx + 1) * HB_OBJ_ALIGN;
+
+	return (native_obj_t*)((u8)heap->heap_region + idx * HB_OBJ_ALIGN);
+}
+
+
+/*
+ * Returns the index of the heap region the address
+ * is in, -1 if it's not on the heap (e.g. in the LOS).
+ *
+ */
+int
+heap_region_of (void * addr)
+{
+	u8 off = (u8)addr - (u8)heap->heap_region;
+
+	if ((u8)addr < (u8)heap->heap_region || off >= heap->committed) {
+		return -1;
+	}
+
+	return off >> HB_REGION_ORDER;
+}
+
+
+u4
+heap_max_regions (void)
+{
+	return heap->max_size >> HB_REGION_ORDER;
+}
+
+
+/*
+ * While a region is being evacuated, the allocator
+ * won't hand out space in it.
+ *
+ */
+void
+heap_set_evacuating (u4 region, int on)
+{
+	if (on == !!test_bit(region, (unsigned long*)heap->evac_bits)) {
+		return;
+	}
+
+	if (on) {
+		__set_bit(region, (volatile char*)heap->evac_bits);
+		heap->nr_evac++;
+	} else {
+		__clear_bit(region, (volatile char*)heap->evac_bits);
+		heap->nr_evac--;
+	}
+}
+
+
+static inline int
+in_evac_region (void * addr)
+{
+	return test_bit(((u8)addr - (u8)heap->heap_region) >> HB_REGION_ORDER, (unsigned long*)heap->evac_bits);
+}
+
+
+static inline int
+in_old_region (void * addr)
+{
+	return test_bit(((u8)addr - (u8)heap->heap_region) >> HB_REGION_ORDER, (unsigned long*)heap->old_bits);
+}
+
+
+/*
+ * Returns true if the region holds pretenured
+ * objects. The GC doesn't evacuate these.
+ *
+ */
+int
+heap_region_is_old (u4 region)
+{
+	return test_bit(region, (unsigned long*)heap->old_bits);
+}
+
+
+u4
+heap_old_regions (void)
+{
+	return heap->nr_old;
+}
+
+
+/*
+ * Iterates over the allocated objects in one region,
+ * in address order. Pass NULL to get the first one.
+ *
+ * @return: the next object after obj, NULL if there
+ * are no more.
+ *
+ */
+native_obj_t *
+heap_region_next_obj (u4 region, native_obj_t * obj)
+{
+	u8 start = obj ? (((u8)obj - (u8)heap->heap_region) / HB_OBJ_ALIGN) + 1 : 
+		((u8)region << HB_REGION_ORDER) / HB_OBJ_ALIGN;
+	u8 end   = ((u8)(region + 1) << HB_REGION_ORDER) / HB_OBJ_ALIGN;
+	u8 idx   = find_next_bit((unsigned long*)heap->obj_bits, end, start);
+
+	if (idx >= end) {
+		return NULL;
+	}
+
+	return (native_obj_t*)((u8)heap->heap_region + idx * HB_OBJ_ALIGN);
+}
+
+
+int
+heap_sweep_pending (void)
+{
+	return heap->sweep_cursor < heap->sweep_limit;
+}
+
+
+/*
+ * Whether a new object should start out marked, 
+ * either because the GC is marking or because it lies
+ * in a part of the heap a lazy sweep hasn't reached yet.
+ *
+ */
+static inline int
+alloc_mark (native_obj_t * obj)
+{
+	u8 off = (u8)obj - (u8)heap->heap_region;
+
+	if (heap->alloc_marked) {
+		return 1;
+	}
+
+	return !is_los_obj(obj) && off >= heap->sweep_cursor && off < heap->sweep_limit;
+}
+
+
+u8
+heap_used (void)
+{
+	return heap->allocated;
+}
+
+
+u8
+heap_committed (void)
+{
+	return heap->committed;
+}
+
+
+/*
+ * Bytes allocated since startup, including
+ * large objects. The GC uses this to keep track 
+ * of the allocation rate.
+ *
+ */
+u8
+heap_total_alloc (void)
+{
+	return heap->total_alloc;
+}
+
+
+u8
+heap_los_used (void)
+{
+	return heap->los_used << HB_PAGE_SHIFT;
+}
+
+
+u8
+heap_los_size (void)
+{
+	return heap->los_pages << HB_PAGE_SHIFT;
+}
+
+
+/*
+ * Returns true if the given address is the start
+ * of a live (allocated) object on the heap. This
+ * is how the GC recognizes references.
+ */
+int
+heap_is_obj (void * addr)
+{
+	u8 off = (u8)addr - (u8)heap->heap_region;
+
+	if (is_los_obj(addr)) {
+		off = (u8)addr - (u8)heap->los_region;
+		return !(off & (HB_PAGE_SIZE - 1)) && 
+			test_bit(off >> HB_PAGE_SHIFT, (unsigned long*)heap->los_start_bits);
+	}
+
+	if ((u8)addr < (u8)heap->heap_region || off >= (1UL << heap->order)) {
+		return 0;
+	}
+
+	if (off & (HB_OBJ_ALIGN - 1)) {
+		return 0;
+	}
+
+	return test_bit(off / HB_OBJ_ALIGN, (unsigned long*)heap->obj_bits);
+}
+
+
+/*
+ * Iterates over allocated objects in address order.
+ * Pass NULL to get the first one. 
+ *
+ * @return: the next object after obj, NULL if there
+ * are no more.
+ *
+ */
+native_obj_t *
+heap_next_obj (native_obj_t * obj)
+{
+	u8 start = obj ? (((u8)obj - (u8)heap->heap_region) / HB_OBJ_ALIGN) + 1 : 0;
+	u8 idx;
+
+	if (start >= heap->num_obj_granules) {
+		return NULL;
+	}
+
+	idx = find_next_bit((unsigned long*)heap->obj_bits, heap->num_obj_granules, start);
+
+	if (idx >= heap->num_obj_granules) {
+		return NULL;
+	}
+
+	return (native_obj_t*)((u8)heap->heap_region + idx * HB_OBJ_ALIGN);
+}
+
+
+/*
+ * Returns the number of heap bytes an allocated
+ * object actually occupies.
+ */
+u4
+object_size (native_obj_t * obj)
+{
+	if (is_los_obj(obj)) {
+		return los_run_pages(((u8)obj - (u8)heap->los_region) >> HB_PAGE_SHIFT) << HB_PAGE_SHIFT;
+	}
+
+	if (is_slab_obj(obj)) {
+		return addr_to_slab(obj)->obj_size;
+	}
+
+	u2 order = ilog2(roundup_pow_of_two(obj_bytes(obj)));
+
+	return 1UL << (order < heap->min_order ? heap->min_order : order);
+}
+
+
+/*
+ * Returns true if the address lies in a
+ * block that has been carved up into a slab.
+ */
+static inline int
+is_slab_obj (void * addr)
+{
+	u8 idx = ((u8)addr - (u8)heap->heap_region) >> HB_SLAB_ORDER;
+	return test_bit(idx, (unsigned long*)heap->slab_bits);
+}
+
+
+static inline struct slab *
+addr_to_slab (void * addr)
+{
+	u8 off = (u8)addr - (u8)heap->heap_region;
+	return (struct slab*)((u8)heap->heap_region + (off & ~(HB_SLAB_SIZE - 1)));
+}
+
+
+/*
+ * Grabs a fresh block from the buddy allocator (or 
+ * an old region) and sets it up as a slab for the given 
+ * size class.
+ *
+ * @return: the new slab on success, NULL otherwise.
+ *
+ */
+static struct slab *
+slab_create (u2 cls_idx, int old)
+{
+	struct slab * s = NULL;
+	u2 obj_size = (cls_idx + 1) * HB_SLAB_GRANULE;
+	u2 first = (sizeof(struct slab) + HB_SLAB_GRANULE - 1) & ~(HB_SLAB_GRANULE - 1);
+
+	s = (struct slab*)(old ? old_alloc(HB_SLAB_ORDER) : buddy_alloc(HB_SLAB_ORDER));
+
+	if (!s) {
+		return NULL;
+	}
+
+	memset(s, 0, sizeof(struct slab));
+
+	s->obj_size = obj_size;
+	s->first    = first;
+	s->nr_objs  = (HB_SLAB_SIZE - first) / obj_size;
+	s->nr_free  = s->nr_objs;
+
+	__set_bit(((u8)s - (u8)heap->heap_region) >> HB_SLAB_ORDER, (volatile char*)heap->slab_bits);
+
+	list_add(&s->link, old ? &heap->old_slab_partial[cls_idx] : &heap->slab_partial[cls_idx]);
+
+	heap->slab_pages++;
+
+	MM_DEBUG("New slab at %p for size %u (%u objs)\n", s, obj_size, s->nr_objs);
+
+	return s;
+}
+
+
+/*
+ * Allocates an object from the slab of the size class
+ * that fits it, creating a new slab if all of them
+ * are full. Pretenured objects have slabs of their own,
+ * in old regions.
+ *
+ * @return: the object on success, NULL otherwise.
+ *
+ */
+static void *
+slab_alloc (u4 size, int old)
+{
+	u2 cls_idx = (size + HB_SLAB_GRANULE - 1) / HB_SLAB_GRANULE - 1;
+	struct list_head * list = old ? &heap->old_slab_partial[cls_idx] : &heap->slab_partial[cls_idx];
+	struct slab * s = NULL;
+	unsigned long slot;
+
+	if (!list_empty(list)) {
+		s = list_entry(list->next, struct slab, link);
+	}
+
+	// skip slabs in regions the GC is emptying
+	if (s && heap->nr_evac && in_evac_region(s)) {
+		struct slab * p = NULL;
+
+		s = NULL;
+
+		list_for_each_entry(p, list, link) {
+			if (!in_evac_region(p)) {
+				s = p;
+				break;
+			}
+		}
+	}
+
+	if (!s) {
+		s = slab_create(cls_idx, old);
+		if (!s) {
+			return NULL;
+		}
+	}
+
+	slot = find_first_zero_bit(s->alloc_bits, s->nr_objs);
+
+	__set_bit(slot, (volatile char*)s->alloc_bits);
+
+	// this slab is full, take it off the partial list
+	if (--s->nr_free == 0) {
+		list_del_init(&s->link);
+	}
+
+	heap->slab_bytes += s->obj_size;
+
+	return (void*)((u8)s + s->first + slot * s->obj_size);
+}
+
+
+/*
+ * Returns an object to its slab. If the slab 
+ * becomes empty, its block goes back to the buddy
+ * allocator.
+ *
+ */
+static void
+slab_free (void * addr)
+{
+	struct slab * s = addr_to_slab(addr);
+	u2 cls_idx = s->obj_size / HB_SLAB_GRANULE - 1;
+	u8 slot = ((u8)addr - (u8)s - s->first) / s->obj_size;
+
+	if (!test_bit(slot, s->alloc_bits)) {
+		HB_ERR("Double free of slab object %p\n", addr);
+		return;
+	}
+
+	__clear_bit(slot, (volatile char*)s->alloc_bits);
+
+	heap->slab_bytes -= s->obj_size;
+
+	// was full, it can hand out objects again
+	if (s->nr_free++ == 0) {
+		list_add(&s->link, (heap->nr_old && in_old_region(s)) ? 
+			 &heap->old_slab_partial[cls_idx] : 
+			 &heap->slab_partial[cls_idx]);
+	}
+
+	if (s->nr_free == s->nr_objs) {
+		list_del_init(&s->link);
+		__clear_bit(((u8)s - (u8)heap->heap_region) >> HB_SLAB_ORDER, (volatile char*)heap->slab_bits);
+		heap->slab_pages--;
+		buddy_free(s, HB_SLAB_ORDER);
+	}
+}
+
+
+/*
+ * Reserves the address range for the large object space. 
+ * Nothing is backed until it is touched.
+ *
+ * @region: an already reserved range to use, or NULL
+ * to reserve a new one
+ *
+ * @return: 0 on success, -1 otherwise.
+ *
+ */
+static int
+los_init (void * region)
+{
+	heap->los_pages  = HB_LOS_DEFAULT_SIZE >> HB_PAGE_SHIFT;
+	heap->los_region = region;
+
+	if (!region) {
+		heap->los_region = mmap(NULL,
+					HB_LOS_DEFAULT_SIZE,
+					PROT_READ|PROT_WRITE,
+					MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,
+					-1,
+					0);
+	}
+
+	if (heap->los_region == MAP_FAILED) {
+		HB_ERR("Could not reserve large object space\n");
+		return -1;
+	}
+
+	heap->los_used_bits  = malloc(BITS_TO_LONGS(heap->los_pages) * sizeof(long));
+	heap->los_start_bits = malloc(BITS_TO_LONGS(heap->los_pages) * sizeof(long));
+
+	if (!heap->los_used_bits || !heap->los_start_bits) {
+		HB_ERR("Could not allocate LOS bits\n");
+		return -1;
+	}
+
+	bitmap_zero((unsigned long*)heap->los_used_bits, heap->los_pages);
+	bitmap_zero((unsigned long*)heap->los_start_bits, heap->los_pages);
+
+	return 0;
+}
+
+
+static inline int
+is_los_obj (void * addr)
+{
+	return (u8)addr >= (u8)heap->los_region && 
+	       (u8)addr < (u8)heap->los_region + (heap->los_pages << HB_PAGE_SHIFT);
+}
+
+
+/*
+ * Returns the number of pages in the run
+ * of the large object that starts at the given page.
+ */
+static u8
+los_run_pages (u8 start)
+{
+	u8 end  = find_next_zero_bit((unsigned long*)heap->los_used_bits, heap->los_pages, start);
+	u8 next = find_next_bit((unsigned long*)heap->los_start_bits, heap->los_pages, start + 1);
+
+	return (next < end ? next : end) - start;
+}
+
+
+/*
+ * Finds the first run of free pages big enough
+ * for the given size in the LOS.
+ *
+ * @return: the object on success, NULL otherwise.
+ *
+ */
+static void *
+los_alloc (u8 size)
+{
+	u8 npages = (size + HB_PAGE_SIZE - 1) >> HB_PAGE_SHIFT;
+	u8 start  = 0;
+	u8 end;
+	u8 i;
+
+	while (1) {
+		start = find_next_zero_bit((unsigned long*)heap->los_used_bits, heap->los_pages, start);
+
+		if (start + npages > heap->los_pages) {
+			return NULL;
+		}
+
+		end = find_next_bit((unsigned long*)heap->los_used_bits, heap->los_pages, start);
+
+		if (end - start >= npages) {
+			break;
+		}
+
+		start = end;
+	}
+
+	for (i = start; i < start + npages; i++) {
+		__set_bit(i, (volatile char*)heap->los_used_bits);
+	}
+
+	__set_bit(start, (volatile char*)heap->los_start_bits);
+
+	heap->los_used += npages;
+
+	MM_DEBUG("LOS object at page %lu (%lu pages)\n", start, npages);
+
+	return (void*)((u8)heap->los_region + (start << HB_PAGE_SHIFT));
+}
+
+
+/*
+ * Frees a large object, giving its pages
+ * back to the OS.
+ *
+ */
+static void
+los_free (void * addr)
+{
+	u8 start = ((u8)addr - (u8)heap->los_region) >> HB_PAGE_SHIFT;
+	u8 npages;
+	u8 i;
+
+	if (!test_bit(start, (unsigned long*)heap->los_start_bits)) {
+		HB_ERR("Bad free of large object %p\n", addr);
+		return;
+	}
+
+	npages = los_run_pages(start);
+
+	madvise(addr, npages << HB_PAGE_SHIFT, MADV_DONTNEED);
+
+	__clear_bit(start, (volatile char*)heap->los_start_bits);
+
+	for (i = start; i < start + npages; i++) {
+		__clear_bit(i, (volatile char*)heap->los_used_bits);
+	}
+
+	heap->los_used -= npages;
+}
+
+
+/*
+ * Iterates over large objects in address order.
+ * Pass NULL to get the first one. 
+ *
+ * @return: the next large object after obj, NULL if
+ * there are no more.
+ *
+ */
+native_obj_t *
+los_next_obj (native_obj_t * obj)
+{
+	u8 start = obj ? (((u8)obj - (u8)heap->los_region) >> HB_PAGE_SHIFT) + 1 : 0;
+	u8 idx;
+
+	if (start >= heap->los_pages) {
+		return NULL;
+	}
+
+	idx = find_next_bit((unsigned long*)heap->los_start_bits, heap->los_pages, start);
+
+	if (idx >= heap->los_pages) {
+		return NULL;
+	}
+
+	return (native_obj_t*)((u8)heap->los_region + (idx << HB_PAGE_SHIFT));
 }
 
 
@@ -559,8 +1758,13 @@ buddy_stats (void)
 	HB_INFO("HEAP ADDR: %p\n", heap->heap_region);
 	HB_INFO("HEAP SIZE: %luB\n", (1UL<<heap->order));
 	HB_INFO("HEAP ALLOC: %luB\n", heap->allocated);
-	HB_INFO("HEAP FREE: %luB\n", (1UL<<heap->order) - heap->allocated);
+	HB_INFO("HEAP FREE: %luB\n", heap->committed - heap->allocated);
 	HB_INFO("HEAP MIN ORDER: %u (%lu B)\n", heap->min_order, (1UL<<heap->min_order));
 	HB_INFO("HEAP #MIN BLKS: %lu\n", heap->num_min_blocks);
+	HB_INFO("HEAP SLABS: %lu (%luB in use of %luB)\n", 
+		heap->slab_pages, heap->slab_bytes, heap->slab_pages * HB_SLAB_SIZE);
+	HB_INFO("HEAP COMMITTED: %luB (max %luB)\n", heap->committed, heap->max_size);
+	HB_INFO("HEAP LOS: %luB in use of %luB\n",
+		heap->los_used << HB_PAGE_SHIFT, heap->los_pages << HB_PAGE_SHIFT);
 }
 
@@ -7,6 +7,10 @@ SRC += src/mm.c \
        src/native.c \
        src/bc_interp.c \
        src/exceptions.c \
-       src/gc.c 
+       src/gc.c \
+       src/stackmap.c \
+       src/inflate.c \
+       src/metaspace.c \
+       src/symbol.c
 
 include src/arch/modules.mk
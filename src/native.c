@@ -41,13 +41,13 @@ handle_putStringToStdout0 (obj_ref_t * thisref, obj_ref_t * strref)
 	native_obj_t * arr_obj;
 	int i;
 
-	strobj = (native_obj_t*)strref->heap_ptr;
+	strobj = strref;
 	
-	arr_ref = strobj->fields[0].obj;
-	arr_obj = (native_obj_t*)arr_ref->heap_ptr;
+	arr_ref = hb_load_ref(HB_FIELD_PTR(strobj, 0, hb_ref_t));
+	arr_obj = arr_ref;
 
 	for (i = 0; i < arr_obj->flags.array.length; i++) {
-		 putchar(arr_obj->fields[i].char_val);
+		 putchar(HB_ARRAY_ELEMS(arr_obj, u2)[i]);
 	}
 
 	return 0;
@@ -76,7 +76,6 @@ hb_pop_frame (jthread_t * t)
 }
 
 
-/* TODO handle arrays... */
 static int
 get_parm_count (const char * mdesc, int * nwide)
 {
@@ -88,7 +87,17 @@ get_parm_count (const char * mdesc, int * nwide)
 
 		if (*mdesc == '(') continue;
 
-		if (*mdesc == '[') continue;
+		// arrays are references, whatever their element type
+		if (*mdesc == '[') {
+			while (*mdesc == '[') {
+				i++;
+				mdesc++;
+			}
+			if (*mdesc != 'L') {
+				count++;
+				continue;
+			}
+		}
 
 		if (*mdesc == 'L') {
 			while (*mdesc != ';') {
@@ -114,6 +123,10 @@ get_parm_count (const char * mdesc, int * nwide)
 }
 
 
+/*
+ * nargs here is the number of operands, i.e. longs and 
+ * doubles only count once
+ */
 static void
 copy_locals (jthread_t * t, int nargs, const char * mdesc, u1 type)
 {
@@ -134,7 +147,18 @@ copy_locals (jthread_t * t, int nargs, const char * mdesc, u1 type)
 
 		if (*mdesc == '(') continue;
 
-		if (*mdesc == '[') continue;
+		if (*mdesc == '[') {
+			while (*mdesc == '[') {
+				i++;
+				mdesc++;
+			}
+			if (*mdesc != 'L') {
+				t->cur_frame->locals[localcount] = prevop->oprs[prevop->sp - nargs + 1 + stackcount];
+				stackcount++;
+				localcount++;
+				continue;
+			}
+		}
 
 		if (*mdesc == 'L') {
 			while (*mdesc != ';') {
@@ -202,7 +226,7 @@ hb_setup_method_parms (jthread_t * t,
 	stack_frame_t * prev = t->cur_frame->prev;
 	op_stack_t * prevop  = prev->op_stack;
 	int i;
-	int nwide;
+	int nwide = 0;
 
 	int nargs = get_parm_count(mdesc, &nwide);
 
@@ -213,6 +237,9 @@ hb_setup_method_parms (jthread_t * t,
 		nargs++;
 	}
 
+	// longs and doubles take two locals, but one operand
+	nargs -= nwide;
+
 	ST_DEBUG("Prev op stack (bottom to top):\n");
 	for (i = 0; i < nargs; i++) {
 		ST_DEBUG("  [%p]\n", (void*)prevop->oprs[prevop->sp - nargs + i + 1].long_val);
@@ -330,7 +357,7 @@ int
 hb_push_ctor_frame (jthread_t * t,
 		    obj_ref_t * oref)
 {
-	native_obj_t * obj = (native_obj_t*)oref->heap_ptr;
+	native_obj_t * obj = oref;
 	java_class_t * cls = obj->class;
 	method_info_t * mi = NULL;
 
@@ -0,0 +1,890 @@
+/* 
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the 
+ * file "LICENSE.txt".
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <class.h>
+#include <constants.h>
+#include <stackmap.h>
+
+/*
+ * This builds the GC stack maps for a method by abstract
+ * interpretation of its bytecode. We only care whether a slot
+ * holds a reference or not, so the state at an instruction is a
+ * bit per local and operand stack slot. Where paths join, a slot
+ * is a reference only if it is one along every path (the verifier
+ * won't let a slot that isn't be used as a reference anyway).
+ *
+ * Note that this follows what *our* interpreter does with the
+ * operand stack: longs and doubles take up a single operand slot
+ * (but two locals).
+ *
+ * If we run into something we can't handle (e.g. jsr/ret), the
+ * method gets no map and the GC scans its frames conservatively.
+ *
+ */
+
+#define SM_REF 1
+#define SM_VAL 0
+
+struct sm_state {
+	u1 * locals;
+	u1 * stack;
+	u2 sp;
+};
+
+struct sm_ctx {
+	java_class_t * cls;
+	method_info_t * mi;
+	code_attr_t * code;
+
+	u2 nlocals;
+	u2 nstack;
+
+	u2 * work;
+	u4 work_len;
+	u1 * queued;
+};
+
+
+static inline void
+set_bit_to (u1 * bits, u4 slot, u1 val)
+{
+	if (val) {
+		bits[slot >> 3] |= (1 << (slot & 7));
+	} else {
+		bits[slot >> 3] &= ~(1 << (slot & 7));
+	}
+}
+
+
+static void
+load_state (struct sm_ctx * ctx, u2 pc, struct sm_state * st)
+{
+	u1 * bits = hb_stack_map_bits(ctx->mi, pc);
+	int i;
+
+	for (i = 0; i < ctx->nlocals; i++) {
+		st->locals[i] = hb_stack_map_is_ref(bits, i);
+	}
+
+	st->sp = ctx->mi->map_depth[pc];
+
+	for (i = 0; i < st->sp; i++) {
+		st->stack[i] = hb_stack_map_is_ref(bits, ctx->nlocals + i);
+	}
+}
+
+
+/*
+ * Merges a state into the map for the instruction at pc,
+ * and queues it up for (re)analysis if the map changed.
+ *
+ * @return: 0 on success, -1 if the stack depths don't agree
+ *
+ */
+static int
+merge_state (struct sm_ctx * ctx, u4 pc, struct sm_state * st)
+{
+	method_info_t * mi = ctx->mi;
+	u1 * bits = NULL;
+	int changed = 0;
+	int i;
+
+	if (pc >= ctx->code->code_len) {
+		HB_ERR("Branch target (%u) out of range in %s\n", pc, __func__);
+		return -1;
+	}
+
+	bits = hb_stack_map_bits(mi, pc);
+
+	if (mi->map_depth[pc] == SM_UNREACHED) {
+
+		mi->map_depth[pc] = st->sp;
+
+		for (i = 0; i < ctx->nlocals; i++) {
+			set_bit_to(bits, i, st->locals[i]);
+		}
+
+		for (i = 0; i < st->sp; i++) {
+			set_bit_to(bits, ctx->nlocals + i, st->stack[i]);
+		}
+
+		changed = 1;
+
+	} else {
+
+		if (mi->map_depth[pc] != st->sp) {
+			SM_DEBUG("Stack depth mismatch at pc %u (%u vs %u)\n", pc, mi->map_depth[pc], st->sp);
+			return -1;
+		}
+
+		for (i = 0; i < ctx->nlocals; i++) {
+			if (hb_stack_map_is_ref(bits, i) && !st->locals[i]) {
+				set_bit_to(bits, i, SM_VAL);
+				changed = 1;
+			}
+		}
+
+		for (i = 0; i < st->sp; i++) {
+			if (hb_stack_map_is_ref(bits, ctx->nlocals + i) && !st->stack[i]) {
+				set_bit_to(bits, ctx->nlocals + i, SM_VAL);
+				changed = 1;
+			}
+		}
+	}
+
+	if (changed && !ctx->queued[pc]) {
+		ctx->queued[pc] = 1;
+		ctx->work[ctx->work_len++] = pc;
+	}
+
+	return 0;
+}
+
+
+static inline int
+push (struct sm_ctx * ctx, struct sm_state * st, u1 val)
+{
+	if (st->sp >= ctx->nstack) {
+		SM_DEBUG("Operand stack overflow in %s\n", __func__);
+		return -1;
+	}
+
+	st->stack[st->sp++] = val;
+
+	return 0;
+}
+
+
+static inline int
+pop (struct sm_state * st, int n)
+{
+	if (st->sp < n) {
+		SM_DEBUG("Operand stack underflow in %s\n", __func__);
+		return -1;
+	}
+
+	st->sp -= n;
+
+	return 0;
+}
+
+
+static inline int
+store_local (struct sm_ctx * ctx, struct sm_state * st, u4 idx, u1 val, int wide)
+{
+	if (idx + wide >= ctx->nlocals) {
+		SM_DEBUG("Local %u out of range\n", idx);
+		return -1;
+	}
+
+	st->locals[idx] = val;
+
+	if (wide) {
+		st->locals[idx + 1] = SM_VAL;
+	}
+
+	return 0;
+}
+
+
+static inline int
+load_local (struct sm_ctx * ctx, struct sm_state * st, u4 idx)
+{
+	if (idx >= ctx->nlocals) {
+		SM_DEBUG("Local %u out of range\n", idx);
+		return -1;
+	}
+
+	return push(ctx, st, st->locals[idx]);
+}
+
+
+/*
+ * Counts the parameters in a method descriptor. Each one
+ * takes a single operand stack slot.
+ *
+ */
+static int
+desc_parm_count (const char * desc)
+{
+	int count = 0;
+
+	if (*desc++ != '(') {
+		return -1;
+	}
+
+	while (*desc && *desc != ')') {
+
+		while (*desc == '[') {
+			desc++;
+		}
+
+		if (*desc == 'L') {
+			while (*desc && *desc != ';') {
+				desc++;
+			}
+		}
+
+		if (!*desc) {
+			return -1;
+		}
+
+		desc++;
+		count++;
+	}
+
+	return count;
+}
+
+
+static inline u1
+desc_is_ref (const char * desc)
+{
+	return *desc == 'L' || *desc == '[';
+}
+
+
+/*
+ * Gets the descriptor for a field or method reference
+ * in the constant pool.
+ *
+ */
+static const char *
+ref_desc (java_class_t * cls, u2 idx)
+{
+	CONSTANT_Fieldref_info_t * ref = NULL;
+	CONSTANT_NameAndType_info_t * nt = NULL;
+
+	if (idx == 0 || idx >= cls->const_pool_count || IS_RESOLVED(cls->const_pool[idx])) {
+		return NULL;
+	}
+
+	// field, method and interface method refs all look the same
+	ref = (CONSTANT_Fieldref_info_t*)cls->const_pool[idx];
+
+	if (ref->name_and_type_idx >= cls->const_pool_count) {
+		return NULL;
+	}
+
+	nt = (CONSTANT_NameAndType_info_t*)cls->const_pool[ref->name_and_type_idx];
+
+	if (IS_RESOLVED(nt) || nt->tag != CONSTANT_NameAndType) {
+		return NULL;
+	}
+
+	return hb_get_const_str(nt->desc_idx, cls);
+}
+
+
+static int
+invoke (struct sm_ctx * ctx, struct sm_state * st, u2 idx, int has_this)
+{
+	const char * desc = ref_desc(ctx->cls, idx);
+	const char * ret  = NULL;
+	int nargs;
+
+	if (!desc || (nargs = desc_parm_count(desc)) < 0) {
+		return -1;
+	}
+
+	if (pop(st, nargs + has_this) != 0) {
+		return -1;
+	}
+
+	ret = strchr(desc, ')') + 1;
+
+	if (*ret == 'V') {
+		return 0;
+	}
+
+	return push(ctx, st, desc_is_ref(ret));
+}
+
+
+static inline u1
+ldc_is_ref (java_class_t * cls, u2 idx)
+{
+	u1 tag;
+
+	if (idx == 0 || idx >= cls->const_pool_count || IS_RESOLVED(cls->const_pool[idx])) {
+		return SM_VAL;
+	}
+
+	tag = cls->const_pool[idx]->tag;
+
+	return tag == CONSTANT_String || tag == CONSTANT_Class ||
+	       tag == CONSTANT_MethodType || tag == CONSTANT_MethodHandle;
+}
+
+
+#define GET_U2(p) ((u2)(((p)[0] << 8) | (p)[1]))
+#define GET_I2(p) ((i2)GET_U2(p))
+#define GET_I4(p) ((i4)(((u4)(p)[0] << 24) | ((u4)(p)[1] << 16) | ((u4)(p)[2] << 8) | (p)[3]))
+
+#define PUSH(v)     if (push(ctx, st, (v)) != 0) return -1
+#define POP(n)      if (pop(st, (n)) != 0) return -1
+#define BRANCH(off) if (merge_state(ctx, pc + (off), st) != 0) return -1
+
+/*
+ * Applies the instruction at pc to the state, and merges
+ * the result into the maps of its successors.
+ *
+ * @return: 0 on success, -1 if we can't map this method
+ *
+ */
+static int
+step (struct sm_ctx * ctx, u2 pc, struct sm_state * st)
+{
+	u1 * bc = &ctx->code->code[pc];
+	u1 op = bc[0];
+	u4 len = 1;
+	u1 a, b, c, d;
+
+	switch (op) {
+		case 0x00: // nop
+			break;
+		case 0x01: // aconst_null
+			PUSH(SM_REF);
+			break;
+		case 0x02 ... 0x0f: // iconst_*, lconst_*, fconst_*, dconst_*
+			PUSH(SM_VAL);
+			break;
+		case 0x10: // bipush
+			PUSH(SM_VAL);
+			len = 2;
+			break;
+		case 0x11: // sipush
+			PUSH(SM_VAL);
+			len = 3;
+			break;
+		case 0x12: // ldc
+			PUSH(ldc_is_ref(ctx->cls, bc[1]));
+			len = 2;
+			break;
+		case 0x13: // ldc_w
+			PUSH(ldc_is_ref(ctx->cls, GET_U2(&bc[1])));
+			len = 3;
+			break;
+		case 0x14: // ldc2_w
+			PUSH(SM_VAL);
+			len = 3;
+			break;
+		case 0x15 ... 0x18: // iload, lload, fload, dload
+			PUSH(SM_VAL);
+			len = 2;
+			break;
+		case 0x19: // aload
+			if (load_local(ctx, st, bc[1]) != 0) {
+				return -1;
+			}
+			len = 2;
+			break;
+		case 0x1a ... 0x29: // [ilfd]load_<n>
+			PUSH(SM_VAL);
+			break;
+		case 0x2a ... 0x2d: // aload_<n>
+			if (load_local(ctx, st, op - 0x2a) != 0) {
+				return -1;
+			}
+			break;
+		case 0x2e ... 0x35: // [ilfdabcs]aload
+			POP(2);
+			PUSH(op == 0x32 ? SM_REF : SM_VAL);
+			break;
+		case 0x36: // istore
+		case 0x38: // fstore
+		case 0x37: // lstore
+		case 0x39: // dstore
+			POP(1);
+			if (store_local(ctx, st, bc[1], SM_VAL, op == 0x37 || op == 0x39) != 0) {
+				return -1;
+			}
+			len = 2;
+			break;
+		case 0x3a: // astore
+			POP(1);
+			if (store_local(ctx, st, bc[1], st->stack[st->sp], 0) != 0) {
+				return -1;
+			}
+			len = 2;
+			break;
+		case 0x3b ... 0x4a: // [ilfd]store_<n>
+			POP(1);
+			a = (op - 0x3b) / 4;
+			if (store_local(ctx, st, (op - 0x3b) % 4, SM_VAL, a == 1 || a == 3) != 0) {
+				return -1;
+			}
+			break;
+		case 0x4b ... 0x4e: // astore_<n>
+			POP(1);
+			if (store_local(ctx, st, op - 0x4b, st->stack[st->sp], 0) != 0) {
+				return -1;
+			}
+			break;
+		case 0x4f ... 0x56: // [ilfdabcs]astore
+			POP(3);
+			break;
+		case 0x57: // pop
+			POP(1);
+			break;
+		case 0x58: // pop2
+			POP(2);
+			break;
+		case 0x59: // dup
+			POP(1);
+			a = st->stack[st->sp];
+			PUSH(a); PUSH(a);
+			break;
+		case 0x5a: // dup_x1
+			POP(2);
+			a = st->stack[st->sp]; b = st->stack[st->sp + 1];
+			PUSH(b); PUSH(a); PUSH(b);
+			break;
+		case 0x5b: // dup_x2
+			POP(3);
+			a = st->stack[st->sp]; b = st->stack[st->sp + 1]; c = st->stack[st->sp + 2];
+			PUSH(c); PUSH(a); PUSH(b); PUSH(c);
+			break;
+		case 0x5c: // dup2
+			POP(2);
+			a = st->stack[st->sp]; b = st->stack[st->sp + 1];
+			PUSH(a); PUSH(b); PUSH(a); PUSH(b);
+			break;
+		case 0x5d: // dup2_x1
+			POP(3);
+			a = st->stack[st->sp]; b = st->stack[st->sp + 1]; c = st->stack[st->sp + 2];
+			PUSH(b); PUSH(c); PUSH(a); PUSH(b); PUSH(c);
+			break;
+		case 0x5e: // dup2_x2
+			POP(4);
+			a = st->stack[st->sp]; b = st->stack[st->sp + 1];
+			c = st->stack[st->sp + 2]; d = st->stack[st->sp + 3];
+			PUSH(c); PUSH(d); PUSH(a); PUSH(b); PUSH(c); PUSH(d);
+			break;
+		case 0x5f: // swap
+			POP(2);
+			a = st->stack[st->sp]; b = st->stack[st->sp + 1];
+			PUSH(b); PUSH(a);
+			break;
+		case 0x60 ... 0x73: // add, sub, mul, div, rem
+		case 0x78 ... 0x83: // shifts, and, or, xor
+		case 0x94 ... 0x98: // lcmp, [fd]cmp[lg]
+			POP(2);
+			PUSH(SM_VAL);
+			break;
+		case 0x74 ... 0x77: // neg
+		case 0x85 ... 0x93: // conversions
+			POP(1);
+			PUSH(SM_VAL);
+			break;
+		case 0x84: // iinc
+			len = 3;
+			break;
+		case 0x99 ... 0x9e: // if<cond>
+		case 0xc6: // ifnull
+		case 0xc7: // ifnonnull
+			POP(1);
+			BRANCH(GET_I2(&bc[1]));
+			len = 3;
+			break;
+		case 0x9f ... 0xa6: // if_[ia]cmp<cond>
+			POP(2);
+			BRANCH(GET_I2(&bc[1]));
+			len = 3;
+			break;
+		case 0xa7: // goto
+			BRANCH(GET_I2(&bc[1]));
+			return 0;
+		case 0xc8: // goto_w
+			BRANCH(GET_I4(&bc[1]));
+			return 0;
+		case 0xaa: { // tableswitch
+			u1 * p = &bc[4 - (pc & 3)];
+			i4 lo, hi, i;
+
+			POP(1);
+
+			lo = GET_I4(&p[4]);
+			hi = GET_I4(&p[8]);
+
+			if (hi < lo) {
+				return -1;
+			}
+
+			BRANCH(GET_I4(p));
+
+			for (i = 0; i <= hi - lo; i++) {
+				BRANCH(GET_I4(&p[12 + i*4]));
+			}
+
+			return 0;
+		}
+		case 0xab: { // lookupswitch
+			u1 * p = &bc[4 - (pc & 3)];
+			i4 npairs, i;
+
+			POP(1);
+
+			npairs = GET_I4(&p[4]);
+
+			BRANCH(GET_I4(p));
+
+			for (i = 0; i < npairs; i++) {
+				BRANCH(GET_I4(&p[8 + i*8 + 4]));
+			}
+
+			return 0;
+		}
+		case 0xac ... 0xb1: // [ilfda]return, return
+		case 0xbf: // athrow
+			return 0;
+		case 0xb2: { // getstatic
+			const char * desc = ref_desc(ctx->cls, GET_U2(&bc[1]));
+			if (!desc) {
+				return -1;
+			}
+			PUSH(desc_is_ref(desc));
+			len = 3;
+			break;
+		}
+		case 0xb3: // putstatic
+			POP(1);
+			len = 3;
+			break;
+		case 0xb4: { // getfield
+			const char * desc = ref_desc(ctx->cls, GET_U2(&bc[1]));
+			if (!desc) {
+				return -1;
+			}
+			POP(1);
+			PUSH(desc_is_ref(desc));
+			len = 3;
+			break;
+		}
+		case 0xb5: // putfield
+			POP(2);
+			len = 3;
+			break;
+		case 0xb6: // invokevirtual
+		case 0xb7: // invokespecial
+		case 0xb8: // invokestatic
+			if (invoke(ctx, st, GET_U2(&bc[1]), op != 0xb8) != 0) {
+				return -1;
+			}
+			len = 3;
+			break;
+		case 0xb9: // invokeinterface
+			if (invoke(ctx, st, GET_U2(&bc[1]), 1) != 0) {
+				return -1;
+			}
+			len = 5;
+			break;
+		case 0xbb: // new
+			PUSH(SM_REF);
+			len = 3;
+			break;
+		case 0xbc: // newarray
+			POP(1);
+			PUSH(SM_REF);
+			len = 2;
+			break;
+		case 0xbd: // anewarray
+			POP(1);
+			PUSH(SM_REF);
+			len = 3;
+			break;
+		case 0xbe: // arraylength
+			POP(1);
+			PUSH(SM_VAL);
+			break;
+		case 0xc0: // checkcast
+			len = 3;
+			break;
+		case 0xc1: // instanceof
+			POP(1);
+			PUSH(SM_VAL);
+			len = 3;
+			break;
+		case 0xc2: // monitorenter
+		case 0xc3: // monitorexit
+			POP(1);
+			break;
+		case 0xc4: // wide
+			switch (bc[1]) {
+				case 0x15 ... 0x18: // [ilfd]load
+					PUSH(SM_VAL);
+					break;
+				case 0x19: // aload
+					if (load_local(ctx, st, GET_U2(&bc[2])) != 0) {
+						return -1;
+					}
+					break;
+				case 0x36 ... 0x39: // [ilfd]store
+					POP(1);
+					if (store_local(ctx, st, GET_U2(&bc[2]), SM_VAL, bc[1] == 0x37 || bc[1] == 0x39) != 0) {
+						return -1;
+					}
+					break;
+				case 0x3a: // astore
+					POP(1);
+					if (store_local(ctx, st, GET_U2(&bc[2]), st->stack[st->sp], 0) != 0) {
+						return -1;
+					}
+					break;
+				case 0x84: // iinc
+					len = 6;
+					break;
+				default:
+					return -1;
+			}
+			if (len == 1) {
+				len = 4;
+			}
+			break;
+		case 0xc5: // multianewarray
+			POP(bc[3]);
+			PUSH(SM_REF);
+			len = 4;
+			break;
+		default:
+			// jsr, ret, invokedynamic, and anything bogus
+			SM_DEBUG("Can't map opcode 0x%02x at pc %u\n", op, pc);
+			return -1;
+	}
+
+	// fall through to the next instruction
+	return merge_state(ctx, pc + len, st);
+}
+
+
+/*
+ * Anything in a try block can end up in its handler,
+ * with the locals as they were before or after any of
+ * the instructions in the block, and just the exception
+ * on the operand stack.
+ *
+ */
+static int
+merge_handlers (struct sm_ctx * ctx, u2 pc, struct sm_state * st)
+{
+	code_attr_t * code = ctx->code;
+	int i;
+
+	if (code->excp_table_len > 0 && ctx->nstack == 0) {
+		return -1;
+	}
+
+	for (i = 0; i < code->excp_table_len; i++) {
+		excp_table_t * e = &code->excp_table[i];
+		u2 sp = st->sp;
+		u1 top = st->stack[0];
+
+		if (pc < e->start_pc || pc >= e->end_pc) {
+			continue;
+		}
+
+		st->sp = 1;
+		st->stack[0] = SM_REF;
+
+		if (merge_state(ctx, e->handler_pc, st) != 0) {
+			return -1;
+		}
+
+		st->stack[0] = top;
+		st->sp = sp;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Sets up the locals on entry to a method, from
+ * its descriptor.
+ *
+ */
+static int
+entry_state (struct sm_ctx * ctx, struct sm_state * st)
+{
+	const char * desc = hb_get_const_str(ctx->mi->desc_idx, ctx->cls);
+	u4 l = 0;
+
+	memset(st->locals, SM_VAL, ctx->nlocals);
+	st->sp = 0;
+
+	if (!desc || *desc++ != '(') {
+		return -1;
+	}
+
+	if (!(ctx->mi->acc_flags & ACC_STATIC)) {
+		if (store_local(ctx, st, l++, SM_REF, 0) != 0) {
+			return -1;
+		}
+	}
+
+	while (*desc && *desc != ')') {
+		u1 ref  = desc_is_ref(desc);
+		int wide = (*desc == 'J' || *desc == 'D');
+
+		while (*desc == '[') {
+			desc++;
+		}
+
+		if (*desc == 'L') {
+			while (*desc && *desc != ';') {
+				desc++;
+			}
+		}
+
+		if (!*desc || store_local(ctx, st, l, ref, wide) != 0) {
+			return -1;
+		}
+
+		l += 1 + wide;
+		desc++;
+	}
+
+	return 0;
+}
+
+
+static int
+build_method_map (java_class_t * cls, method_info_t * mi)
+{
+	code_attr_t * code = mi->code_attr;
+	struct sm_state st, post;
+	struct sm_ctx ctx;
+	int ret = -1;
+	u4 i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&st, 0, sizeof(st));
+	memset(&post, 0, sizeof(post));
+
+	ctx.cls     = cls;
+	ctx.mi      = mi;
+	ctx.code    = code;
+	ctx.nlocals = code->max_locals;
+	ctx.nstack  = code->max_stack;
+
+	mi->map_stride = (ctx.nlocals + ctx.nstack + 7) / 8;
+
+	if (mi->map_stride == 0) {
+		mi->map_stride = 1;
+	}
+
+	mi->map_depth = hb_meta_alloc(&cls->meta, sizeof(u2) * code->code_len);
+	mi->map_bits  = hb_meta_alloc(&cls->meta, (u8)code->code_len * mi->map_stride);
+	ctx.work      = malloc(sizeof(u2) * code->code_len);
+	ctx.queued    = calloc(code->code_len, 1);
+	st.locals     = malloc(ctx.nlocals + 1);
+	st.stack      = malloc(ctx.nstack + 1);
+	post.locals   = malloc(ctx.nlocals + 1);
+	post.stack    = malloc(ctx.nstack + 1);
+
+	if (!mi->map_depth || !mi->map_bits || !ctx.work || !ctx.queued ||
+	    !st.locals || !st.stack || !post.locals || !post.stack) {
+		HB_ERR("Could not allocate stack map in %s\n", __func__);
+		goto out;
+	}
+
+	for (i = 0; i < code->code_len; i++) {
+		mi->map_depth[i] = SM_UNREACHED;
+	}
+
+	if (entry_state(&ctx, &st) != 0 || merge_state(&ctx, 0, &st) != 0) {
+		goto out;
+	}
+
+	while (ctx.work_len > 0) {
+		u2 pc = ctx.work[--ctx.work_len];
+
+		ctx.queued[pc] = 0;
+
+		load_state(&ctx, pc, &st);
+
+		// handlers see the locals from before...
+		if (merge_handlers(&ctx, pc, &st) != 0) {
+			goto out;
+		}
+
+		memcpy(post.locals, st.locals, ctx.nlocals);
+		memcpy(post.stack, st.stack, st.sp);
+		post.sp = st.sp;
+
+		if (step(&ctx, pc, &post) != 0) {
+			goto out;
+		}
+
+		// ...and after the instruction
+		if (merge_handlers(&ctx, pc, &post) != 0) {
+			goto out;
+		}
+	}
+
+	ret = 0;
+
+out:
+	free(ctx.work);
+	free(ctx.queued);
+	free(st.locals);
+	free(st.stack);
+	free(post.locals);
+	free(post.stack);
+
+	// the maps stay in the class's metaspace either way
+	if (ret != 0) {
+		mi->map_depth = NULL;
+		mi->map_bits  = NULL;
+	}
+
+	return ret;
+}
+
+
+/*
+ * Builds the GC stack maps for all the methods of a
+ * class. A method we can't map just doesn't get one, so
+ * this never fails.
+ *
+ * @return: the number of methods we couldn't map
+ *
+ */
+int
+hb_build_stack_maps (java_class_t * cls)
+{
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < cls->methods_count; i++) {
+		method_info_t * mi = &cls->methods[i];
+
+		if (!mi->code_attr || mi->code_attr->code_len == 0) {
+			continue;
+		}
+
+		if (build_method_map(cls, mi) != 0) {
+			SM_DEBUG("No stack map for %s%s in %s\n",
+				hb_get_const_str(mi->name_idx, cls),
+				hb_get_const_str(mi->desc_idx, cls),
+				hb_get_class_name(cls));
+			failed++;
+		}
+	}
+
+	return failed;
+}
@@ -0,0 +1,168 @@
+/* 
+ * This file is part of the Hawkbeans JVM developed by
+ * the HExSA Lab at Illinois Institute of Technology.
+ *
+ * Copyright (c) 2017, Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * All rights reserved.
+ *
+ * Author: Kyle C. Hale <khale@cs.iit.edu>
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the 
+ * file "LICENSE.txt".
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <hawkbeans.h>
+#include <symbol.h>
+#include <hashtable.h>
+
+/*
+ * The symbol table is a chained hashtable whose entries
+ * (symbols) are bump-allocated out of a metaspace of their own.
+ * Symbols are never freed. Loader threads intern concurrently,
+ * so everything happens under one lock; interning is only done
+ * when a class is loaded or for the odd name given as a C
+ * string, so it's not worth anything fancier.
+ */
+static struct {
+	pthread_mutex_t lock;
+	hb_symbol_t ** buckets;
+	u4 size; // power of 2
+	u4 count;
+	metaspace_t meta;
+} symtab = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+const char * hb_sym_ctor;
+const char * hb_sym_string;
+
+
+static int
+grow_symtab (void)
+{
+	hb_symbol_t ** buckets = NULL;
+	u4 size = symtab.size * 2;
+	u4 i;
+
+	buckets = calloc(size, sizeof(hb_symbol_t*));
+
+	if (!buckets) {
+		HB_ERR("Could not grow symbol table\n");
+		return -1;
+	}
+
+	for (i = 0; i < symtab.size; i++) {
+		hb_symbol_t * s = symtab.buckets[i];
+
+		while (s) {
+			hb_symbol_t * next = s->next;
+			s->next = buckets[s->hash & (size - 1)];
+			buckets[s->hash & (size - 1)] = s;
+			s = next;
+		}
+	}
+
+	free(symtab.buckets);
+
+	symtab.buckets = buckets;
+	symtab.size    = size;
+
+	return 0;
+}
+
+
+/*
+ * Interns the len bytes at str (which need not be
+ * NUL-terminated).
+ *
+ * @return: the symbol, NULL on error
+ *
+ */
+const char *
+hb_intern (const char * str, u2 len)
+{
+	u4 hash = nk_hash_buffer((unsigned char*)str, len);
+	hb_symbol_t * s = NULL;
+
+	pthread_mutex_lock(&symtab.lock);
+
+	for (s = symtab.buckets[hash & (symtab.size - 1)]; s; s = s->next) {
+		if (s->hash == hash && s->len == len && memcmp(s->bytes, str, len) == 0) {
+			goto out;
+		}
+	}
+
+	if (symtab.count >= symtab.size && grow_symtab() != 0) {
+		goto out;
+	}
+
+	s = hb_meta_alloc(&symtab.meta, sizeof(hb_symbol_t) + len + 1);
+
+	if (!s) {
+		HB_ERR("Could not allocate symbol\n");
+		goto out;
+	}
+
+	s->hash = hash;
+	s->len  = len;
+	memcpy(s->bytes, str, len);
+
+	s->next = symtab.buckets[hash & (symtab.size - 1)];
+	symtab.buckets[hash & (symtab.size - 1)] = s;
+	symtab.count++;
+
+out:
+	pthread_mutex_unlock(&symtab.lock);
+	return s ? s->bytes : NULL;
+}
+
+
+const char *
+hb_intern_str (const char * str)
+{
+	return hb_intern(str, strlen(str));
+}
+
+
+u4
+hb_symtab_count (void)
+{
+	return symtab.count;
+}
+
+
+const metaspace_t *
+hb_symtab_meta (void)
+{
+	return &symtab.meta;
+}
+
+
+/* 
+ * Initializes the global symbol table.
+ *
+ * @return: 0 on success, -1 otherwise
+ *
+ */
+int
+hb_symtab_init (void)
+{
+	symtab.buckets = calloc(HB_SYMTAB_INIT_SIZE, sizeof(hb_symbol_t*));
+
+	if (!symtab.buckets) {
+		HB_ERR("Could not create symbol table\n");
+		return -1;
+	}
+
+	symtab.size = HB_SYMTAB_INIT_SIZE;
+
+	hb_sym_ctor   = hb_intern_str("<init>");
+	hb_sym_string = hb_intern_str("java/lang/String");
+
+	return (hb_sym_ctor && hb_sym_string) ? 0 : -1;
+}
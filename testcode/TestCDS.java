@@ -0,0 +1,52 @@
+/* TestCDS.java
+ *
+ * touches a handful of classes so that a class data sharing
+ * archive has something in it. Dump an archive, then load
+ * it, and check the two runs print the same thing:
+ *
+ *   hawkbeans --dump-cds test.jsa TestCDS.class > dump.out
+ *   hawkbeans --cds test.jsa TestCDS.class > load.out
+ *   diff dump.out load.out
+ */
+
+class CDSShape
+{
+	static String kind = "shape";
+
+	public int area () {
+		return 0;
+	}
+}
+
+class CDSSquare extends CDSShape
+{
+	int side;
+
+	CDSSquare (int side) {
+		this.side = side;
+	}
+
+	public int area () {
+		return side * side;
+	}
+}
+
+public class TestCDS
+{
+	public static void main (String[] args) {
+		CDSShape[] shapes = new CDSShape[3];
+		int total = 0;
+		int i;
+
+		shapes[0] = new CDSShape();
+		shapes[1] = new CDSSquare(3);
+		shapes[2] = new CDSSquare(5);
+
+		for (i = 0; i < shapes.length; i++)
+			total += shapes[i].area();
+
+		System.out.println(CDSShape.kind);
+		System.out.println(total);
+		System.out.println("CDS round trip");
+	}
+}
@@ -0,0 +1,35 @@
+/* TestClasspath.java
+ *
+ * loads a helper class from a jar on the classpath. Build
+ * and run it with:
+ *
+ *   javac TestClasspath.java
+ *   jar cf helper.jar ClasspathHelper.class
+ *   rm ClasspathHelper.class
+ *   hawkbeans --classpath helper.jar:. TestClasspath.class
+ *
+ * (keep the jar holding the Java library on the classpath
+ * too, if the library isn't in the current directory)
+ */
+
+class ClasspathHelper
+{
+	static int loads = 0;
+
+	static {
+		loads++;
+	}
+
+	public static int square (int x) {
+		return x * x;
+	}
+}
+
+public class TestClasspath
+{
+	public static void main (String[] args) {
+		System.out.println(ClasspathHelper.square(12));
+		System.out.println(ClasspathHelper.square(7));
+		System.out.println(ClasspathHelper.loads);
+	}
+}
@@ -0,0 +1,54 @@
+/* TestLongArrays.java
+ *
+ * Arrays longer than 511 elements, arrays big enough to
+ * land in the large object space, and arrays too big to
+ * allocate at all (these should throw OutOfMemoryError)
+ */
+
+public class TestLongArrays
+{
+	public static void main (String[] args) {
+		int[] ints = new int[4096];
+		long[] longs = new long[1000];
+		Object[] objs = new Object[600];
+		int i;
+
+		for (i = 0; i < ints.length; i++)
+			ints[i] = i;
+		for (i = 0; i < longs.length; i++)
+			longs[i] = (long)i << 32;
+		for (i = 0; i < objs.length; i++)
+			objs[i] = ints;
+
+		System.out.println(ints.length);
+		System.out.println(longs.length);
+		System.out.println(objs.length);
+
+		if (ints[4095] == 4095 && longs[999] == (999L << 32) && objs[599] == ints)
+			System.out.println("Long arrays OK");
+
+		/* 4MB, well past the large object threshold */
+		byte[] big = new byte[4 * 1024 * 1024];
+		big[big.length - 1] = 42;
+		System.out.println(big.length);
+		System.out.println(big[big.length - 1]);
+
+		try {
+			int[] huge = new int[0x40000000];
+			System.out.println("Allocated " + huge.length + " ints");
+		} catch (OutOfMemoryError e) {
+			System.out.println("Caught OOM");
+		}
+
+		try {
+			long[] huge = new long[Integer.MAX_VALUE];
+			System.out.println("Allocated " + huge.length + " longs");
+		} catch (OutOfMemoryError e) {
+			System.out.println("Caught OOM");
+		}
+
+		/* the heap should still be usable afterwards */
+		ints = new int[1024];
+		System.out.println(ints.length);
+	}
+}